@@ -0,0 +1,158 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Lock-free free-list in front of a kmem_cache.
+ *
+ * Freed objects are pushed onto an llist instead of going back to the
+ * slab. llist_add() is a single cmpxchg, so llfree_free() works from any
+ * context, IRQ and NMI included, on any CPU. Allocations take the whole
+ * list at once with llist_del_all() into a per-CPU batch and pop from
+ * that batch without atomics until it runs dry; only then, and only if
+ * no frees are pending, do they fall back to the slab.
+ *
+ * The llist_node lives in the first bytes of a free object, so objects
+ * must be at least a pointer in size. A recycled object has had those
+ * bytes overwritten: with a constructor it is run again before the
+ * object is handed out, which keeps the slab's "constructed on alloc"
+ * promise.
+ *
+ * Objects are never given back to the slab until llfree_destroy(); the
+ * pool holds the peak number of objects ever in use plus whatever sits
+ * in other CPUs' batches.
+ *
+ * llfree_alloc() disables preemption around the batch and must be called
+ * from task context; llfree_free() has no such restriction.
+ *
+ * Usage:
+ *	llfree_init(&lf, cache, ctor);
+ *	p = llfree_alloc(&lf, GFP_KERNEL);
+ *	llfree_free(&lf, p);
+ *	llfree_destroy(&lf);		(before kmem_cache_destroy())
+ */
+#ifndef _MM_LLFREE_H
+#define _MM_LLFREE_H
+
+#include <linux/kernel.h>
+#include <linux/llist.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+
+struct llfree_pcpu {
+	struct llist_node *batch;	/* taken from free, owned by this CPU */
+	u64 hits;			/* allocations served from the list */
+	u64 misses;			/* allocations that went to the slab */
+};
+
+struct llfree {
+	struct kmem_cache *cache;
+	void (*ctor)(void *);
+	struct llist_head free;		/* pushed by llfree_free() */
+	struct llfree_pcpu __percpu *pcpu;
+};
+
+static inline int llfree_init(struct llfree *lf, struct kmem_cache *cache,
+			      void (*ctor)(void *))
+{
+	lf->cache = cache;
+	lf->ctor = ctor;
+	init_llist_head(&lf->free);
+	lf->pcpu = alloc_percpu(struct llfree_pcpu);
+	return lf->pcpu ? 0 : -ENOMEM;
+}
+
+static inline void *llfree_alloc(struct llfree *lf, gfp_t gfp)
+{
+	struct llfree_pcpu *pc = get_cpu_ptr(lf->pcpu);
+	struct llist_node *node = pc->batch;
+
+	if (!node)
+		node = llist_del_all(&lf->free);
+	if (node) {
+		pc->batch = node->next;
+		pc->hits++;
+		put_cpu_ptr(lf->pcpu);
+		if (lf->ctor)
+			lf->ctor(node);
+		return node;
+	}
+	pc->misses++;
+	put_cpu_ptr(lf->pcpu);
+	return kmem_cache_alloc(lf->cache, gfp);
+}
+
+static inline void llfree_free(struct llfree *lf, void *obj)
+{
+	llist_add(obj, &lf->free);
+}
+
+static inline void llfree_stats(struct llfree *lf, u64 *hits, u64 *misses)
+{
+	struct llfree_pcpu *pc;
+	int cpu;
+
+	*hits = *misses = 0;
+	for_each_possible_cpu(cpu) {
+		pc = per_cpu_ptr(lf->pcpu, cpu);
+		*hits += pc->hits;
+		*misses += pc->misses;
+	}
+}
+
+static inline void llfree_release(struct llfree *lf, struct llist_node *node)
+{
+	struct llist_node *next;
+
+	for (; node; node = next) {
+		next = node->next;
+		/* the slab expects constructed objects back */
+		if (lf->ctor)
+			lf->ctor(node);
+		kmem_cache_free(lf->cache, node);
+	}
+}
+
+/* give every pooled object back to the slab; no users may remain */
+static inline void llfree_destroy(struct llfree *lf)
+{
+	struct llfree_pcpu *pc;
+	int cpu;
+
+	if (!lf->pcpu)
+		return;
+	llfree_release(lf, llist_del_all(&lf->free));
+	for_each_possible_cpu(cpu) {
+		pc = per_cpu_ptr(lf->pcpu, cpu);
+		llfree_release(lf, pc->batch);
+		pc->batch = NULL;
+	}
+	free_percpu(lf->pcpu);
+	lf->pcpu = NULL;
+}
+
+#endif /* _MM_LLFREE_H */
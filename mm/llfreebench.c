@@ -0,0 +1,336 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * alloc/free pair cost: bare slab vs the llist free-list of llfree.h
+ *
+ * An allocator thread pinned to cpu_a takes batch objects of the
+ * drv_priv layout of mycache.c and gets them freed again, loops times
+ * in total, in one of three patterns:
+ *
+ *   local	the allocator frees them itself
+ *   remote	they are handed to a thread on cpu_b, which frees them
+ *   irq	they are freed from a hard irq_work raised on cpu_b
+ *
+ * The cache has no constructor here, so both backends pay for the
+ * allocator only. At most 4 * batch objects are in flight. Results are
+ * printed at insmod time:
+ *
+ *   insmod llfreebench.ko cpu_a=2 cpu_b=3 loops=2000000
+ *   dmesg | grep LLFREEBENCH
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/completion.h>
+#include <linux/irq_work.h>
+#include <linux/llist.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+
+#include "llfree.h"
+
+#define MODNAME "[LLFREEBENCH] "
+
+static char *backend = "all";
+module_param(backend, charp, 0444);
+MODULE_PARM_DESC(backend, "all, slab or llfree");
+
+static char *pattern = "all";
+module_param(pattern, charp, 0444);
+MODULE_PARM_DESC(pattern, "all, local, remote or irq");
+
+static int loops = 1000000;
+module_param(loops, int, 0444);
+MODULE_PARM_DESC(loops, "alloc/free pairs per run");
+
+static int batch = 32;
+module_param(batch, int, 0444);
+MODULE_PARM_DESC(batch, "Objects allocated before they are freed");
+
+static int cpu_a = -1;
+module_param(cpu_a, int, 0444);
+MODULE_PARM_DESC(cpu_a, "Allocating CPU (-1 = first online CPU)");
+
+static int cpu_b = -1;
+module_param(cpu_b, int, 0444);
+MODULE_PARM_DESC(cpu_b, "Freeing CPU for remote and irq (-1 = second online CPU)");
+
+/* same layout as drv_priv in mycache.c */
+struct lb_obj {
+	u32 devid;
+	s8 *name;
+	u16 irq;
+};
+
+enum { LB_SLAB, LB_LLFREE, LB_NR_BACKENDS };
+enum { LB_LOCAL, LB_REMOTE, LB_IRQ, LB_NR_PATTERNS };
+
+static const char * const lb_backend_names[LB_NR_BACKENDS] = {
+	[LB_SLAB]	= "slab",
+	[LB_LLFREE]	= "llfree",
+};
+
+static const char * const lb_pattern_names[LB_NR_PATTERNS] = {
+	[LB_LOCAL]	= "local",
+	[LB_REMOTE]	= "remote",
+	[LB_IRQ]	= "irq",
+};
+
+static struct kmem_cache *lb_cache;
+static struct llfree lb_pool;
+static int lb_backend, lb_pattern;
+static void **lb_objs;
+static LLIST_HEAD(lb_handoff);		/* allocated, waiting to be freed */
+static atomic_t lb_inflight;
+static u64 lb_ns;
+static DECLARE_COMPLETION(lb_done);
+
+static void *lb_alloc(void)
+{
+	if (lb_backend == LB_LLFREE)
+		return llfree_alloc(&lb_pool, GFP_KERNEL);
+	return kmem_cache_alloc(lb_cache, GFP_KERNEL);
+}
+
+static void lb_free(void *obj)
+{
+	if (lb_backend == LB_LLFREE)
+		llfree_free(&lb_pool, obj);
+	else
+		kmem_cache_free(lb_cache, obj);
+}
+
+/* free everything handed off so far, on the freeing CPU */
+static void lb_drain(void)
+{
+	struct llist_node *node, *next;
+	int n = 0;
+
+	llist_for_each_safe(node, next, llist_del_all(&lb_handoff)) {
+		lb_free(node);
+		n++;
+	}
+	atomic_sub(n, &lb_inflight);
+}
+
+static void lb_irq_fn(struct irq_work *work)
+{
+	lb_drain();
+}
+
+static struct irq_work lb_irq_work = IRQ_WORK_INIT_HARD(lb_irq_fn);
+
+static int lb_freer(void *arg)
+{
+	while (!kthread_should_stop()) {
+		if (llist_empty(&lb_handoff)) {
+			cond_resched();
+			cpu_relax();
+			continue;
+		}
+		lb_drain();
+	}
+	return 0;
+}
+
+static int lb_allocer(void *arg)
+{
+	u64 t0 = ktime_get_ns();
+	int done, i, n;
+
+	for (done = 0; done < loops; done += n) {
+		n = min(batch, loops - done);
+		while (atomic_read(&lb_inflight) > 3 * batch)
+			cond_resched();
+		for (i = 0; i < n; i++) {
+			lb_objs[i] = lb_alloc();
+			if (!lb_objs[i])
+				break;
+		}
+		n = i;
+		if (!n)
+			break;
+		if (lb_pattern == LB_LOCAL) {
+			for (i = 0; i < n; i++)
+				lb_free(lb_objs[i]);
+			continue;
+		}
+		atomic_add(n, &lb_inflight);
+		for (i = 0; i < n; i++)
+			llist_add(lb_objs[i], &lb_handoff);
+		if (lb_pattern == LB_IRQ)
+			irq_work_queue_on(&lb_irq_work, cpu_b);
+	}
+	while (atomic_read(&lb_inflight)) {
+		if (lb_pattern == LB_IRQ)
+			irq_work_queue_on(&lb_irq_work, cpu_b);
+		cond_resched();
+	}
+	lb_ns = ktime_get_ns() - t0;
+	complete(&lb_done);
+	return 0;
+}
+
+static struct task_struct *lb_start(int (*fn)(void *), const char *name,
+				    int cpu)
+{
+	struct task_struct *t;
+
+	t = kthread_create_on_node(fn, NULL, cpu_to_node(cpu), "%s/%d",
+				   name, cpu);
+	if (!IS_ERR(t)) {
+		kthread_bind(t, cpu);
+		wake_up_process(t);
+	}
+	return t;
+}
+
+static int lb_run(int b, int p)
+{
+	struct task_struct *allocer, *freer = NULL;
+	u64 hits = 0, misses = 0;
+	int ret;
+
+	lb_backend = b;
+	lb_pattern = p;
+	atomic_set(&lb_inflight, 0);
+	reinit_completion(&lb_done);
+	if (b == LB_LLFREE) {
+		ret = llfree_init(&lb_pool, lb_cache, NULL);
+		if (ret)
+			return ret;
+	}
+
+	if (p == LB_REMOTE) {
+		freer = lb_start(lb_freer, "llfreebench-f", cpu_b);
+		if (IS_ERR(freer)) {
+			ret = PTR_ERR(freer);
+			goto fail;
+		}
+	}
+	allocer = lb_start(lb_allocer, "llfreebench-a", cpu_a);
+	if (IS_ERR(allocer)) {
+		ret = PTR_ERR(allocer);
+		if (freer)
+			kthread_stop(freer);
+		goto fail;
+	}
+
+	/* the allocator exits on its own once everything is freed */
+	wait_for_completion(&lb_done);
+	if (freer)
+		kthread_stop(freer);
+	irq_work_sync(&lb_irq_work);
+
+	if (b == LB_LLFREE) {
+		llfree_stats(&lb_pool, &hits, &misses);
+		llfree_destroy(&lb_pool);
+	}
+	pr_info(MODNAME "%-8s %-8s %8llu ns/pair %12llu %12llu\n",
+		lb_backend_names[b], lb_pattern_names[p],
+		div64_u64(lb_ns, loops), hits, misses);
+	return 0;
+fail:
+	pr_err("%s: unable to start kernel thread\n", __func__);
+	if (b == LB_LLFREE)
+		llfree_destroy(&lb_pool);
+	return ret;
+}
+
+static bool lb_cpu_ok(int cpu)
+{
+	return cpu >= 0 && cpu < nr_cpu_ids && cpu_online(cpu);
+}
+
+static int __init lb_init(void)
+{
+	int b, p, cpu, ret = 0;
+
+	if (!lb_cpu_ok(cpu_a))
+		cpu_a = cpumask_first(cpu_online_mask);
+	if (!lb_cpu_ok(cpu_b)) {
+		cpu_b = cpu_a;
+		for_each_online_cpu(cpu) {
+			if (cpu != cpu_a) {
+				cpu_b = cpu;
+				break;
+			}
+		}
+	}
+	if (loops <= 0)
+		loops = 1;
+	if (batch <= 0)
+		batch = 1;
+
+	lb_cache = kmem_cache_create("llfreebench", sizeof(struct lb_obj), 0,
+				     SLAB_HWCACHE_ALIGN, NULL);
+	if (!lb_cache)
+		return -ENOMEM;
+	lb_objs = kmalloc_array(batch, sizeof(*lb_objs), GFP_KERNEL);
+	if (!lb_objs) {
+		kmem_cache_destroy(lb_cache);
+		return -ENOMEM;
+	}
+
+	pr_info(MODNAME "cpu_a %d cpu_b %d loops %d batch %d\n", cpu_a, cpu_b,
+		loops, batch);
+	pr_info(MODNAME "%-8s %-8s %16s %12s %12s\n", "backend", "pattern",
+		"cost", "list_hits", "slab_misses");
+	for (b = 0; b < LB_NR_BACKENDS && !ret; b++) {
+		if (strcmp(backend, "all") && strcmp(backend, lb_backend_names[b]))
+			continue;
+		for (p = 0; p < LB_NR_PATTERNS && !ret; p++) {
+			if (strcmp(pattern, "all") &&
+			    strcmp(pattern, lb_pattern_names[p]))
+				continue;
+			ret = lb_run(b, p);
+		}
+	}
+
+	kfree(lb_objs);
+	kmem_cache_destroy(lb_cache);
+	return ret;
+}
+
+static void __exit lb_exit(void)
+{
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(lb_init);
+module_exit(lb_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("alloc/free pair cost of kmem_cache vs an llist free-list");
+MODULE_LICENSE("Dual MIT/GPL");
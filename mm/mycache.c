@@ -35,10 +35,13 @@
 #include<linux/types.h>
 #include <asm/atomic.h>
 
+#include "llfree.h"
+
 #define SUCCESS 0
 #define DRVNAME "drv_privpool"
 
 struct kmem_cache *my_cache;
+struct llfree my_pool;	/* freed objects, reused before the slab */
 
 typedef struct {
 	u32 devid;
@@ -63,17 +66,19 @@ static void cache_init(void *data)
 /* 
  * cache specific derived object allocator / de-allocator routines
  * use these routines from rest of driver code for alloc/dealloc ops.
+ * myfree() may be called from any context, including IRQ handlers;
+ * myalloc() sleeps (GFP_KERNEL) when the free-list is empty.
  */
 static drv_priv *myalloc(void)
 {
 	drv_priv *mydata;
-	mydata = (drv_priv *) kmem_cache_alloc(my_cache, GFP_KERNEL);
+	mydata = (drv_priv *) llfree_alloc(&my_pool, GFP_KERNEL);
 	return mydata;
 }
 
 static void myfree(drv_priv * free)
 {
-	kmem_cache_free(my_cache, free);
+	llfree_free(&my_pool, free);
 	pr_info("%s: myfree invoked\n",__func__);
 }
 
@@ -86,6 +91,10 @@ static int __init myinit(void)
 			      SLAB_HWCACHE_ALIGN, cache_init);
 	if (my_cache == NULL)
 		return -ENOMEM;
+	if (llfree_init(&my_pool, my_cache, cache_init)) {
+		kmem_cache_destroy(my_cache);
+		return -ENOMEM;
+	}
 
 	/* Alloc an object from list */
 	handle = myalloc();
@@ -100,7 +109,8 @@ static int __init myinit(void)
 
 static void __exit myexit(void)
 {
-	/* delete cache list */
+	/* return pooled objects, then delete cache list */
+	llfree_destroy(&my_pool);
 	kmem_cache_destroy(my_cache);
 }
 
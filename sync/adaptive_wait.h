@@ -0,0 +1,173 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Adaptive spin-then-sleep waiting.
+ *
+ * wait_event() puts the caller to sleep as soon as the condition is
+ * false. When the next event is only a few hundred ns away that costs a
+ * context switch and a wakeup per event. adaptive_wait_event() first
+ * polls the condition for a bounded time and only then falls back to
+ * wait_event_interruptible().
+ *
+ * The poll budget tunes itself: an EWMA of how long recent waits lasted
+ * is kept, and the next wait polls for twice that, capped at
+ * max_spin_ns. Once waits get longer than the cap polling stops, except
+ * for every 16th wait, which probes with the full budget so a rise in
+ * the event rate is noticed.
+ *
+ * adaptive_down() does the same for a semaphore, polling with
+ * down_trylock() before it sleeps in down(). adaptive_down_mark() also
+ * sets *@sleeping while blocked in down(), so the side calling up() can
+ * tell a sleeping waiter from a polling one.
+ *
+ * Usage (one struct per waiter):
+ *	static struct adaptive_wait aw;
+ *
+ *	adaptive_wait_init(&aw, 20 * NSEC_PER_USEC);
+ *	adaptive_wait_event(&aw, wq, !list_empty(&queue));
+ *	adaptive_down(&aw, &sem);
+ */
+#ifndef _SYNC_ADAPTIVE_WAIT_H
+#define _SYNC_ADAPTIVE_WAIT_H
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/semaphore.h>
+#include <linux/string.h>
+#include <linux/wait.h>
+
+#define ADAPTIVE_WAIT_PROBE	16
+
+struct adaptive_wait {
+	u64 est_ns;		/* EWMA of recent wait durations */
+	u64 max_spin_ns;	/* never poll longer than this */
+
+	/* statistics */
+	u64 waits;		/* waits where the condition was false */
+	u64 spin_hits;		/* ... and came true while polling */
+	u64 sleeps;		/* ... and needed wait_event() */
+	u64 spin_ns;		/* time spent polling */
+};
+
+static inline void adaptive_wait_init(struct adaptive_wait *aw,
+				      u64 max_spin_ns)
+{
+	memset(aw, 0, sizeof(*aw));
+	aw->max_spin_ns = max_spin_ns;
+}
+
+/* how long the next wait may poll before sleeping */
+static inline u64 adaptive_wait_budget(const struct adaptive_wait *aw)
+{
+	if (aw->waits % ADAPTIVE_WAIT_PROBE == 0)
+		return aw->max_spin_ns;
+	if (aw->est_ns > aw->max_spin_ns)
+		return 0;
+	return min(2 * aw->est_ns, aw->max_spin_ns);
+}
+
+static inline void adaptive_wait_update(struct adaptive_wait *aw,
+					u64 waited_ns, u64 spun_ns,
+					bool slept)
+{
+	aw->waits++;
+	aw->spin_ns += spun_ns;
+	if (slept)
+		aw->sleeps++;
+	else
+		aw->spin_hits++;
+	/* weight 1/8 for the newest sample */
+	aw->est_ns = aw->est_ns - (aw->est_ns >> 3) + (waited_ns >> 3);
+}
+
+/*
+ * Like wait_event_interruptible(), returns 0 or -ERESTARTSYS. The wakers
+ * must still wake @wq; the poll just makes most of those wakeups find
+ * nobody asleep.
+ */
+#define adaptive_wait_event(aw, wq, condition)				\
+({									\
+	int __ret = 0;							\
+									\
+	if (!(condition)) {						\
+		u64 __t0 = ktime_get_ns();				\
+		u64 __budget = adaptive_wait_budget(aw);		\
+		u64 __now = __t0;					\
+		bool __slept = false;					\
+									\
+		while (!(condition)) {					\
+			__now = ktime_get_ns();				\
+			if (__now - __t0 >= __budget || need_resched()) { \
+				__slept = true;				\
+				__ret = wait_event_interruptible(wq,	\
+							condition);	\
+				break;					\
+			}						\
+			cpu_relax();					\
+		}							\
+		adaptive_wait_update(aw, ktime_get_ns() - __t0,		\
+				     __now - __t0, __slept);		\
+	}								\
+	__ret;								\
+})
+
+static inline void adaptive_down_mark(struct adaptive_wait *aw,
+				      struct semaphore *sem, int *sleeping)
+{
+	u64 t0, now, budget;
+	bool slept = false;
+
+	if (!down_trylock(sem))
+		return;
+	t0 = now = ktime_get_ns();
+	budget = adaptive_wait_budget(aw);
+	while (down_trylock(sem)) {
+		now = ktime_get_ns();
+		if (now - t0 >= budget || need_resched()) {
+			slept = true;
+			if (sleeping)
+				smp_store_mb(*sleeping, 1);
+			down(sem);
+			if (sleeping)
+				WRITE_ONCE(*sleeping, 0);
+			break;
+		}
+		cpu_relax();
+	}
+	adaptive_wait_update(aw, ktime_get_ns() - t0, now - t0, slept);
+}
+
+static inline void adaptive_down(struct adaptive_wait *aw,
+				 struct semaphore *sem)
+{
+	adaptive_down_mark(aw, sem, NULL);
+}
+
+#endif /* _SYNC_ADAPTIVE_WAIT_H */
@@ -0,0 +1,320 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Barrier crossing benchmark
+ *
+ * nthreads threads cross a barrier rounds times in a row, optionally
+ * doing up to work_ns of random work before each crossing so they
+ * arrive at different times. Two barriers are compared for each thread
+ * count in threads=:
+ *
+ *   naive	one atomic counter; the last thread completes a completion
+ *		the others sleep on (two completions, used in turn)
+ *   tree	kbarrier.h: combining tree with fanin-way nodes, waiters
+ *		spin for spin_ns before they sleep
+ *
+ *   insmod barrierbench.ko threads=2,8,32,128 fanin=4 placement=compact
+ *   cat /sys/kernel/debug/barrierbench/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/completion.h>
+#include <linux/random.h>
+
+#include "bench.h"
+#include "kbarrier.h"
+
+#define MODNAME "[BARRIERBENCH] "
+
+#define BAR_MAX_STEPS	16
+
+static char *variant = "all";
+module_param(variant, charp, 0444);
+MODULE_PARM_DESC(variant, "all, naive or tree");
+
+static int threads[BAR_MAX_STEPS] = { 2, 4, 8, 16, 32, 64, 128 };
+static int nr_steps = 7;
+module_param_array(threads, int, &nr_steps, 0444);
+MODULE_PARM_DESC(threads, "Thread counts to run");
+
+static int rounds = 10000;
+module_param(rounds, int, 0444);
+MODULE_PARM_DESC(rounds, "Barrier crossings per run");
+
+static int fanin = 4;
+module_param(fanin, int, 0444);
+MODULE_PARM_DESC(fanin, "Tree barrier fan-in");
+
+static int spin_ns = 10000;
+module_param(spin_ns, int, 0444);
+MODULE_PARM_DESC(spin_ns, "Tree barrier spin time before sleeping in ns");
+
+static int work_ns;
+module_param(work_ns, int, 0444);
+MODULE_PARM_DESC(work_ns, "Random work of up to work_ns before each crossing");
+
+enum { BAR_NAIVE, BAR_TREE, BAR_NR_VARIANTS };
+
+static const char * const bar_names[BAR_NR_VARIANTS] = {
+	[BAR_NAIVE]	= "naive",
+	[BAR_TREE]	= "tree",
+};
+
+/* atomic counter plus completion, the barrier one writes first */
+struct naive_barrier {
+	atomic_t count;
+	int nthreads;
+	struct completion done[2];
+};
+
+static void naive_barrier_init(struct naive_barrier *b, int nthreads)
+{
+	atomic_set(&b->count, 0);
+	b->nthreads = nthreads;
+	init_completion(&b->done[0]);
+	init_completion(&b->done[1]);
+}
+
+/*
+ * Everyone has left phase - 1 before anyone can complete phase, so its
+ * completion can be rearmed for phase + 1.
+ */
+static void naive_barrier_wait(struct naive_barrier *b, unsigned int phase)
+{
+	if (atomic_inc_return(&b->count) == b->nthreads) {
+		atomic_set(&b->count, 0);
+		reinit_completion(&b->done[(phase + 1) & 1]);
+		complete_all(&b->done[phase & 1]);
+		return;
+	}
+	wait_for_completion(&b->done[phase & 1]);
+}
+
+struct bar_thread {
+	struct task_struct *task;
+	int id;
+	u32 seed;
+} ____cacheline_aligned_in_smp;
+
+struct bar_result {
+	bool ran;
+	u64 ns;
+	u64 sleeps;
+	struct bench_perf_sum perf;	/* all threads, per crossing */
+};
+
+static int bar_variant;
+static struct naive_barrier bar_naive;
+static struct kbarrier bar_tree;
+static struct bar_thread *bar_threads;
+static struct bar_result bar_results[BAR_NR_VARIANTS][BAR_MAX_STEPS];
+static struct bench_ctl bar_ctl;
+static struct task_struct *bar_task;
+static DECLARE_COMPLETION(bar_all_done);
+static struct dentry *bar_dir;
+
+static int bar_thread_fn(void *arg)
+{
+	struct bar_thread *t = arg;
+	struct bench_perf perf;
+	unsigned int phase;
+
+	bench_perf_open(&perf);
+	bench_gate(&bar_ctl);
+	bench_perf_start(&perf);
+	/* stopped at the gate: a thread failed to start */
+	for (phase = 0; phase < rounds && !kthread_should_stop(); phase++) {
+		if (work_ns)
+			bench_spin_ns(bench_rand(&t->seed) % work_ns);
+		if (bar_variant == BAR_NAIVE)
+			naive_barrier_wait(&bar_naive, phase);
+		else if (kbarrier_wait(&bar_tree, t->id) < 0)
+			break;
+	}
+	bench_perf_stop(&perf, &bar_ctl);
+	bench_done(&bar_ctl);
+	return 0;
+}
+
+static int bar_run(int v, int step)
+{
+	struct bar_result *r = &bar_results[v][step];
+	int n = threads[step];
+	int i, ret;
+
+	bar_variant = v;
+	naive_barrier_init(&bar_naive, n);
+	ret = kbarrier_init(&bar_tree, n, fanin, spin_ns);
+	if (ret)
+		return ret;
+
+	/* rounds bound the run, the run timer is not used */
+	bench_ctl_init(&bar_ctl, n, 0);
+	for (i = 0; i < n; i++) {
+		bar_threads[i].id = i;
+		bar_threads[i].seed = get_random_u32() | 1;
+		bar_threads[i].task = bench_kthread_run(bar_thread_fn,
+					&bar_threads[i], "barrierbench", i);
+		if (IS_ERR(bar_threads[i].task)) {
+			ret = PTR_ERR(bar_threads[i].task);
+			pr_err("%s: unable to start kernel thread\n", __func__);
+			/* the others would wait for it forever */
+			while (--i >= 0)
+				kthread_stop(bar_threads[i].task);
+			goto out;
+		}
+	}
+
+	wait_for_completion(&bar_ctl.finished);
+	for (i = 0; i < n; i++)
+		kthread_stop(bar_threads[i].task);
+
+	r->ns = bench_elapsed_ns(&bar_ctl);
+	r->sleeps = atomic64_read(&bar_tree.sleeps);
+	r->perf = bar_ctl.perf;
+	r->ran = true;
+out:
+	bench_ctl_cleanup(&bar_ctl);
+	kbarrier_destroy(&bar_tree);
+	return ret;
+}
+
+static int bar_main(void *arg)
+{
+	int v, s;
+
+	for (v = 0; v < BAR_NR_VARIANTS; v++) {
+		if (strcmp(variant, "all") && strcmp(variant, bar_names[v]))
+			continue;
+		for (s = 0; s < nr_steps; s++)
+			if (kthread_should_stop() || bar_run(v, s))
+				goto out;
+	}
+out:
+	complete(&bar_all_done);
+	bench_park();
+	return 0;
+}
+
+static int bar_results_show(struct seq_file *m, void *v)
+{
+	int b, s;
+
+	if (!completion_done(&bar_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_printf(m, "rounds %d fanin %d spin_ns %d work_ns %d\n", rounds,
+		   fanin, spin_ns, work_ns);
+	bench_placement_show(m);
+	seq_printf(m, "%-7s %8s %14s %14s\n", "barrier", "threads",
+		   "ns/crossing", "sleeps/cross");
+	for (b = 0; b < BAR_NR_VARIANTS; b++) {
+		for (s = 0; s < nr_steps; s++) {
+			struct bar_result *r = &bar_results[b][s];
+			u64 sl = bench_milli(r->sleeps, rounds);
+
+			if (!r->ran)
+				continue;
+			if (b == BAR_NAIVE)
+				seq_printf(m, "%-7s %8d %14llu %14s",
+					   bar_names[b], threads[s],
+					   div_u64(r->ns, rounds), "-");
+			else
+				seq_printf(m, "%-7s %8d %14llu "
+					   BENCH_MILLI_FMTW(10),
+					   bar_names[b], threads[s],
+					   div_u64(r->ns, rounds),
+					   BENCH_MILLI_ARG(sl));
+			bench_perf_show(m, &r->perf, rounds);
+			seq_putc(m, '\n');
+		}
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bar_results);
+
+static int __init bar_init(void)
+{
+	int i, ret, max_threads = 0;
+
+	if (rounds <= 0)
+		rounds = 1;
+	fanin = max(fanin, 2);
+	spin_ns = max(spin_ns, 0);
+	work_ns = max(work_ns, 0);
+	for (i = 0; i < nr_steps; i++) {
+		threads[i] = max(threads[i], 1);
+		max_threads = max(max_threads, threads[i]);
+	}
+
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+	bar_threads = vzalloc(array_size(max_threads, sizeof(*bar_threads)));
+	if (!bar_threads) {
+		bench_placement_free();
+		return -ENOMEM;
+	}
+
+	bar_task = kthread_run(bar_main, NULL, "barrierbench");
+	if (IS_ERR(bar_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		vfree(bar_threads);
+		bench_placement_free();
+		return PTR_ERR(bar_task);
+	}
+
+	bar_dir = debugfs_create_dir("barrierbench", NULL);
+	debugfs_create_file("results", 0444, bar_dir, NULL, &bar_results_fops);
+	return 0;
+}
+
+static void __exit bar_exit(void)
+{
+	debugfs_remove_recursive(bar_dir);
+	kthread_stop(bar_task);
+	vfree(bar_threads);
+	bench_placement_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(bar_init);
+module_exit(bar_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("tree barrier vs atomic counter plus completion");
+MODULE_LICENSE("Dual MIT/GPL");
@@ -0,0 +1,789 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Helpers shared by the sync/ benchmark modules.
+ *
+ * Every benchmark has the same shape: module params describe the run,
+ * N kthreads meet at a start gate, hammer the primitive under test until
+ * the run timer fires, then park until rmmod. Results are read back from
+ * /sys/kernel/debug/<module>/results.
+ */
+#ifndef _SYNC_BENCH_H
+#define _SYNC_BENCH_H
+
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/completion.h>
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+#include <linux/seq_file.h>
+#include <linux/cpumask.h>
+#include <linux/nodemask.h>
+#include <linux/topology.h>
+#include <linux/slab.h>
+#include <linux/moduleparam.h>
+#include <linux/spinlock.h>
+#include <linux/perf_event.h>
+
+/*
+ * Latency histogram: log2 buckets, each split into 8 linear sub-buckets,
+ * so any recorded value is known to within 1/8 of its magnitude.
+ */
+#define BENCH_HIST_SUB_BITS	3
+#define BENCH_HIST_SUB		(1U << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_BUCKETS	((64 - BENCH_HIST_SUB_BITS + 1) << BENCH_HIST_SUB_BITS)
+
+struct bench_hist {
+	u64 count;
+	u64 sum;
+	u64 min;
+	u64 max;
+	u64 bucket[BENCH_HIST_BUCKETS];
+};
+
+static inline void bench_hist_init(struct bench_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = U64_MAX;
+}
+
+static inline unsigned int bench_hist_idx(u64 v)
+{
+	unsigned int msb;
+
+	if (v < BENCH_HIST_SUB)
+		return v;
+	msb = fls64(v) - 1;
+	return ((msb - BENCH_HIST_SUB_BITS + 1) << BENCH_HIST_SUB_BITS) |
+	       ((v >> (msb - BENCH_HIST_SUB_BITS)) & (BENCH_HIST_SUB - 1));
+}
+
+/* smallest value that lands in bucket @idx */
+static inline u64 bench_hist_val(unsigned int idx)
+{
+	if (idx < BENCH_HIST_SUB)
+		return idx;
+	return (u64)((idx & (BENCH_HIST_SUB - 1)) | BENCH_HIST_SUB) <<
+	       ((idx >> BENCH_HIST_SUB_BITS) - 1);
+}
+
+static inline void bench_hist_add(struct bench_hist *h, u64 v)
+{
+	h->count++;
+	h->sum += v;
+	if (v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->bucket[bench_hist_idx(v)]++;
+}
+
+static inline void bench_hist_merge(struct bench_hist *dst,
+				    const struct bench_hist *src)
+{
+	unsigned int i;
+
+	if (!src->count)
+		return;
+	dst->count += src->count;
+	dst->sum += src->sum;
+	dst->min = min(dst->min, src->min);
+	dst->max = max(dst->max, src->max);
+	for (i = 0; i < BENCH_HIST_BUCKETS; i++)
+		dst->bucket[i] += src->bucket[i];
+}
+
+/* value below which @permille of the samples fall */
+static inline u64 bench_hist_pct(const struct bench_hist *h,
+				 unsigned int permille)
+{
+	u64 want, seen = 0;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+	want = div_u64(h->count * permille + 999, 1000);
+	for (i = 0; i < BENCH_HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= want)
+			return clamp(bench_hist_val(i), h->min, h->max);
+	}
+	return h->max;
+}
+
+static inline void bench_hist_show(struct seq_file *m, const char *label,
+				   const struct bench_hist *h)
+{
+	if (!h->count) {
+		seq_printf(m, "%-16s n=0\n", label);
+		return;
+	}
+	seq_printf(m, "%-16s n=%llu min=%llu avg=%llu p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu\n",
+		   label, h->count, h->min, div64_u64(h->sum, h->count),
+		   bench_hist_pct(h, 500), bench_hist_pct(h, 900),
+		   bench_hist_pct(h, 990), bench_hist_pct(h, 999), h->max);
+}
+
+/* ops per second over @ns nanoseconds */
+static inline u64 bench_rate(u64 ops, u64 ns)
+{
+	return ns ? mul_u64_u64_div_u64(ops, NSEC_PER_SEC, ns) : 0;
+}
+
+/* @num / @den in thousandths, print with BENCH_MILLI_FMT / BENCH_MILLI_ARG */
+static inline u64 bench_milli(u64 num, u64 den)
+{
+	return den ? mul_u64_u64_div_u64(num, 1000, den) : 0;
+}
+
+#define BENCH_MILLI_FMT		"%llu.%03llu"
+/* integer part padded to @w, so the field is @w + 4 wide */
+#define BENCH_MILLI_FMTW(w)	"%" #w "llu.%03llu"
+#define BENCH_MILLI_ARG(v)	(v) / 1000, (v) % 1000
+
+/* context switches of the calling thread so far */
+static inline u64 bench_ctxsw(void)
+{
+	return current->nvcsw + current->nivcsw;
+}
+
+/* CPU time consumed by the calling thread so far */
+static inline u64 bench_runtime_ns(void)
+{
+	return current->se.sum_exec_runtime;
+}
+
+/* cheap per-thread PRNG (xorshift32), @state must be non-zero */
+static inline u32 bench_rand(u32 *state)
+{
+	u32 x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/* burn @ns nanoseconds on the CPU, used to model critical sections */
+static inline void bench_spin_ns(unsigned int ns)
+{
+	if (ns)
+		ndelay(ns);
+}
+
+/*
+ * Per-thread perf counters. Each benchmark thread opens kernel counters
+ * on itself before the start gate, takes a baseline once the run starts
+ * and adds its deltas to the bench_ctl totals when the run ends:
+ *
+ *	bench_perf_open(&perf);
+ *	bench_gate(ctl);
+ *	bench_perf_start(&perf);
+ *	... run ...
+ *	bench_perf_stop(&perf, ctl);
+ *	bench_done(ctl);
+ *
+ * Threads outside a bench_ctl run use bench_perf_stop_sum() with their
+ * own bench_perf_sum. bench_perf_show() then prints the totals per
+ * operation. Without a hardware PMU (most VMs) cycles fall back to the
+ * task clock in ns and events with no software counterpart are left
+ * out. perf=0 opens none.
+ */
+static bool perf = true;
+module_param(perf, bool, 0444);
+MODULE_PARM_DESC(perf, "Count cycles, instructions, cache misses and context switches per thread");
+
+enum bench_perf_event {
+	BENCH_PERF_CYCLES,
+	BENCH_PERF_INSNS,
+	BENCH_PERF_MISSES,
+	BENCH_PERF_CTXSW,
+	BENCH_PERF_MIGRATIONS,
+	BENCH_PERF_NR,
+};
+
+/* which counter backs an event */
+enum {
+	BENCH_PERF_NONE,
+	BENCH_PERF_PRIMARY,
+	BENCH_PERF_FALLBACK,
+};
+
+struct bench_perf_desc {
+	const char *name;
+	u32 type;
+	u64 config;
+	const char *fb_name;	/* NULL: no software fallback */
+	u32 fb_type;
+	u64 fb_config;
+};
+
+static const struct bench_perf_desc bench_perf_descs[BENCH_PERF_NR] = {
+	[BENCH_PERF_CYCLES]	= { "cycles", PERF_TYPE_HARDWARE,
+				    PERF_COUNT_HW_CPU_CYCLES, "task_clock_ns",
+				    PERF_TYPE_SOFTWARE,
+				    PERF_COUNT_SW_TASK_CLOCK },
+	[BENCH_PERF_INSNS]	= { "instructions", PERF_TYPE_HARDWARE,
+				    PERF_COUNT_HW_INSTRUCTIONS },
+	[BENCH_PERF_MISSES]	= { "cache_misses", PERF_TYPE_HARDWARE,
+				    PERF_COUNT_HW_CACHE_MISSES },
+	[BENCH_PERF_CTXSW]	= { "ctxsw", PERF_TYPE_SOFTWARE,
+				    PERF_COUNT_SW_CONTEXT_SWITCHES },
+	[BENCH_PERF_MIGRATIONS]	= { "migrations", PERF_TYPE_SOFTWARE,
+				    PERF_COUNT_SW_CPU_MIGRATIONS },
+};
+
+/* one thread's counters */
+struct bench_perf {
+	struct perf_event *ev[BENCH_PERF_NR];
+	u8 src[BENCH_PERF_NR];
+	u64 base[BENCH_PERF_NR];
+};
+
+/* deltas summed over the threads of a run */
+struct bench_perf_sum {
+	u8 src[BENCH_PERF_NR];
+	u64 val[BENCH_PERF_NR];
+};
+
+/*
+ * Run control shared by all threads of one benchmark run.
+ */
+struct bench_ctl {
+	int nthreads;
+	atomic_t ready;		/* threads that reached the start gate */
+	atomic_t done;		/* threads that finished the run */
+	int go;
+	int stop;
+	u64 duration_ns;
+	ktime_t start;
+	ktime_t end;
+	struct hrtimer timer;
+	struct completion finished;
+	spinlock_t perf_lock;
+	struct bench_perf_sum perf;
+};
+
+static inline enum hrtimer_restart bench_ctl_timeout(struct hrtimer *timer)
+{
+	struct bench_ctl *ctl = container_of(timer, struct bench_ctl, timer);
+
+	WRITE_ONCE(ctl->stop, 1);
+	return HRTIMER_NORESTART;
+}
+
+static inline void bench_ctl_init(struct bench_ctl *ctl, int nthreads,
+				  unsigned int duration_ms)
+{
+	ctl->nthreads = nthreads;
+	atomic_set(&ctl->ready, 0);
+	atomic_set(&ctl->done, 0);
+	ctl->go = 0;
+	ctl->stop = 0;
+	ctl->duration_ns = (u64)duration_ms * NSEC_PER_MSEC;
+	hrtimer_init(&ctl->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	ctl->timer.function = bench_ctl_timeout;
+	init_completion(&ctl->finished);
+	spin_lock_init(&ctl->perf_lock);
+	memset(&ctl->perf, 0, sizeof(ctl->perf));
+}
+
+static inline void bench_ctl_cleanup(struct bench_ctl *ctl)
+{
+	hrtimer_cancel(&ctl->timer);
+}
+
+/* Wait for all threads of the run; the last one to arrive starts the clock. */
+static inline void bench_gate(struct bench_ctl *ctl)
+{
+	if (atomic_inc_return(&ctl->ready) == ctl->nthreads) {
+		ctl->start = ktime_get();
+		hrtimer_start(&ctl->timer, ns_to_ktime(ctl->duration_ns),
+			      HRTIMER_MODE_REL);
+		smp_store_release(&ctl->go, 1);
+		return;
+	}
+	while (!smp_load_acquire(&ctl->go) && !kthread_should_stop()) {
+		cpu_relax();
+		cond_resched();
+	}
+}
+
+static inline bool bench_running(struct bench_ctl *ctl)
+{
+	return !READ_ONCE(ctl->stop) && !kthread_should_stop();
+}
+
+/* Park until kthread_stop(), so rmmod never races a thread that returned. */
+static inline void bench_park(void)
+{
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+/* Thread finished its run: account for it, then park. */
+static inline void bench_done(struct bench_ctl *ctl)
+{
+	if (atomic_inc_return(&ctl->done) == ctl->nthreads) {
+		ctl->end = ktime_get();
+		complete_all(&ctl->finished);
+	}
+	bench_park();
+}
+
+static inline bool bench_finished(struct bench_ctl *ctl)
+{
+	return completion_done(&ctl->finished);
+}
+
+static inline u64 bench_elapsed_ns(struct bench_ctl *ctl)
+{
+	return ktime_to_ns(ktime_sub(ctl->end, ctl->start));
+}
+
+#ifdef CONFIG_PERF_EVENTS
+static inline struct perf_event *bench_perf_create(u32 type, u64 config)
+{
+	struct perf_event_attr attr = {
+		.size		= sizeof(attr),
+		.type		= type,
+		.config		= config,
+		.exclude_hv	= 1,
+	};
+
+	return perf_event_create_kernel_counter(&attr, -1, current, NULL, NULL);
+}
+
+static inline u64 bench_perf_read(struct perf_event *ev)
+{
+	u64 enabled, running, v;
+
+	v = perf_event_read_value(ev, &enabled, &running);
+	/* the PMU was shared with other events: scale to the whole time */
+	if (running && running < enabled)
+		v = mul_u64_u64_div_u64(v, enabled, running);
+	return v;
+}
+
+static inline void bench_perf_release(struct perf_event *ev)
+{
+	perf_event_release_kernel(ev);
+}
+#else
+static inline struct perf_event *bench_perf_create(u32 type, u64 config)
+{
+	return ERR_PTR(-ENODEV);
+}
+
+static inline u64 bench_perf_read(struct perf_event *ev)
+{
+	return 0;
+}
+
+static inline void bench_perf_release(struct perf_event *ev)
+{
+}
+#endif
+
+/* open the counters of the calling thread */
+static inline void bench_perf_open(struct bench_perf *p)
+{
+	const struct bench_perf_desc *d;
+	struct perf_event *ev;
+	int i;
+
+	memset(p, 0, sizeof(*p));
+	if (!perf)
+		return;
+	for (i = 0; i < BENCH_PERF_NR; i++) {
+		d = &bench_perf_descs[i];
+		ev = bench_perf_create(d->type, d->config);
+		p->src[i] = BENCH_PERF_PRIMARY;
+		if (IS_ERR(ev) && d->fb_name) {
+			ev = bench_perf_create(d->fb_type, d->fb_config);
+			p->src[i] = BENCH_PERF_FALLBACK;
+		}
+		if (IS_ERR(ev)) {
+			p->src[i] = BENCH_PERF_NONE;
+			continue;
+		}
+		p->ev[i] = ev;
+	}
+}
+
+static inline void bench_perf_start(struct bench_perf *p)
+{
+	int i;
+
+	for (i = 0; i < BENCH_PERF_NR; i++)
+		if (p->ev[i])
+			p->base[i] = bench_perf_read(p->ev[i]);
+}
+
+/*
+ * Add the deltas since bench_perf_start() to @sum and close the counters.
+ * @lock serialises threads adding to the same @sum; NULL if only one does.
+ */
+static inline void bench_perf_stop_sum(struct bench_perf *p,
+				       struct bench_perf_sum *sum,
+				       spinlock_t *lock)
+{
+	u64 delta[BENCH_PERF_NR] = { 0 };
+	int i;
+
+	for (i = 0; i < BENCH_PERF_NR; i++) {
+		if (!p->ev[i])
+			continue;
+		delta[i] = bench_perf_read(p->ev[i]) - p->base[i];
+		bench_perf_release(p->ev[i]);
+		p->ev[i] = NULL;
+	}
+
+	if (lock)
+		spin_lock(lock);
+	for (i = 0; i < BENCH_PERF_NR; i++) {
+		if (!p->src[i])
+			continue;
+		sum->val[i] += delta[i];
+		if (!sum->src[i])
+			sum->src[i] = p->src[i];
+	}
+	if (lock)
+		spin_unlock(lock);
+}
+
+/* add the deltas since bench_perf_start() to @ctl and close the counters */
+static inline void bench_perf_stop(struct bench_perf *p, struct bench_ctl *ctl)
+{
+	bench_perf_stop_sum(p, &ctl->perf, &ctl->perf_lock);
+}
+
+/* " cycles/op 1234.567 instructions/op ..." for the events that counted */
+static inline void bench_perf_show(struct seq_file *m,
+				   const struct bench_perf_sum *s, u64 ops)
+{
+	const struct bench_perf_desc *d;
+	u64 v;
+	int i;
+
+	for (i = 0; i < BENCH_PERF_NR; i++) {
+		if (!s->src[i])
+			continue;
+		d = &bench_perf_descs[i];
+		v = bench_milli(s->val[i], ops);
+		seq_printf(m, " %s/op " BENCH_MILLI_FMT,
+			   s->src[i] == BENCH_PERF_FALLBACK ? d->fb_name : d->name,
+			   BENCH_MILLI_ARG(v));
+	}
+}
+
+/* @n-th online CPU, wrapping around when there are fewer than @n */
+static inline int bench_nth_online_cpu(int n)
+{
+	int cpu;
+
+	n %= num_online_cpus();
+	for_each_online_cpu(cpu)
+		if (n-- == 0)
+			return cpu;
+	return cpumask_first(cpu_online_mask);
+}
+
+static inline struct task_struct *bench_kthread_run_on_cpu(int (*fn)(void *),
+							   void *data,
+							   const char *name,
+							   int id, int cpu)
+{
+	struct task_struct *t;
+
+	t = kthread_create_on_node(fn, data, cpu_to_node(cpu), "%s/%d",
+				   name, id);
+	if (!IS_ERR(t)) {
+		kthread_bind(t, cpu);
+		wake_up_process(t);
+	}
+	return t;
+}
+
+/*
+ * Thread placement, shared by all benchmarks through two module params:
+ *
+ *   placement=none	threads are not pinned, the scheduler places them
+ *   placement=compact	fill one node before the next, one thread per
+ *			core before using SMT siblings
+ *   placement=scatter	round-robin over the nodes, one thread per core
+ *			before using SMT siblings
+ *   placement=smt	all SMT siblings of a core before the next core
+ *   placement=pernode	thread n may run on any CPU of the n-th node
+ *   placement=cpulist	the online CPUs of cpulist=, e.g. cpulist=0-3,8
+ *
+ * A benchmark numbers its threads with slots; slot n gets the n-th entry
+ * of the policy's order, wrapping around when there are more threads
+ * than entries. Call bench_placement_init() from module init and
+ * bench_placement_free() on exit. CPUs are picked from the online CPUs
+ * at init.
+ *
+ * Benchmarks that place their threads themselves define
+ * BENCH_NO_PLACEMENT before including bench.h, so they do not offer
+ * params that would do nothing.
+ */
+static char *placement = "none";
+static char *cpulist = "";
+#ifndef BENCH_NO_PLACEMENT
+module_param(placement, charp, 0444);
+MODULE_PARM_DESC(placement, "Thread placement: none, compact, scatter, smt, pernode or cpulist");
+
+module_param(cpulist, charp, 0444);
+MODULE_PARM_DESC(cpulist, "CPUs for placement=cpulist, e.g. 0-3,8");
+#endif
+
+enum bench_place_policy {
+	BENCH_PLACE_NONE,
+	BENCH_PLACE_COMPACT,
+	BENCH_PLACE_SCATTER,
+	BENCH_PLACE_SMT,
+	BENCH_PLACE_PERNODE,
+	BENCH_PLACE_CPULIST,
+	BENCH_PLACE_NR,
+};
+
+static const char * const bench_place_names[BENCH_PLACE_NR] = {
+	[BENCH_PLACE_NONE]	= "none",
+	[BENCH_PLACE_COMPACT]	= "compact",
+	[BENCH_PLACE_SCATTER]	= "scatter",
+	[BENCH_PLACE_SMT]	= "smt",
+	[BENCH_PLACE_PERNODE]	= "pernode",
+	[BENCH_PLACE_CPULIST]	= "cpulist",
+};
+
+static enum bench_place_policy bench_place_policy;
+static int *bench_place_order;	/* CPUs, or nodes for pernode */
+static int bench_place_nr;
+
+static inline void bench_place_add(struct cpumask *seen, int cpu)
+{
+	if (!cpumask_test_and_set_cpu(cpu, seen))
+		bench_place_order[bench_place_nr++] = cpu;
+}
+
+/* online CPUs of @node; one per core first unless @smt, then the rest */
+static inline void bench_place_node(struct cpumask *seen, int node, bool smt)
+{
+	int cpu, sib;
+
+	for_each_cpu_and(cpu, cpumask_of_node(node), cpu_online_mask) {
+		if (smt) {
+			for_each_cpu_and(sib, topology_sibling_cpumask(cpu),
+					 cpu_online_mask)
+				bench_place_add(seen, sib);
+		} else if (!cpumask_intersects(topology_sibling_cpumask(cpu),
+					       seen)) {
+			bench_place_add(seen, cpu);
+		}
+	}
+	for_each_cpu_and(cpu, cpumask_of_node(node), cpu_online_mask)
+		bench_place_add(seen, cpu);
+}
+
+/* compact order, then one CPU of each node in turn */
+static inline int bench_place_scatter(struct cpumask *seen)
+{
+	int *start, *end, *tmp;
+	int node, i, n = 0;
+
+	start = kcalloc(2 * nr_node_ids, sizeof(*start), GFP_KERNEL);
+	tmp = kcalloc(nr_cpu_ids, sizeof(*tmp), GFP_KERNEL);
+	if (!start || !tmp) {
+		kfree(start);
+		kfree(tmp);
+		return -ENOMEM;
+	}
+	end = start + nr_node_ids;
+
+	for_each_node_with_cpus(node) {
+		start[node] = bench_place_nr;
+		bench_place_node(seen, node, false);
+		end[node] = bench_place_nr;
+	}
+	for (i = 0; n < bench_place_nr; i++)
+		for_each_node_with_cpus(node)
+			if (start[node] + i < end[node])
+				tmp[n++] = bench_place_order[start[node] + i];
+	memcpy(bench_place_order, tmp, n * sizeof(*tmp));
+
+	kfree(tmp);
+	kfree(start);
+	return 0;
+}
+
+static inline void bench_placement_free(void)
+{
+	kfree(bench_place_order);
+	bench_place_order = NULL;
+	bench_place_nr = 0;
+}
+
+static inline int bench_placement_init(void)
+{
+	cpumask_var_t seen;
+	int i, cpu, node, ret = 0;
+
+	for (i = 0; i < BENCH_PLACE_NR; i++)
+		if (!strcmp(placement, bench_place_names[i]))
+			break;
+	if (i == BENCH_PLACE_NR) {
+		pr_err("%s: unknown placement '%s'\n", __func__, placement);
+		return -EINVAL;
+	}
+	bench_place_policy = i;
+	if (bench_place_policy == BENCH_PLACE_NONE)
+		return 0;
+
+	if (!zalloc_cpumask_var(&seen, GFP_KERNEL))
+		return -ENOMEM;
+	bench_place_order = kcalloc(nr_cpu_ids, sizeof(int), GFP_KERNEL);
+	if (!bench_place_order) {
+		free_cpumask_var(seen);
+		return -ENOMEM;
+	}
+
+	switch (bench_place_policy) {
+	case BENCH_PLACE_COMPACT:
+	case BENCH_PLACE_SMT:
+		for_each_node_with_cpus(node)
+			bench_place_node(seen, node,
+					 bench_place_policy == BENCH_PLACE_SMT);
+		break;
+	case BENCH_PLACE_SCATTER:
+		ret = bench_place_scatter(seen);
+		break;
+	case BENCH_PLACE_PERNODE:
+		for_each_node_with_cpus(node)
+			if (cpumask_intersects(cpumask_of_node(node),
+					       cpu_online_mask))
+				bench_place_order[bench_place_nr++] = node;
+		break;
+	case BENCH_PLACE_CPULIST:
+		ret = cpulist_parse(cpulist, seen);
+		if (ret)
+			break;
+		for_each_cpu_and(cpu, seen, cpu_online_mask)
+			bench_place_order[bench_place_nr++] = cpu;
+		break;
+	default:
+		break;
+	}
+	free_cpumask_var(seen);
+
+	if (!ret && !bench_place_nr) {
+		pr_err("%s: no online CPUs for placement '%s'\n", __func__,
+		       placement);
+		ret = -EINVAL;
+	}
+	if (ret)
+		bench_placement_free();
+	return ret;
+}
+
+static inline bool bench_placed(void)
+{
+	return bench_place_policy != BENCH_PLACE_NONE;
+}
+
+/* CPU for thread @slot, -1 if the policy does not pin to a single CPU */
+static inline int bench_place_cpu(int slot)
+{
+	if (!bench_place_nr || bench_place_policy == BENCH_PLACE_PERNODE)
+		return -1;
+	return bench_place_order[slot % bench_place_nr];
+}
+
+static inline void bench_placement_show(struct seq_file *m)
+{
+	int i;
+
+	seq_printf(m, "placement %s", bench_place_names[bench_place_policy]);
+	if (bench_place_nr)
+		seq_puts(m, bench_place_policy == BENCH_PLACE_PERNODE ?
+			 " nodes" : " cpus");
+	for (i = 0; i < bench_place_nr; i++)
+		seq_printf(m, "%c%d", i ? ',' : ' ', bench_place_order[i]);
+	seq_putc(m, '\n');
+}
+
+/*
+ * Start a thread placed for @slot; @id only names it. Threads with the
+ * same role usually get consecutive slots, different roles of one run
+ * must not share slots.
+ */
+static inline struct task_struct *bench_kthread_place(int (*fn)(void *),
+						      void *data,
+						      const char *name,
+						      int id, int slot)
+{
+	struct task_struct *t;
+	int node;
+
+	if (bench_place_cpu(slot) >= 0)
+		return bench_kthread_run_on_cpu(fn, data, name, id,
+						bench_place_cpu(slot));
+
+	if (bench_place_policy != BENCH_PLACE_PERNODE) {
+		t = kthread_create(fn, data, "%s/%d", name, id);
+	} else {
+		node = bench_place_order[slot % bench_place_nr];
+		t = kthread_create_on_node(fn, data, node, "%s/%d", name, id);
+		/* kthread_bind_mask() is not exported */
+		if (!IS_ERR(t))
+			set_cpus_allowed_ptr(t, cpumask_of_node(node));
+	}
+	if (!IS_ERR(t))
+		wake_up_process(t);
+	return t;
+}
+
+static inline struct task_struct *bench_kthread_run(int (*fn)(void *),
+						    void *data,
+						    const char *name, int id)
+{
+	return bench_kthread_place(fn, data, name, id, id);
+}
+
+#endif /* _SYNC_BENCH_H */
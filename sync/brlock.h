@@ -0,0 +1,115 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Per-CPU "big reader" lock.
+ *
+ * A rwlock_t keeps its reader count in one word, so every read_lock()
+ * bounces that cache line between the CPUs that read. A brlock gives
+ * each CPU its own spinlock: readers take only the lock of the CPU they
+ * run on, writers take all of them in CPU order. Reads scale with the
+ * number of CPUs, writes cost one lock per possible CPU, so this only
+ * pays off for data that is read very often and written rarely (and
+ * cannot use RCU, e.g. because readers must see the update at once).
+ *
+ * Readers run with preemption disabled and must not sleep. The locks
+ * are arch_spinlock_t, as lockdep cannot follow a writer holding one
+ * lock of the same class per CPU.
+ *
+ * Usage:
+ *	struct brlock br;
+ *
+ *	brlock_init(&br);
+ *	br_read_lock(&br);	...	br_read_unlock(&br);
+ *	br_write_lock(&br);	...	br_write_unlock(&br);
+ *	brlock_free(&br);
+ */
+#ifndef _SYNC_BRLOCK_H
+#define _SYNC_BRLOCK_H
+
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/preempt.h>
+#include <linux/spinlock.h>
+
+struct brlock {
+	arch_spinlock_t __percpu *locks;
+};
+
+static inline int brlock_init(struct brlock *br)
+{
+	int cpu;
+
+	br->locks = alloc_percpu(arch_spinlock_t);
+	if (!br->locks)
+		return -ENOMEM;
+	for_each_possible_cpu(cpu)
+		*per_cpu_ptr(br->locks, cpu) =
+			(arch_spinlock_t)__ARCH_SPIN_LOCK_UNLOCKED;
+	return 0;
+}
+
+static inline void brlock_free(struct brlock *br)
+{
+	free_percpu(br->locks);
+	br->locks = NULL;
+}
+
+static inline void br_read_lock(struct brlock *br)
+{
+	preempt_disable();
+	arch_spin_lock(this_cpu_ptr(br->locks));
+}
+
+static inline void br_read_unlock(struct brlock *br)
+{
+	arch_spin_unlock(this_cpu_ptr(br->locks));
+	preempt_enable();
+}
+
+/* possible, not online CPUs: a CPU coming up must find its lock held */
+static inline void br_write_lock(struct brlock *br)
+{
+	int cpu;
+
+	preempt_disable();
+	for_each_possible_cpu(cpu)
+		arch_spin_lock(per_cpu_ptr(br->locks, cpu));
+}
+
+static inline void br_write_unlock(struct brlock *br)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		arch_spin_unlock(per_cpu_ptr(br->locks, cpu));
+	preempt_enable();
+}
+
+#endif /* _SYNC_BRLOCK_H */
@@ -0,0 +1,400 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * brlock scaling benchmark
+ *
+ * The reader and writer threads of kthread_rwspin.c and kthread_rwsem.c
+ * (readers take the lock and read counter, one writer takes it and
+ * increments counter), without the pr_info() and with the writer coming
+ * back every write_gap_us instead of every 500 ms. They run against
+ * rwlock_t, rw_semaphore, the per-CPU brlock of brlock.h and an
+ * RCU-published object (rcu_obj.h), for a sweep of reader counts
+ * (1, 2, 4, ... up to the online CPUs, or the list given in readers=).
+ *
+ *   insmod brlockbench.ko readers=1,3,8,32
+ *   cat /sys/kernel/debug/brlockbench/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/spinlock.h>
+#include <linux/rwsem.h>
+
+#include "bench.h"
+#include "brlock.h"
+#include "rcu_obj.h"
+
+#define MODNAME "[BRLOCKBENCH] "
+
+#define BB_MAX_STEPS	16
+
+static char *prim = "all";
+module_param(prim, charp, 0444);
+MODULE_PARM_DESC(prim, "all, rwlock, rwsem, brlock or rcu");
+
+static int readers[BB_MAX_STEPS];
+static int nr_steps;
+module_param_array(readers, int, &nr_steps, 0444);
+MODULE_PARM_DESC(readers, "Reader counts to run (default 1, 2, 4, ... online CPUs)");
+
+static int write_gap_us = 1000;
+module_param(write_gap_us, int, 0444);
+MODULE_PARM_DESC(write_gap_us, "Time the writer sleeps between writes in us");
+
+static int duration_ms = 2000;
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Run length per primitive and reader count in ms");
+
+/* shared data, as in kthread_rwspin.c */
+static unsigned int counter;
+
+static DEFINE_RWLOCK(counter_lock);
+static DECLARE_RWSEM(counter_rwsem);
+static struct brlock counter_brlock;
+static RCU_OBJ(unsigned int) counter_rcu;
+
+static unsigned int rwlock_read(void)
+{
+	unsigned int v;
+
+	read_lock(&counter_lock);
+	v = counter;
+	read_unlock(&counter_lock);
+	return v;
+}
+
+static void rwlock_write(void)
+{
+	write_lock(&counter_lock);
+	counter++;
+	write_unlock(&counter_lock);
+}
+
+static unsigned int rwsem_read(void)
+{
+	unsigned int v;
+
+	down_read(&counter_rwsem);
+	v = counter;
+	up_read(&counter_rwsem);
+	return v;
+}
+
+/* kthread_rwsem.c's writer: increment, then downgrade and read back */
+static void rwsem_write(void)
+{
+	down_write(&counter_rwsem);
+	counter++;
+	downgrade_write(&counter_rwsem);
+	up_read(&counter_rwsem);
+}
+
+static unsigned int brlock_read(void)
+{
+	unsigned int v;
+
+	br_read_lock(&counter_brlock);
+	v = counter;
+	br_read_unlock(&counter_brlock);
+	return v;
+}
+
+static void brlock_write(void)
+{
+	br_write_lock(&counter_brlock);
+	counter++;
+	br_write_unlock(&counter_brlock);
+}
+
+static unsigned int rcu_read(void)
+{
+	unsigned int v;
+
+	rcu_obj_read(&counter_rcu, &v);
+	return v;
+}
+
+static void rcu_write(void)
+{
+	typeof(*counter_rcu.ptr) *new = rcu_obj_copy(&counter_rcu);
+
+	if (!new)
+		return;
+	new->data++;
+	rcu_obj_publish(&counter_rcu, new);
+}
+
+struct bb_ops {
+	const char *name;
+	unsigned int (*read)(void);
+	void (*write)(void);
+};
+
+static const struct bb_ops bb_ops_table[] = {
+	{ "rwlock",	rwlock_read,	rwlock_write },
+	{ "rwsem",	rwsem_read,	rwsem_write },
+	{ "brlock",	brlock_read,	brlock_write },
+	{ "rcu",	rcu_read,	rcu_write },
+};
+
+struct bb_reader {
+	struct task_struct *task;
+	u64 reads;
+} ____cacheline_aligned_in_smp;
+
+struct bb_result {
+	bool ran;
+	u64 reads_per_sec;
+	u64 writes_per_sec;
+	u64 write_p99;
+	u64 reads;
+	struct bench_perf_sum perf;	/* readers only */
+};
+
+static const struct bb_ops *bb_ops;
+static struct bb_reader *bb_readers;
+static struct task_struct *bb_writer;
+static u64 bb_writes;
+static struct bench_hist bb_wlat;
+static struct bb_result bb_results[ARRAY_SIZE(bb_ops_table)][BB_MAX_STEPS];
+static struct bench_ctl bb_ctl;
+static struct task_struct *bb_task;
+static DECLARE_COMPLETION(bb_all_done);
+static struct dentry *bb_dir;
+
+static int read_function(void *data)
+{
+	struct bb_reader *r = data;
+	struct bench_perf perf;
+	unsigned int sink = 0;
+
+	bench_perf_open(&perf);
+	bench_gate(&bb_ctl);
+	bench_perf_start(&perf);
+	while (bench_running(&bb_ctl)) {
+		sink += bb_ops->read();
+		if (++r->reads % 64 == 0)
+			cond_resched();
+	}
+	barrier_data(&sink);
+	bench_perf_stop(&perf, &bb_ctl);
+	bench_done(&bb_ctl);
+	return 0;
+}
+
+static int writer_function(void *data)
+{
+	u64 t0;
+
+	bench_gate(&bb_ctl);
+	while (bench_running(&bb_ctl)) {
+		t0 = ktime_get_ns();
+		bb_ops->write();
+		bench_hist_add(&bb_wlat, ktime_get_ns() - t0);
+		bb_writes++;
+		if (write_gap_us)
+			usleep_range(write_gap_us, write_gap_us + 1);
+	}
+	bench_done(&bb_ctl);
+	return 0;
+}
+
+static int bb_run(int p, int step)
+{
+	struct bb_result *r = &bb_results[p][step];
+	int n = readers[step];
+	u64 reads = 0, ns;
+	int i, ret = 0;
+
+	bb_ops = &bb_ops_table[p];
+	memset(bb_readers, 0, array_size(n, sizeof(*bb_readers)));
+	bb_writes = 0;
+	bench_hist_init(&bb_wlat);
+
+	bench_ctl_init(&bb_ctl, n + 1, duration_ms);
+	bb_writer = bench_kthread_place(writer_function, NULL, "brlockbench-w",
+					0, 0);
+	if (IS_ERR(bb_writer)) {
+		ret = PTR_ERR(bb_writer);
+		bb_writer = NULL;
+		goto out;
+	}
+	for (i = 0; i < n; i++) {
+		bb_readers[i].task = bench_kthread_place(read_function,
+					&bb_readers[i], "brlockbench-r", i, i + 1);
+		if (IS_ERR(bb_readers[i].task)) {
+			ret = PTR_ERR(bb_readers[i].task);
+			goto out;
+		}
+	}
+
+	wait_for_completion(&bb_ctl.finished);
+	ns = bench_elapsed_ns(&bb_ctl);
+	for (i = 0; i < n; i++)
+		reads += bb_readers[i].reads;
+	r->reads_per_sec = bench_rate(reads, ns);
+	r->writes_per_sec = bench_rate(bb_writes, ns);
+	r->write_p99 = bench_hist_pct(&bb_wlat, 990);
+	r->reads = reads;
+	r->perf = bb_ctl.perf;
+	r->ran = true;
+out:
+	if (ret)
+		pr_err("%s: unable to start kernel thread\n", __func__);
+	for (i = 0; i < n; i++)
+		if (!IS_ERR_OR_NULL(bb_readers[i].task))
+			kthread_stop(bb_readers[i].task);
+	if (bb_writer)
+		kthread_stop(bb_writer);
+	bench_ctl_cleanup(&bb_ctl);
+	return ret;
+}
+
+static int bb_main(void *arg)
+{
+	int p, s;
+
+	for (p = 0; p < ARRAY_SIZE(bb_ops_table); p++) {
+		if (strcmp(prim, "all") && strcmp(prim, bb_ops_table[p].name))
+			continue;
+		for (s = 0; s < nr_steps; s++)
+			if (kthread_should_stop() || bb_run(p, s))
+				goto out;
+	}
+out:
+	complete(&bb_all_done);
+	bench_park();
+	return 0;
+}
+
+static int bb_results_show(struct seq_file *m, void *v)
+{
+	int p, s;
+
+	if (!completion_done(&bb_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_printf(m, "write_gap_us %d duration_ms %d\n", write_gap_us,
+		   duration_ms);
+	bench_placement_show(m);
+	seq_printf(m, "%-8s %8s %14s %10s %14s\n", "prim", "readers",
+		   "reads/s", "writes/s", "write_p99_ns");
+	for (p = 0; p < ARRAY_SIZE(bb_ops_table); p++) {
+		for (s = 0; s < nr_steps; s++) {
+			struct bb_result *r = &bb_results[p][s];
+
+			if (!r->ran)
+				continue;
+			seq_printf(m, "%-8s %8d %14llu %10llu %14llu",
+				   bb_ops_table[p].name, readers[s],
+				   r->reads_per_sec, r->writes_per_sec,
+				   r->write_p99);
+			bench_perf_show(m, &r->perf, r->reads);
+			seq_putc(m, '\n');
+		}
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bb_results);
+
+static void bb_free(void)
+{
+	vfree(bb_readers);
+	brlock_free(&counter_brlock);
+	rcu_obj_free(&counter_rcu);
+	bench_placement_free();
+}
+
+static int __init bb_init(void)
+{
+	unsigned int zero = 0;
+	int i, ret, max_readers = 0;
+
+	if (!nr_steps) {
+		for (i = 1; i <= num_online_cpus() && nr_steps < BB_MAX_STEPS;
+		     i *= 2)
+			readers[nr_steps++] = i;
+		if (readers[nr_steps - 1] != num_online_cpus() &&
+		    nr_steps < BB_MAX_STEPS)
+			readers[nr_steps++] = num_online_cpus();
+	}
+	for (i = 0; i < nr_steps; i++) {
+		readers[i] = max(readers[i], 1);
+		max_readers = max(max_readers, readers[i]);
+	}
+
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+	if (brlock_init(&counter_brlock)) {
+		bench_placement_free();
+		return -ENOMEM;
+	}
+	ret = rcu_obj_init(&counter_rcu, &zero);
+	bb_readers = vzalloc(array_size(max_readers, sizeof(*bb_readers)));
+	if (ret || !bb_readers) {
+		bb_free();
+		return -ENOMEM;
+	}
+
+	bb_task = kthread_run(bb_main, NULL, "brlockbench");
+	if (IS_ERR(bb_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		bb_free();
+		return PTR_ERR(bb_task);
+	}
+
+	bb_dir = debugfs_create_dir("brlockbench", NULL);
+	debugfs_create_file("results", 0444, bb_dir, NULL, &bb_results_fops);
+	return 0;
+}
+
+static void __exit bb_exit(void)
+{
+	debugfs_remove_recursive(bb_dir);
+	kthread_stop(bb_task);
+	bb_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(bb_init);
+module_exit(bb_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("per-CPU brlock vs rwlock vs rwsem vs RCU reader scaling");
+MODULE_LICENSE("Dual MIT/GPL");
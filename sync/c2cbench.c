@@ -0,0 +1,367 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Core-to-core cache line transfer latency
+ *
+ * For every pair of online CPUs, two kthreads pinned to the pair pass
+ * one cache line back and forth with cmpxchg(): the first moves it from
+ * even to odd, the second from odd to even. Each round costs two
+ * transfers of the line; the reported latency is the time of one
+ * transfer, the median of samples batches of rounds round trips.
+ *
+ * kthread_atomic.c's two unpinned threads see an average over wherever
+ * the scheduler put them; the matrix shows what each placement costs:
+ * SMT siblings, cores of one package, and across packages.
+ *
+ *   insmod c2cbench.ko rounds=2000
+ *   cat /sys/kernel/debug/c2cbench/results	(summary per CPU relation)
+ *   cat /sys/kernel/debug/c2cbench/matrix.csv	(ns, row = first CPU)
+ *
+ * CPUs are taken from the online mask at insmod; do not hotplug CPUs
+ * while it runs. Pairs take n * (n - 1) / 2 runs, so a large machine
+ * takes a while: watch results for "running".
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/debugfs.h>
+#include <linux/topology.h>
+#include <linux/cache.h>
+
+/* threads are pinned per CPU pair, placement= would not apply */
+#define BENCH_NO_PLACEMENT
+#include "bench.h"
+
+#define MODNAME "[C2CBENCH] "
+
+#define C2C_MAX_SAMPLES	15
+
+static int rounds = 1000;
+module_param(rounds, int, 0444);
+MODULE_PARM_DESC(rounds, "Round trips per sample");
+
+static int samples = 5;
+module_param(samples, int, 0444);
+MODULE_PARM_DESC(samples, "Samples per CPU pair, the median is reported (at most 15)");
+
+enum { C2C_SMT, C2C_PACKAGE, C2C_CROSS, C2C_NR_RELS };
+
+static const char * const c2c_rel_names[C2C_NR_RELS] = {
+	[C2C_SMT]	= "smt",
+	[C2C_PACKAGE]	= "same_package",
+	[C2C_CROSS]	= "cross_package",
+};
+
+static struct {
+	int v;
+} ____cacheline_aligned_in_smp c2c_line;
+
+static atomic_t c2c_ready;
+static u64 c2c_ns;		/* time of one sample, set by the first thread */
+static DECLARE_COMPLETION(c2c_pair_done);
+static struct bench_perf_sum c2c_perf[C2C_NR_RELS];	/* both threads */
+static DEFINE_SPINLOCK(c2c_perf_lock);
+
+static int c2c_nr;		/* CPUs measured */
+static int *c2c_cpus;
+static u64 *c2c_matrix;		/* c2c_nr * c2c_nr, thousandths of ns */
+static struct task_struct *c2c_task;
+static DECLARE_COMPLETION(c2c_all_done);
+static struct dentry *c2c_dir;
+
+static int c2c_rel(int a, int b)
+{
+	if (cpumask_test_cpu(b, topology_sibling_cpumask(a)))
+		return C2C_SMT;
+	if (topology_physical_package_id(a) == topology_physical_package_id(b))
+		return C2C_PACKAGE;
+	return C2C_CROSS;
+}
+
+/* move the line from @from to @from + 1, false if told to stop */
+static bool c2c_pass(int from)
+{
+	while (cmpxchg(&c2c_line.v, from, from + 1) != from) {
+		if (kthread_should_stop())
+			return false;
+		cpu_relax();
+	}
+	return true;
+}
+
+static void c2c_wait_ready(void)
+{
+	atomic_inc(&c2c_ready);
+	while (atomic_read(&c2c_ready) < 2 && !kthread_should_stop())
+		cpu_relax();
+}
+
+static int c2c_first(void *arg)
+{
+	struct bench_perf perf;
+	u64 t0;
+	int k;
+
+	bench_perf_open(&perf);
+	c2c_wait_ready();
+	bench_perf_start(&perf);
+	t0 = ktime_get_ns();
+	for (k = 0; k < rounds; k++)
+		if (!c2c_pass(2 * k))
+			break;
+	/* the last pass needs the second thread's answer */
+	while (READ_ONCE(c2c_line.v) != 2 * rounds && !kthread_should_stop())
+		cpu_relax();
+	c2c_ns = ktime_get_ns() - t0;
+	bench_perf_stop_sum(&perf, arg, &c2c_perf_lock);
+	complete(&c2c_pair_done);
+	bench_park();
+	return 0;
+}
+
+static int c2c_second(void *arg)
+{
+	struct bench_perf perf;
+	int k;
+
+	bench_perf_open(&perf);
+	c2c_wait_ready();
+	bench_perf_start(&perf);
+	for (k = 0; k < rounds; k++)
+		if (!c2c_pass(2 * k + 1))
+			break;
+	bench_perf_stop_sum(&perf, arg, &c2c_perf_lock);
+	complete(&c2c_pair_done);
+	bench_park();
+	return 0;
+}
+
+static int c2c_cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* one sample on @a and @b, thousandths of ns per transfer */
+static int c2c_sample(int a, int b, u64 *out)
+{
+	struct bench_perf_sum *ps = &c2c_perf[c2c_rel(a, b)];
+	struct task_struct *t1, *t2;
+
+	WRITE_ONCE(c2c_line.v, 0);
+	atomic_set(&c2c_ready, 0);
+	reinit_completion(&c2c_pair_done);
+
+	t1 = bench_kthread_run_on_cpu(c2c_first, ps, "c2cbench", a, a);
+	if (IS_ERR(t1))
+		return PTR_ERR(t1);
+	t2 = bench_kthread_run_on_cpu(c2c_second, ps, "c2cbench", b, b);
+	if (IS_ERR(t2)) {
+		kthread_stop(t1);
+		return PTR_ERR(t2);
+	}
+	wait_for_completion(&c2c_pair_done);
+	wait_for_completion(&c2c_pair_done);
+	kthread_stop(t1);
+	kthread_stop(t2);
+	*out = bench_milli(c2c_ns, 2ULL * rounds);
+	return 0;
+}
+
+static int c2c_pair(int i, int j)
+{
+	u64 s[C2C_MAX_SAMPLES];
+	int k, ret;
+
+	for (k = 0; k < samples; k++) {
+		ret = c2c_sample(c2c_cpus[i], c2c_cpus[j], &s[k]);
+		if (ret)
+			return ret;
+		cond_resched();
+	}
+	sort(s, samples, sizeof(s[0]), c2c_cmp_u64, NULL);
+	c2c_matrix[i * c2c_nr + j] = s[samples / 2];
+	c2c_matrix[j * c2c_nr + i] = s[samples / 2];
+	return 0;
+}
+
+static int c2c_main(void *arg)
+{
+	int i, j, ret = 0;
+
+	for (i = 0; i < c2c_nr && !ret; i++)
+		for (j = i + 1; j < c2c_nr && !ret; j++) {
+			if (kthread_should_stop())
+				goto out;
+			ret = c2c_pair(i, j);
+		}
+	if (ret)
+		pr_err("%s: unable to start kernel thread\n", __func__);
+out:
+	complete(&c2c_all_done);
+	bench_park();
+	return 0;
+}
+
+static int c2c_results_show(struct seq_file *m, void *v)
+{
+	u64 min[C2C_NR_RELS], max[C2C_NR_RELS], sum[C2C_NR_RELS];
+	u64 n[C2C_NR_RELS] = { 0 }, x, avg;
+	int i, j, r;
+
+	if (!completion_done(&c2c_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	for (r = 0; r < C2C_NR_RELS; r++) {
+		min[r] = U64_MAX;
+		max[r] = sum[r] = 0;
+	}
+	for (i = 0; i < c2c_nr; i++)
+		for (j = i + 1; j < c2c_nr; j++) {
+			x = c2c_matrix[i * c2c_nr + j];
+			if (!x)
+				continue;
+			r = c2c_rel(c2c_cpus[i], c2c_cpus[j]);
+			min[r] = min(min[r], x);
+			max[r] = max(max[r], x);
+			sum[r] += x;
+			n[r]++;
+		}
+
+	seq_printf(m, "cpus %d rounds %d samples %d\n", c2c_nr, rounds,
+		   samples);
+	seq_printf(m, "%-14s %8s %12s %12s %12s\n", "relation", "pairs",
+		   "min_ns", "avg_ns", "max_ns");
+	for (r = 0; r < C2C_NR_RELS; r++) {
+		if (!n[r])
+			continue;
+		avg = div64_u64(sum[r], n[r]);
+		seq_printf(m, "%-14s %8llu " BENCH_MILLI_FMTW(8) " "
+			   BENCH_MILLI_FMTW(8) " " BENCH_MILLI_FMTW(8),
+			   c2c_rel_names[r], n[r], BENCH_MILLI_ARG(min[r]),
+			   BENCH_MILLI_ARG(avg), BENCH_MILLI_ARG(max[r]));
+		/* per transfer, over every sample of the relation's pairs */
+		bench_perf_show(m, &c2c_perf[r], n[r] * samples * 2 * rounds);
+		seq_putc(m, '\n');
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(c2c_results);
+
+/* header row of CPU numbers, then one row per CPU; empty on the diagonal */
+static int c2c_matrix_show(struct seq_file *m, void *v)
+{
+	u64 x;
+	int i, j;
+
+	if (!completion_done(&c2c_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_puts(m, "cpu");
+	for (j = 0; j < c2c_nr; j++)
+		seq_printf(m, ",%d", c2c_cpus[j]);
+	seq_putc(m, '\n');
+	for (i = 0; i < c2c_nr; i++) {
+		seq_printf(m, "%d", c2c_cpus[i]);
+		for (j = 0; j < c2c_nr; j++) {
+			x = c2c_matrix[i * c2c_nr + j];
+			if (i == j || !x)
+				seq_putc(m, ',');
+			else
+				seq_printf(m, "," BENCH_MILLI_FMT,
+					   BENCH_MILLI_ARG(x));
+		}
+		seq_putc(m, '\n');
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(c2c_matrix);
+
+static int __init c2c_init(void)
+{
+	int cpu, i = 0;
+
+	rounds = max(rounds, 1);
+	samples = clamp(samples, 1, C2C_MAX_SAMPLES);
+
+	c2c_nr = num_online_cpus();
+	c2c_cpus = kcalloc(c2c_nr, sizeof(*c2c_cpus), GFP_KERNEL);
+	c2c_matrix = vzalloc(array3_size(c2c_nr, c2c_nr, sizeof(*c2c_matrix)));
+	if (!c2c_cpus || !c2c_matrix) {
+		vfree(c2c_matrix);
+		kfree(c2c_cpus);
+		return -ENOMEM;
+	}
+	for_each_online_cpu(cpu) {
+		if (i == c2c_nr)
+			break;
+		c2c_cpus[i++] = cpu;
+	}
+	c2c_nr = i;
+
+	c2c_task = kthread_run(c2c_main, NULL, "c2cbench");
+	if (IS_ERR(c2c_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		vfree(c2c_matrix);
+		kfree(c2c_cpus);
+		return PTR_ERR(c2c_task);
+	}
+
+	c2c_dir = debugfs_create_dir("c2cbench", NULL);
+	debugfs_create_file("results", 0444, c2c_dir, NULL, &c2c_results_fops);
+	debugfs_create_file("matrix.csv", 0444, c2c_dir, NULL,
+			    &c2c_matrix_fops);
+	return 0;
+}
+
+static void __exit c2c_exit(void)
+{
+	debugfs_remove_recursive(c2c_dir);
+	kthread_stop(c2c_task);
+	vfree(c2c_matrix);
+	kfree(c2c_cpus);
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(c2c_init);
+module_exit(c2c_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("core-to-core cache line transfer latency");
+MODULE_LICENSE("Dual MIT/GPL");
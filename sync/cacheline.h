@@ -0,0 +1,111 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Cache line sharing report for module globals.
+ *
+ * Two hot variables written by different CPUs that land in the same
+ * cache line slow each other down even though they never touch the same
+ * bytes. The linker decides where globals go, so list the ones that
+ * matter and ask which of them share a line:
+ *
+ *	static const struct cacheline_obj my_globals[] = {
+ *		CACHELINE_OBJ(counter),
+ *		CACHELINE_OBJ(read_thread),
+ *	};
+ *
+ *	cacheline_report(NULL, MODNAME, my_globals, ARRAY_SIZE(my_globals));
+ *
+ * prints one line per object that shares a cache line with another one,
+ * to the kernel log, or to a seq_file when @m is set. Lines are
+ * SMP_CACHE_BYTES, the unit ____cacheline_aligned pads to.
+ */
+#ifndef _SYNC_CACHELINE_H
+#define _SYNC_CACHELINE_H
+
+#include <linux/kernel.h>
+#include <linux/cache.h>
+#include <linux/seq_file.h>
+
+struct cacheline_obj {
+	const char *name;
+	const void *addr;
+	size_t size;
+};
+
+#define CACHELINE_OBJ(v)	{ #v, &(v), sizeof(v) }
+
+static inline unsigned long cacheline_first(const struct cacheline_obj *o)
+{
+	return (unsigned long)o->addr / SMP_CACHE_BYTES;
+}
+
+static inline unsigned long cacheline_last(const struct cacheline_obj *o)
+{
+	return ((unsigned long)o->addr + max_t(size_t, o->size, 1) - 1) /
+	       SMP_CACHE_BYTES;
+}
+
+static inline bool cacheline_shared(const struct cacheline_obj *a,
+				    const struct cacheline_obj *b)
+{
+	return cacheline_first(a) <= cacheline_last(b) &&
+	       cacheline_first(b) <= cacheline_last(a);
+}
+
+/* returns the number of objects sharing a line with another one */
+static inline int cacheline_report(struct seq_file *m, const char *prefix,
+				   const struct cacheline_obj *objs, int n)
+{
+	char buf[160];
+	int i, j, len, shared = 0;
+
+	for (i = 0; i < n; i++) {
+		len = 0;
+		for (j = 0; j < n; j++)
+			if (j != i && cacheline_shared(&objs[i], &objs[j]))
+				len += scnprintf(buf + len, sizeof(buf) - len,
+						 " %s", objs[j].name);
+		if (!len)
+			continue;
+		shared++;
+		if (m)
+			seq_printf(m, "%s%-24s off %3lu size %5zu shares a line with%s\n",
+				   prefix, objs[i].name,
+				   (unsigned long)objs[i].addr % SMP_CACHE_BYTES,
+				   objs[i].size, buf);
+		else
+			pr_info("%s%s off %lu size %zu shares a line with%s\n",
+				prefix, objs[i].name,
+				(unsigned long)objs[i].addr % SMP_CACHE_BYTES,
+				objs[i].size, buf);
+	}
+	return shared;
+}
+
+#endif /* _SYNC_CACHELINE_H */
@@ -0,0 +1,270 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Counter scalability benchmark
+ *
+ * Runs nthreads kthreads, each pinned to its own online CPU (or placed
+ * as placement= says), that do nothing but increment one stat_counter (stat_counter.h) for
+ * duration_ms. Every design is run in turn (or just the one named by
+ * variant=) and for each the module reports increments per second, the
+ * cost of an exact and of a fast read once the writers are done, and
+ * whether the final value matches the number of increments.
+ *
+ *   insmod counterbench.ko nthreads=64 batch=64
+ *   cat /sys/kernel/debug/counterbench/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+
+#include "bench.h"
+#include "stat_counter.h"
+
+#define MODNAME "[COUNTERBENCH] "
+
+#define CB_INC_CHUNK	64
+#define CB_READ_LOOPS	1000
+
+static char *variant = "all";
+module_param(variant, charp, 0444);
+MODULE_PARM_DESC(variant, "all, atomic, atomic64, percpu_counter, local or slots");
+
+static int nthreads;
+module_param(nthreads, int, 0444);
+MODULE_PARM_DESC(nthreads, "Incrementing threads, one per CPU (0 = all online CPUs)");
+
+static int batch = 32;
+module_param(batch, int, 0444);
+MODULE_PARM_DESC(batch, "percpu_counter batch size");
+
+static int duration_ms = 2000;
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Run length per variant in ms");
+
+struct cb_result {
+	bool ran;
+	u64 incs;
+	u64 ns;
+	u64 read_ns;
+	u64 fast_read_ns;
+	s64 value;
+	struct bench_perf_sum perf;
+};
+
+struct cb_thread {
+	struct task_struct *task;
+	u64 incs;
+} ____cacheline_aligned_in_smp;
+
+static struct cb_result cb_results[STAT_NR_TYPES];
+static struct cb_thread *cb_threads;
+static struct stat_counter cb_counter;
+static struct bench_ctl cb_ctl;
+static struct task_struct *cb_task;
+static DECLARE_COMPLETION(cb_all_done);
+static struct dentry *cb_dir;
+
+static int cb_worker(void *arg)
+{
+	struct cb_thread *t = arg;
+	struct bench_perf perf;
+	u64 n = 0;
+	int i;
+
+	bench_perf_open(&perf);
+	bench_gate(&cb_ctl);
+	bench_perf_start(&perf);
+	while (bench_running(&cb_ctl)) {
+		for (i = 0; i < CB_INC_CHUNK; i++)
+			stat_counter_inc(&cb_counter);
+		n += CB_INC_CHUNK;
+		cond_resched();
+	}
+	bench_perf_stop(&perf, &cb_ctl);
+	t->incs = n;
+	bench_done(&cb_ctl);
+	return 0;
+}
+
+/* average cost of one read in ns */
+static u64 cb_read_cost(s64 (*read)(struct stat_counter *))
+{
+	u64 t0, t1;
+	s64 sink = 0;
+	int i;
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < CB_READ_LOOPS; i++)
+		sink += read(&cb_counter);
+	t1 = ktime_get_ns();
+	barrier_data(&sink);
+	return div_u64(t1 - t0, CB_READ_LOOPS);
+}
+
+static int cb_run(enum stat_counter_type type)
+{
+	struct cb_result *r = &cb_results[type];
+	int i, ret;
+
+	ret = stat_counter_init(&cb_counter, type, batch);
+	if (ret)
+		return ret;
+
+	bench_ctl_init(&cb_ctl, nthreads, duration_ms);
+	for (i = 0; i < nthreads; i++) {
+		cb_threads[i].incs = 0;
+		if (bench_placed())
+			cb_threads[i].task = bench_kthread_run(cb_worker,
+						&cb_threads[i], "counterbench", i);
+		else
+			cb_threads[i].task = bench_kthread_run_on_cpu(cb_worker,
+						&cb_threads[i], "counterbench",
+						i, bench_nth_online_cpu(i));
+		if (IS_ERR(cb_threads[i].task)) {
+			ret = PTR_ERR(cb_threads[i].task);
+			pr_err("%s: unable to start kernel thread\n", __func__);
+			while (--i >= 0)
+				kthread_stop(cb_threads[i].task);
+			goto out;
+		}
+	}
+
+	wait_for_completion(&cb_ctl.finished);
+	for (i = 0; i < nthreads; i++) {
+		kthread_stop(cb_threads[i].task);
+		r->incs += cb_threads[i].incs;
+	}
+
+	r->ns = bench_elapsed_ns(&cb_ctl);
+	r->perf = cb_ctl.perf;
+	r->value = stat_counter_read(&cb_counter);
+	r->read_ns = cb_read_cost(stat_counter_read);
+	r->fast_read_ns = cb_read_cost(stat_counter_read_fast);
+	r->ran = true;
+out:
+	bench_ctl_cleanup(&cb_ctl);
+	stat_counter_destroy(&cb_counter);
+	return ret;
+}
+
+static int cb_main(void *arg)
+{
+	int type;
+
+	for (type = 0; type < STAT_NR_TYPES; type++) {
+		if (strcmp(variant, "all") &&
+		    strcmp(variant, stat_counter_names[type]))
+			continue;
+		if (kthread_should_stop() || cb_run(type))
+			break;
+	}
+	complete(&cb_all_done);
+	bench_park();
+	return 0;
+}
+
+static int cb_results_show(struct seq_file *m, void *v)
+{
+	int type;
+
+	if (!completion_done(&cb_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_printf(m, "threads %d batch %d duration_ms %d\n",
+		   nthreads, batch, duration_ms);
+	bench_placement_show(m);
+	seq_printf(m, "%-16s %14s %10s %14s %s\n",
+		   "variant", "incs/s", "read_ns", "fast_read_ns", "value");
+	for (type = 0; type < STAT_NR_TYPES; type++) {
+		struct cb_result *r = &cb_results[type];
+
+		if (!r->ran)
+			continue;
+		seq_printf(m, "%-16s %14llu %10llu %14llu %s",
+			   stat_counter_names[type], bench_rate(r->incs, r->ns),
+			   r->read_ns, r->fast_read_ns,
+			   (u64)r->value == r->incs ? "ok" : "MISMATCH");
+		bench_perf_show(m, &r->perf, r->incs);
+		seq_putc(m, '\n');
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cb_results);
+
+static int __init cb_init(void)
+{
+	int ret;
+
+	if (nthreads <= 0 || nthreads > num_online_cpus())
+		nthreads = num_online_cpus();
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+
+	cb_threads = kcalloc(nthreads, sizeof(*cb_threads), GFP_KERNEL);
+	if (!cb_threads) {
+		bench_placement_free();
+		return -ENOMEM;
+	}
+
+	cb_task = kthread_run(cb_main, NULL, "counterbench");
+	if (IS_ERR(cb_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		kfree(cb_threads);
+		bench_placement_free();
+		return PTR_ERR(cb_task);
+	}
+
+	cb_dir = debugfs_create_dir("counterbench", NULL);
+	debugfs_create_file("results", 0444, cb_dir, NULL, &cb_results_fops);
+	return 0;
+}
+
+static void __exit cb_exit(void)
+{
+	debugfs_remove_recursive(cb_dir);
+	kthread_stop(cb_task);
+	kfree(cb_threads);
+	bench_placement_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(cb_init);
+module_exit(cb_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("scalable counter benchmark");
+MODULE_LICENSE("Dual MIT/GPL");
@@ -0,0 +1,431 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Deferred work dispatch benchmark
+ *
+ * A producer thread hands the same work items to each mechanism for
+ * duration_ms and every item records the time from its submission until
+ * its handler started:
+ *
+ *   wq		queue_work(system_wq), runs on the submitting CPU
+ *   unbound	queue_work(system_unbound_wq)
+ *   kworker	kthread_queue_work() on a dedicated kthread_worker
+ *   tasklet	tasklet_schedule(), softirq on the submitting CPU
+ *   irq_work	irq_work_queue(), hardirq on the submitting CPU
+ *   kthread	a raw kthread fed through an llist and woken with
+ *		wake_up_process(), as the producer/consumer demos do
+ *
+ * At most nitems items are in flight; when the next one is still
+ * queued the producer waits for it (counted as a stall), so throughput
+ * is the rate the mechanism sustains. gap_ns spaces the submissions out
+ * to see dispatch latency without queueing, work_ns is the handler body.
+ *
+ *   insmod deferbench.ko gap_ns=20000 placement=compact
+ *   cat /sys/kernel/debug/deferbench/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/workqueue.h>
+#include <linux/interrupt.h>
+#include <linux/irq_work.h>
+#include <linux/llist.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/wait_bit.h>
+
+#include "bench.h"
+
+#define MODNAME "[DEFERBENCH] "
+
+static char *mech = "all";
+module_param(mech, charp, 0444);
+MODULE_PARM_DESC(mech, "all, wq, unbound, kworker, tasklet, irq_work or kthread");
+
+static int nitems = 32;
+module_param(nitems, int, 0444);
+MODULE_PARM_DESC(nitems, "Work items in flight at most");
+
+static int gap_ns;
+module_param(gap_ns, int, 0444);
+MODULE_PARM_DESC(gap_ns, "Producer work between submissions in ns");
+
+static int work_ns;
+module_param(work_ns, int, 0444);
+MODULE_PARM_DESC(work_ns, "Handler work per item in ns");
+
+static int duration_ms = 2000;
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Run length per mechanism in ms");
+
+enum {
+	DF_WQ,
+	DF_UNBOUND,
+	DF_KWORKER,
+	DF_TASKLET,
+	DF_IRQ_WORK,
+	DF_KTHREAD,
+	DF_NR_MECHS,
+};
+
+static const char * const df_mech_names[DF_NR_MECHS] = {
+	[DF_WQ]		= "wq",
+	[DF_UNBOUND]	= "unbound",
+	[DF_KWORKER]	= "kworker",
+	[DF_TASKLET]	= "tasklet",
+	[DF_IRQ_WORK]	= "irq_work",
+	[DF_KTHREAD]	= "kthread",
+};
+
+struct df_item {
+	struct work_struct work;
+	struct kthread_work kwork;
+	struct tasklet_struct tasklet;
+	struct irq_work iw;
+	struct llist_node lnode;
+	u64 stamp;
+	int busy;		/* submitted, handler not finished */
+} ____cacheline_aligned_in_smp;
+
+struct df_result {
+	bool ran;
+	u64 ns;
+	u64 stalls;
+	struct bench_hist lat;
+	struct bench_perf_sum perf;	/* producer */
+};
+
+static struct df_item *df_items;
+static struct bench_hist __percpu *df_lat;	/* handlers run anywhere */
+static struct df_result df_results[DF_NR_MECHS];
+static int df_mech;
+static u64 df_stalls;
+static struct kthread_worker *df_kworker;
+static struct task_struct *df_raw_task;
+static LLIST_HEAD(df_raw_list);
+static struct bench_ctl df_ctl;
+static struct task_struct *df_task;
+static DECLARE_COMPLETION(df_all_done);
+static struct dentry *df_dir;
+
+static void df_handle(struct df_item *it)
+{
+	struct bench_hist *h;
+
+	h = get_cpu_ptr(df_lat);
+	bench_hist_add(h, ktime_get_ns() - it->stamp);
+	put_cpu_ptr(df_lat);
+	bench_spin_ns(work_ns);
+
+	smp_store_release(&it->busy, 0);
+	smp_mb();	/* busy before the waiter check in wake_up_var() */
+	wake_up_var(&it->busy);
+}
+
+static void df_work_fn(struct work_struct *w)
+{
+	df_handle(container_of(w, struct df_item, work));
+}
+
+static void df_kwork_fn(struct kthread_work *w)
+{
+	df_handle(container_of(w, struct df_item, kwork));
+}
+
+static void df_tasklet_fn(struct tasklet_struct *t)
+{
+	struct df_item *it = from_tasklet(it, t, tasklet);
+
+	df_handle(it);
+}
+
+static void df_irq_work_fn(struct irq_work *w)
+{
+	df_handle(container_of(w, struct df_item, iw));
+}
+
+static int df_raw_fn(void *arg)
+{
+	struct llist_node *list;
+	struct df_item *it, *next;
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (llist_empty(&df_raw_list)) {
+			if (kthread_should_stop())
+				break;
+			schedule();
+		}
+		__set_current_state(TASK_RUNNING);
+		list = llist_reverse_order(llist_del_all(&df_raw_list));
+		llist_for_each_entry_safe(it, next, list, lnode)
+			df_handle(it);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static void df_submit(struct df_item *it)
+{
+	it->stamp = ktime_get_ns();
+	switch (df_mech) {
+	case DF_WQ:
+		queue_work(system_wq, &it->work);
+		break;
+	case DF_UNBOUND:
+		queue_work(system_unbound_wq, &it->work);
+		break;
+	case DF_KWORKER:
+		kthread_queue_work(df_kworker, &it->kwork);
+		break;
+	case DF_TASKLET:
+		tasklet_schedule(&it->tasklet);
+		break;
+	case DF_IRQ_WORK:
+		irq_work_queue(&it->iw);
+		break;
+	case DF_KTHREAD:
+		if (llist_add(&it->lnode, &df_raw_list))
+			wake_up_process(df_raw_task);
+		break;
+	}
+}
+
+static int df_producer(void *arg)
+{
+	struct bench_perf perf;
+	struct df_item *it;
+	u64 stalls = 0;
+	int i = 0;
+
+	bench_perf_open(&perf);
+	bench_gate(&df_ctl);
+	bench_perf_start(&perf);
+	while (bench_running(&df_ctl)) {
+		it = &df_items[i];
+		if (READ_ONCE(it->busy)) {
+			stalls++;
+			/* the end of the run wakes nobody, poll for it */
+			while (!wait_var_event_timeout(&it->busy,
+					!smp_load_acquire(&it->busy) ||
+					!bench_running(&df_ctl),
+					msecs_to_jiffies(10)))
+				;
+			continue;
+		}
+		WRITE_ONCE(it->busy, 1);
+		df_submit(it);
+		i = (i + 1) % nitems;
+		bench_spin_ns(gap_ns);
+		cond_resched();
+	}
+	df_stalls = stalls;
+	bench_perf_stop(&perf, &df_ctl);
+	bench_done(&df_ctl);
+	return 0;
+}
+
+/* wait until every handler of the run has finished */
+static void df_drain(void)
+{
+	int i;
+
+	for (i = 0; i < nitems; i++)
+		wait_var_event(&df_items[i].busy,
+			       !smp_load_acquire(&df_items[i].busy));
+}
+
+static int df_run(int m)
+{
+	struct df_result *r = &df_results[m];
+	struct task_struct *t;
+	int cpu, ret = 0;
+
+	df_mech = m;
+	df_stalls = 0;
+	for_each_possible_cpu(cpu)
+		bench_hist_init(per_cpu_ptr(df_lat, cpu));
+
+	bench_ctl_init(&df_ctl, 1, duration_ms);
+	t = bench_kthread_run(df_producer, NULL, "deferbench-p", 0);
+	if (IS_ERR(t)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		ret = PTR_ERR(t);
+		goto out;
+	}
+	wait_for_completion(&df_ctl.finished);
+	kthread_stop(t);
+	df_drain();
+
+	r->ns = bench_elapsed_ns(&df_ctl);
+	r->stalls = df_stalls;
+	bench_hist_init(&r->lat);
+	for_each_possible_cpu(cpu)
+		bench_hist_merge(&r->lat, per_cpu_ptr(df_lat, cpu));
+	r->perf = df_ctl.perf;
+	r->ran = true;
+out:
+	bench_ctl_cleanup(&df_ctl);
+	return ret;
+}
+
+static int df_main(void *arg)
+{
+	int m;
+
+	for (m = 0; m < DF_NR_MECHS; m++) {
+		if (strcmp(mech, "all") && strcmp(mech, df_mech_names[m]))
+			continue;
+		if (kthread_should_stop() || df_run(m))
+			break;
+	}
+	complete(&df_all_done);
+	bench_park();
+	return 0;
+}
+
+static int df_results_show(struct seq_file *m, void *v)
+{
+	struct df_result *r;
+	int i;
+
+	if (!completion_done(&df_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_printf(m, "nitems %d gap_ns %d work_ns %d duration_ms %d\n",
+		   nitems, gap_ns, work_ns, duration_ms);
+	bench_placement_show(m);
+	seq_printf(m, "%-10s %12s %10s\n", "mech", "items/s", "stalls");
+	for (i = 0; i < DF_NR_MECHS; i++) {
+		r = &df_results[i];
+		if (!r->ran)
+			continue;
+		seq_printf(m, "%-10s %12llu %10llu", df_mech_names[i],
+			   bench_rate(r->lat.count, r->ns), r->stalls);
+		bench_perf_show(m, &r->perf, r->lat.count);
+		seq_putc(m, '\n');
+	}
+	seq_puts(m, "\ndispatch latency (ns)\n");
+	for (i = 0; i < DF_NR_MECHS; i++)
+		if (df_results[i].ran)
+			bench_hist_show(m, df_mech_names[i],
+					&df_results[i].lat);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(df_results);
+
+static void df_free(void)
+{
+	int i;
+
+	for (i = 0; i < nitems; i++) {
+		tasklet_kill(&df_items[i].tasklet);
+		irq_work_sync(&df_items[i].iw);
+		flush_work(&df_items[i].work);
+	}
+	if (!IS_ERR_OR_NULL(df_raw_task))
+		kthread_stop(df_raw_task);
+	if (!IS_ERR_OR_NULL(df_kworker))
+		kthread_destroy_worker(df_kworker);
+	free_percpu(df_lat);
+	kfree(df_items);
+	bench_placement_free();
+}
+
+static int __init df_init(void)
+{
+	int i, ret;
+
+	nitems = max(nitems, 1);
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+
+	df_items = kcalloc(nitems, sizeof(*df_items), GFP_KERNEL);
+	df_lat = alloc_percpu(struct bench_hist);
+	if (!df_items || !df_lat) {
+		free_percpu(df_lat);
+		kfree(df_items);
+		bench_placement_free();
+		return -ENOMEM;
+	}
+	for (i = 0; i < nitems; i++) {
+		struct df_item *it = &df_items[i];
+
+		INIT_WORK(&it->work, df_work_fn);
+		kthread_init_work(&it->kwork, df_kwork_fn);
+		tasklet_setup(&it->tasklet, df_tasklet_fn);
+		init_irq_work(&it->iw, df_irq_work_fn);
+	}
+
+	df_kworker = kthread_create_worker(0, "deferbench-kw");
+	df_raw_task = kthread_run(df_raw_fn, NULL, "deferbench-raw");
+	if (IS_ERR(df_kworker) || IS_ERR(df_raw_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		ret = IS_ERR(df_kworker) ? PTR_ERR(df_kworker) :
+					   PTR_ERR(df_raw_task);
+		df_free();
+		return ret;
+	}
+	/* kthread_create_worker() leaves the worker stopped since 6.14 */
+	wake_up_process(df_kworker->task);
+
+	df_task = kthread_run(df_main, NULL, "deferbench");
+	if (IS_ERR(df_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		df_free();
+		return PTR_ERR(df_task);
+	}
+
+	df_dir = debugfs_create_dir("deferbench", NULL);
+	debugfs_create_file("results", 0444, df_dir, NULL, &df_results_fops);
+	return 0;
+}
+
+static void __exit df_exit(void)
+{
+	debugfs_remove_recursive(df_dir);
+	kthread_stop(df_task);
+	df_drain();
+	df_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(df_init);
+module_exit(df_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("deferred work dispatch benchmark");
+MODULE_LICENSE("Dual MIT/GPL");
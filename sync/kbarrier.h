@@ -0,0 +1,184 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Reusable N-thread barrier.
+ *
+ * kthread_compl.c signals once, from one writer to one reader. A barrier
+ * holds N threads until all of them have arrived, then lets them all go,
+ * and can be crossed again and again (phases).
+ *
+ * The obvious version, one atomic counter plus a completion, puts every
+ * arrival on one cache line and every waiter to sleep. kbarrier instead
+ * counts arrivals in a combining tree: threads are split into groups of
+ * @fanin that each count on their own cache line, and the last thread
+ * of a group carries the arrival one level up. The last thread to reach
+ * the root starts the next generation. Waiters watch the generation
+ * word, which is written once per phase, for up to @spin_ns and then
+ * sleep until it changes.
+ *
+ * Every thread passes its own id in [0, nthreads). kbarrier_wait()
+ * returns KBARRIER_SERIAL for exactly one thread per phase (the one that
+ * completed it, e.g. to update shared state before the next phase), 0
+ * for the others and -EINTR if the calling kthread is being stopped.
+ *
+ * Usage:
+ *	kbarrier_init(&b, nthreads, 4, 10 * NSEC_PER_USEC);
+ *	...
+ *	kbarrier_wait(&b, id);		(in each of the nthreads threads)
+ *	...
+ *	kbarrier_destroy(&b);
+ */
+#ifndef _SYNC_KBARRIER_H
+#define _SYNC_KBARRIER_H
+
+#include <linux/kernel.h>
+#include <linux/atomic.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+
+#define KBARRIER_SERIAL	1
+
+struct kbarrier_node {
+	atomic_t count;
+	int expected;		/* threads or child nodes reporting here */
+	int parent;		/* index in nodes[], -1 for the root */
+} ____cacheline_aligned_in_smp;
+
+struct kbarrier {
+	int nthreads;
+	int fanin;
+	u64 spin_ns;
+	struct kbarrier_node *nodes;	/* leaves first, root last */
+
+	unsigned int gen ____cacheline_aligned_in_smp;
+	atomic_t sleepers;
+	wait_queue_head_t wq;
+	atomic64_t sleeps;		/* statistics */
+};
+
+static inline int kbarrier_init(struct kbarrier *b, int nthreads, int fanin,
+				u64 spin_ns)
+{
+	int level, width, nr = 0, first = 0, i;
+
+	if (nthreads < 1 || fanin < 2)
+		return -EINVAL;
+
+	/* nodes of all levels: ceil(n/f) + ceil(n/f^2) + ... + 1 */
+	for (width = nthreads; width > 1; width = DIV_ROUND_UP(width, fanin))
+		nr += DIV_ROUND_UP(width, fanin);
+	nr = max(nr, 1);
+
+	b->nodes = kcalloc(nr, sizeof(*b->nodes), GFP_KERNEL);
+	if (!b->nodes)
+		return -ENOMEM;
+
+	/* level 0 counts threads, level k counts the nodes of level k-1 */
+	width = nthreads;
+	for (level = 0; first < nr; level++) {
+		int nodes = DIV_ROUND_UP(width, fanin);
+
+		for (i = 0; i < nodes; i++) {
+			struct kbarrier_node *n = &b->nodes[first + i];
+
+			atomic_set(&n->count, 0);
+			n->expected = min(fanin, width - i * fanin);
+			n->parent = nodes > 1 ? first + nodes + i / fanin : -1;
+		}
+		first += nodes;
+		width = nodes;
+	}
+
+	b->nthreads = nthreads;
+	b->fanin = fanin;
+	b->spin_ns = spin_ns;
+	b->gen = 0;
+	atomic_set(&b->sleepers, 0);
+	init_waitqueue_head(&b->wq);
+	atomic64_set(&b->sleeps, 0);
+	return 0;
+}
+
+static inline void kbarrier_destroy(struct kbarrier *b)
+{
+	kfree(b->nodes);
+	b->nodes = NULL;
+}
+
+static inline bool kbarrier_passed(struct kbarrier *b, unsigned int gen)
+{
+	return smp_load_acquire(&b->gen) != gen;
+}
+
+static inline int kbarrier_wait(struct kbarrier *b, int id)
+{
+	struct kbarrier_node *n = &b->nodes[id / b->fanin];
+	unsigned int gen = smp_load_acquire(&b->gen);
+	u64 t0;
+
+	while (atomic_inc_return(&n->count) == n->expected) {
+		/* last here; nobody touches this node again until release */
+		atomic_set(&n->count, 0);
+		if (n->parent < 0) {
+			smp_store_release(&b->gen, gen + 1);
+			smp_mb();	/* gen before sleepers */
+			if (atomic_read(&b->sleepers))
+				wake_up_all(&b->wq);
+			return KBARRIER_SERIAL;
+		}
+		n = &b->nodes[n->parent];
+	}
+
+	if (b->spin_ns) {
+		t0 = ktime_get_ns();
+		while (!kbarrier_passed(b, gen)) {
+			if (need_resched() ||
+			    ktime_get_ns() - t0 > b->spin_ns)
+				break;
+			cpu_relax();
+		}
+	}
+
+	if (!kbarrier_passed(b, gen)) {
+		atomic64_inc(&b->sleeps);
+		atomic_inc(&b->sleepers);
+		smp_mb__after_atomic();	/* sleepers before gen */
+		wait_event_idle(b->wq, kbarrier_passed(b, gen) ||
+				kthread_should_stop());
+		atomic_dec(&b->sleepers);
+		if (!kbarrier_passed(b, gen))
+			return -EINTR;
+	}
+	return 0;
+}
+
+#endif /* _SYNC_KBARRIER_H */
@@ -0,0 +1,313 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Work-stealing kthread pool.
+ *
+ * kthread.c starts one thread that sleeps in a loop, the other demos
+ * create t1 and t2 by hand. kpool keeps one worker kthread bound to each
+ * online CPU. Every worker owns a deque: work submitted on a CPU goes to
+ * the tail of that CPU's deque and its worker takes it back from the
+ * tail (newest first, cache hot). A worker whose deque is empty steals
+ * the oldest item from the head of another worker's deque, and parks
+ * when there is nothing left anywhere.
+ *
+ * The deques are lists under a per-worker spinlock. The owner is the
+ * only user of its lock unless someone is stealing, so it stays local.
+ *
+ * Work runs in process context and may sleep. A work item must stay
+ * valid until kpool_wait() or kpool_flush() has returned for it, and
+ * must not be submitted again before that. Submit from process
+ * context. Workers are created for the CPUs online at kpool_create();
+ * submits from other CPUs go to the first worker.
+ *
+ * Usage:
+ *	static void fn(struct kpool_work *w) { ... }
+ *
+ *	kpool_create(&pool, "mypool");
+ *	kpool_work_init(&w, fn);
+ *	kpool_submit(&pool, &w);
+ *	kpool_wait(&w);			(or kpool_flush(&pool))
+ *	kpool_destroy(&pool);
+ */
+#ifndef _SYNC_KPOOL_H
+#define _SYNC_KPOOL_H
+
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
+#include <linux/wait_bit.h>
+
+struct kpool_work {
+	struct list_head node;
+	void (*fn)(struct kpool_work *w);
+	int done;
+};
+
+struct kpool_worker {
+	spinlock_t lock;
+	struct list_head deque;		/* tail: owner, head: thieves */
+	int nr;
+	int idle;
+	struct task_struct *task;
+	struct kpool *pool;
+	int cpu;
+	u64 executed;
+	u64 stolen;
+} ____cacheline_aligned_in_smp;
+
+struct kpool {
+	struct kpool_worker **workers;	/* by CPU, NULL if none */
+	int first_cpu;
+	atomic_t pending;		/* submitted, not yet finished */
+	atomic_t nr_idle;
+};
+
+static inline void kpool_work_init(struct kpool_work *w,
+				   void (*fn)(struct kpool_work *w))
+{
+	INIT_LIST_HEAD(&w->node);
+	w->fn = fn;
+	w->done = 0;
+}
+
+static inline struct kpool_work *kpool_take(struct kpool_worker *v, bool tail)
+{
+	struct kpool_work *w = NULL;
+
+	if (!READ_ONCE(v->nr))
+		return NULL;
+
+	spin_lock(&v->lock);
+	if (!list_empty(&v->deque)) {
+		w = tail ? list_last_entry(&v->deque, struct kpool_work, node) :
+			   list_first_entry(&v->deque, struct kpool_work, node);
+		list_del_init(&w->node);
+		WRITE_ONCE(v->nr, v->nr - 1);
+	}
+	spin_unlock(&v->lock);
+	return w;
+}
+
+/* oldest item of the first non-empty deque after @me */
+static inline struct kpool_work *kpool_steal(struct kpool *pool,
+					     struct kpool_worker *me)
+{
+	struct kpool_worker *v;
+	struct kpool_work *w;
+	int i, cpu;
+
+	for (i = 1; i < nr_cpu_ids; i++) {
+		cpu = (me->cpu + i) % nr_cpu_ids;
+		v = READ_ONCE(pool->workers[cpu]);
+		if (!v)
+			continue;
+		w = kpool_take(v, false);
+		if (w)
+			return w;
+	}
+	return NULL;
+}
+
+static inline bool kpool_has_work(struct kpool *pool)
+{
+	struct kpool_worker *v;
+	int cpu;
+
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		v = READ_ONCE(pool->workers[cpu]);
+		if (v && READ_ONCE(v->nr))
+			return true;
+	}
+	return false;
+}
+
+static inline void kpool_run(struct kpool *pool, struct kpool_work *w)
+{
+	w->fn(w);
+	smp_store_release(&w->done, 1);
+	smp_mb();	/* done before the waitqueue check in wake_up_var() */
+	wake_up_var(&w->done);
+	if (atomic_dec_and_test(&pool->pending))
+		wake_up_var(&pool->pending);
+}
+
+static inline int kpool_worker_fn(void *arg)
+{
+	struct kpool_worker *me = arg;
+	struct kpool *pool = me->pool;
+	struct kpool_work *w;
+
+	while (!kthread_should_stop()) {
+		w = kpool_take(me, true);
+		if (!w) {
+			w = kpool_steal(pool, me);
+			if (w)
+				me->stolen++;
+		}
+		if (w) {
+			kpool_run(pool, w);
+			me->executed++;
+			cond_resched();
+			continue;
+		}
+
+		/* park; pairs with the smp_mb() in kpool_submit_on() */
+		set_current_state(TASK_INTERRUPTIBLE);
+		WRITE_ONCE(me->idle, 1);
+		atomic_inc(&pool->nr_idle);
+		smp_mb__after_atomic();
+		if (!kpool_has_work(pool) && !kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+		WRITE_ONCE(me->idle, 0);
+		atomic_dec(&pool->nr_idle);
+	}
+	return 0;
+}
+
+/* wake one parked worker other than the one on @cpu, so it can steal */
+static inline void kpool_wake_idle(struct kpool *pool, int cpu)
+{
+	struct kpool_worker *v;
+	int i;
+
+	for (i = 1; i < nr_cpu_ids; i++) {
+		v = READ_ONCE(pool->workers[(cpu + i) % nr_cpu_ids]);
+		if (v && READ_ONCE(v->idle)) {
+			wake_up_process(v->task);
+			return;
+		}
+	}
+}
+
+static inline void kpool_submit_on(struct kpool *pool, int cpu,
+				   struct kpool_work *w)
+{
+	struct kpool_worker *v = pool->workers[cpu];
+
+	if (!v) {
+		cpu = pool->first_cpu;
+		v = pool->workers[cpu];
+	}
+
+	w->done = 0;
+	atomic_inc(&pool->pending);
+	spin_lock(&v->lock);
+	list_add_tail(&w->node, &v->deque);
+	WRITE_ONCE(v->nr, v->nr + 1);
+	spin_unlock(&v->lock);
+
+	smp_mb();	/* queued before reading idle */
+	if (READ_ONCE(v->idle))
+		wake_up_process(v->task);
+	else if (atomic_read(&pool->nr_idle))
+		kpool_wake_idle(pool, cpu);
+}
+
+static inline void kpool_submit(struct kpool *pool, struct kpool_work *w)
+{
+	kpool_submit_on(pool, raw_smp_processor_id(), w);
+}
+
+static inline void kpool_wait(struct kpool_work *w)
+{
+	wait_var_event(&w->done, smp_load_acquire(&w->done));
+}
+
+/* wait until everything submitted so far has run */
+static inline void kpool_flush(struct kpool *pool)
+{
+	wait_var_event(&pool->pending, !atomic_read(&pool->pending));
+}
+
+static inline void kpool_destroy(struct kpool *pool)
+{
+	int cpu;
+
+	if (!pool->workers)
+		return;
+	kpool_flush(pool);
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		if (!pool->workers[cpu])
+			continue;
+		kthread_stop(pool->workers[cpu]->task);
+		kfree(pool->workers[cpu]);
+	}
+	kfree(pool->workers);
+	pool->workers = NULL;
+}
+
+static inline int kpool_create(struct kpool *pool, const char *name)
+{
+	struct kpool_worker *v;
+	int cpu;
+
+	pool->workers = kcalloc(nr_cpu_ids, sizeof(*pool->workers), GFP_KERNEL);
+	if (!pool->workers)
+		return -ENOMEM;
+	atomic_set(&pool->pending, 0);
+	atomic_set(&pool->nr_idle, 0);
+	pool->first_cpu = cpumask_first(cpu_online_mask);
+
+	for_each_online_cpu(cpu) {
+		v = kzalloc_node(sizeof(*v), GFP_KERNEL, cpu_to_node(cpu));
+		if (!v)
+			goto fail;
+		spin_lock_init(&v->lock);
+		INIT_LIST_HEAD(&v->deque);
+		v->pool = pool;
+		v->cpu = cpu;
+		v->task = kthread_create_on_node(kpool_worker_fn, v,
+						 cpu_to_node(cpu), "%s/%d",
+						 name, cpu);
+		if (IS_ERR(v->task)) {
+			int ret = PTR_ERR(v->task);
+
+			kfree(v);
+			kpool_destroy(pool);
+			return ret;
+		}
+		kthread_bind(v->task, cpu);
+		/* running workers may already scan for it */
+		smp_store_release(&pool->workers[cpu], v);
+		wake_up_process(v->task);
+	}
+	return 0;
+fail:
+	kpool_destroy(pool);
+	return -ENOMEM;
+}
+
+#endif /* _SYNC_KPOOL_H */
@@ -0,0 +1,337 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Work-stealing pool vs workqueue benchmark
+ *
+ * A controller pinned to submit_cpu submits rounds of ntasks tasks and
+ * waits for each round to finish, for duration_ms per backend. Tasks
+ * burn small_ns, except big_pct percent of them which burn big_ns, so
+ * the load is both concentrated on one CPU and uneven in size.
+ *
+ *   kpool	kpool.h, idle workers steal from submit_cpu's deque
+ *   wq		queue_work() on system_wq, runs on the submitting CPU
+ *   unbound	queue_work() on system_unbound_wq
+ *
+ *   insmod kpoolbench.ko ntasks=512 big_pct=2 big_ns=500000
+ *   cat /sys/kernel/debug/kpoolbench/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/workqueue.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/cpumask.h>
+#include <linux/wait_bit.h>
+
+#include "bench.h"
+#include "kpool.h"
+
+#define MODNAME "[KPOOLBENCH] "
+
+static char *backend = "all";
+module_param(backend, charp, 0444);
+MODULE_PARM_DESC(backend, "all, kpool, wq or unbound");
+
+static int ntasks = 256;
+module_param(ntasks, int, 0444);
+MODULE_PARM_DESC(ntasks, "Tasks per round");
+
+static int small_ns = 2000;
+module_param(small_ns, int, 0444);
+MODULE_PARM_DESC(small_ns, "Work per small task in ns");
+
+static int big_ns = 200000;
+module_param(big_ns, int, 0444);
+MODULE_PARM_DESC(big_ns, "Work per big task in ns");
+
+static int big_pct = 5;
+module_param(big_pct, int, 0444);
+MODULE_PARM_DESC(big_pct, "Percentage of big tasks");
+
+static int submit_cpu = -1;
+module_param(submit_cpu, int, 0444);
+MODULE_PARM_DESC(submit_cpu, "CPU that submits all tasks (-1 = placement= slot 0, else first online)");
+
+static int duration_ms = 2000;
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Run length per backend in ms");
+
+enum { KB_KPOOL, KB_WQ, KB_UNBOUND, KB_NR_BACKENDS };
+
+static const char * const kb_names[KB_NR_BACKENDS] = {
+	[KB_KPOOL]	= "kpool",
+	[KB_WQ]		= "wq",
+	[KB_UNBOUND]	= "unbound",
+};
+
+struct kb_task {
+	struct kpool_work kw;
+	struct work_struct ws;
+	unsigned int ns;
+	int cpu;
+	u64 queued;
+	u64 lat;
+};
+
+struct kb_result {
+	bool ran;
+	u64 tasks;
+	u64 ns;
+	u64 work_ns;
+	u64 stolen;
+	int cpus;
+	struct bench_hist lat;
+	struct bench_perf_sum perf;	/* submitting thread */
+};
+
+static struct kpool kb_pool;
+static struct kb_task *kb_tasks;
+static atomic_t kb_pending;
+static struct kb_result kb_results[KB_NR_BACKENDS];
+static struct task_struct *kb_thread;
+static DECLARE_COMPLETION(kb_all_done);
+static struct dentry *kb_dir;
+
+static void kb_exec(struct kb_task *t)
+{
+	bench_spin_ns(t->ns);
+	t->cpu = raw_smp_processor_id();
+	t->lat = ktime_get_ns() - t->queued;
+}
+
+static void kb_kpool_fn(struct kpool_work *w)
+{
+	kb_exec(container_of(w, struct kb_task, kw));
+}
+
+static void kb_wq_fn(struct work_struct *w)
+{
+	kb_exec(container_of(w, struct kb_task, ws));
+	if (atomic_dec_and_test(&kb_pending))
+		wake_up_var(&kb_pending);
+}
+
+static void kb_round(int b)
+{
+	int i;
+
+	atomic_set(&kb_pending, ntasks);
+	for (i = 0; i < ntasks; i++) {
+		struct kb_task *t = &kb_tasks[i];
+
+		t->queued = ktime_get_ns();
+		switch (b) {
+		case KB_KPOOL:
+			kpool_submit(&kb_pool, &t->kw);
+			break;
+		case KB_WQ:
+			queue_work(system_wq, &t->ws);
+			break;
+		case KB_UNBOUND:
+			queue_work(system_unbound_wq, &t->ws);
+			break;
+		}
+	}
+
+	if (b == KB_KPOOL)
+		kpool_flush(&kb_pool);
+	else
+		wait_var_event(&kb_pending, !atomic_read(&kb_pending));
+}
+
+static u64 kb_stolen(void)
+{
+	u64 stolen = 0;
+	int cpu;
+
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++)
+		if (kb_pool.workers[cpu])
+			stolen += kb_pool.workers[cpu]->stolen;
+	return stolen;
+}
+
+static void kb_run(int b)
+{
+	struct kb_result *r = &kb_results[b];
+	u64 start, end, stolen = kb_stolen();
+	struct bench_perf perf;
+	cpumask_var_t used;
+	int i;
+
+	if (!zalloc_cpumask_var(&used, GFP_KERNEL))
+		return;
+	bench_hist_init(&r->lat);
+
+	/* the workers are not ours to count: measure what submitting costs */
+	bench_perf_open(&perf);
+	bench_perf_start(&perf);
+	start = ktime_get_ns();
+	end = start + (u64)duration_ms * NSEC_PER_MSEC;
+	do {
+		kb_round(b);
+		for (i = 0; i < ntasks; i++) {
+			bench_hist_add(&r->lat, kb_tasks[i].lat);
+			r->work_ns += kb_tasks[i].ns;
+			cpumask_set_cpu(kb_tasks[i].cpu, used);
+		}
+		r->tasks += ntasks;
+	} while (ktime_get_ns() < end && !kthread_should_stop());
+
+	r->ns = ktime_get_ns() - start;
+	bench_perf_stop_sum(&perf, &r->perf, NULL);
+	r->stolen = b == KB_KPOOL ? kb_stolen() - stolen : 0;
+	r->cpus = cpumask_weight(used);
+	r->ran = true;
+	free_cpumask_var(used);
+}
+
+static int kb_main(void *arg)
+{
+	int b;
+
+	for (b = 0; b < KB_NR_BACKENDS; b++) {
+		if (kthread_should_stop())
+			break;
+		if (strcmp(backend, "all") && strcmp(backend, kb_names[b]))
+			continue;
+		kb_run(b);
+	}
+	complete(&kb_all_done);
+	bench_park();
+	return 0;
+}
+
+static int kb_results_show(struct seq_file *m, void *v)
+{
+	int b;
+
+	if (!completion_done(&kb_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_printf(m, "ntasks %d small_ns %d big_ns %d big_pct %d submit_cpu %d online_cpus %d\n",
+		   ntasks, small_ns, big_ns, big_pct, submit_cpu,
+		   num_online_cpus());
+	bench_placement_show(m);
+	for (b = 0; b < KB_NR_BACKENDS; b++) {
+		struct kb_result *r = &kb_results[b];
+		u64 util = bench_milli(r->work_ns * 100,
+				       r->ns * num_online_cpus());
+
+		if (!r->ran)
+			continue;
+		seq_printf(m, "%s:\n", kb_names[b]);
+		seq_printf(m, "tasks/s %llu cpus_used %d stolen %llu util%% " BENCH_MILLI_FMT "\n",
+			   bench_rate(r->tasks, r->ns), r->cpus, r->stolen,
+			   BENCH_MILLI_ARG(util));
+		seq_puts(m, "submitter");
+		bench_perf_show(m, &r->perf, r->tasks);
+		seq_putc(m, '\n');
+		bench_hist_show(m, "latency_ns", &r->lat);
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(kb_results);
+
+static int __init kb_init(void)
+{
+	u32 seed = 1;
+	int i, ret;
+
+	if (ntasks <= 0)
+		ntasks = 1;
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+	if (submit_cpu < 0 || submit_cpu >= nr_cpu_ids || !cpu_online(submit_cpu))
+		submit_cpu = bench_place_cpu(0);
+	if (submit_cpu < 0)
+		submit_cpu = cpumask_first(cpu_online_mask);
+
+	kb_tasks = vzalloc(array_size(ntasks, sizeof(*kb_tasks)));
+	if (!kb_tasks) {
+		bench_placement_free();
+		return -ENOMEM;
+	}
+	for (i = 0; i < ntasks; i++) {
+		struct kb_task *t = &kb_tasks[i];
+
+		kpool_work_init(&t->kw, kb_kpool_fn);
+		INIT_WORK(&t->ws, kb_wq_fn);
+		t->ns = bench_rand(&seed) % 100 < big_pct ? big_ns : small_ns;
+	}
+
+	ret = kpool_create(&kb_pool, "kpoolbench");
+	if (ret) {
+		vfree(kb_tasks);
+		bench_placement_free();
+		return ret;
+	}
+
+	kb_thread = bench_kthread_run_on_cpu(kb_main, NULL, "kpoolbench", 0,
+					     submit_cpu);
+	if (IS_ERR(kb_thread)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		kpool_destroy(&kb_pool);
+		vfree(kb_tasks);
+		bench_placement_free();
+		return PTR_ERR(kb_thread);
+	}
+
+	kb_dir = debugfs_create_dir("kpoolbench", NULL);
+	debugfs_create_file("results", 0444, kb_dir, NULL, &kb_results_fops);
+	return 0;
+}
+
+static void __exit kb_exit(void)
+{
+	int i;
+
+	debugfs_remove_recursive(kb_dir);
+	kthread_stop(kb_thread);
+	/* the last work of a round may still be returning */
+	for (i = 0; i < ntasks; i++)
+		flush_work(&kb_tasks[i].ws);
+	kpool_destroy(&kb_pool);
+	vfree(kb_tasks);
+	bench_placement_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(kb_init);
+module_exit(kb_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("work-stealing kthread pool vs system workqueues");
+MODULE_LICENSE("Dual MIT/GPL");
@@ -35,26 +35,45 @@
 #include <linux/sched.h>
 #include <linux/types.h>
 
+#include "loadgen.h"
+#include "cacheline.h"
+
 #define MODNAME "[SYNC_ATOMIC] "
 
 atomic_t counter; 	/* shared data: */
 struct task_struct *read_thread, *write_thread;
 
+/* counter is written on every op, the others only at init */
+static const struct cacheline_obj at_globals[] = {
+	CACHELINE_OBJ(counter),
+	CACHELINE_OBJ(read_thread),
+	CACHELINE_OBJ(write_thread),
+	CACHELINE_OBJ(rate_hz),
+};
+
 static int writer_function(void *data)
 {
-	while(!kthread_should_stop()) {
+	struct loadgen lg;
+
+	loadgen_init(&lg, rate_hz, 500);
+	while (loadgen_wait(&lg))
 		atomic_inc(&counter);
-		msleep(500);
-	}
+	loadgen_report(&lg, MODNAME "writer");
 	do_exit(0);
 }
 
 static int read_function(void *data)
 {
-	while(!kthread_should_stop()) {
-		pr_info(MODNAME "counter: %d\n", atomic_read(&counter));
-		msleep(500);
+	struct loadgen lg;
+	int val;
+
+	loadgen_init(&lg, rate_hz, 500);
+	while (loadgen_wait(&lg)) {
+		val = atomic_read(&counter);
+		if (!rate_hz)
+			pr_info(MODNAME "counter: %d\n", val);
 	}
+	loadgen_report(&lg, MODNAME "reader");
 	do_exit(0);
 }
 
@@ -62,6 +81,7 @@ static int __init my_mod_init(void)
 {
 	pr_info("%s Entering module.\n", MODNAME);
 	atomic_set(&counter, 0);
+	cacheline_report(NULL, MODNAME, at_globals, ARRAY_SIZE(at_globals));
 	read_thread = kthread_run(read_function, NULL, "read-thread");
 	write_thread = kthread_run(writer_function, NULL, "write-thread");
 	return 0;
@@ -63,11 +63,19 @@
 #include <linux/delay.h>
 #include <linux/atomic.h>
 
+#include "cacheline.h"
+
 #define LOOPS 100000
 
 unsigned int counter;
 struct task_struct *t1, *t2;
 
+static const struct cacheline_obj counter_globals[] = {
+	CACHELINE_OBJ(counter),
+	CACHELINE_OBJ(t1),
+	CACHELINE_OBJ(t2),
+};
+
 int Kthread_start(void *arg)
 {
 	int local;
@@ -84,6 +92,8 @@ int Kthread_start(void *arg)
 
 int kthr_init(void)
 {
+	cacheline_report(NULL, "kthread_counter: ", counter_globals,
+			 ARRAY_SIZE(counter_globals));
 	t1 = kthread_create(Kthread_start, NULL, "Kthread1");
 	if(IS_ERR(t1)){
 		pr_err("%s: unable to start kernel thread\n",__func__);
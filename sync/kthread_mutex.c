@@ -33,6 +33,8 @@
 #include <linux/mutex.h>
 #include <linux/slab.h>
 
+#include "lockprof.h"
+
 typedef struct {
 	int a;
 	int b;
@@ -42,24 +44,30 @@ static priv_data *p;
 struct task_struct *t1, *t2;
 
 DEFINE_MUTEX(lock);
+DEFINE_LOCKPROF_SITE(reader_site);
+DEFINE_LOCKPROF_SITE(writer_site);
 
 int kthr_reader(void *arg)
 {
+	u64 t;
+
 	pr_info("%s: attempting to lock \n",__func__);
-	mutex_lock(&lock);
+	t = lockprof_mutex_lock(&lock, &reader_site);
 	pr_info("%s: read a = %d, b = %d\n", __func__, p->a, p->b);
-	mutex_unlock(&lock);
+	lockprof_mutex_unlock(&lock, &reader_site, t);
 
 	do_exit(0);
 }
 
 int kthr_writer(void *arg)
 {
-	mutex_lock(&lock);
+	u64 t;
+
+	t = lockprof_mutex_lock(&lock, &writer_site);
 	p->a = 10;
 	ssleep(10);
 	p->b = 20;
-	mutex_unlock(&lock);
+	lockprof_mutex_unlock(&lock, &writer_site, t);
 
 	do_exit(0);
 }
@@ -76,6 +84,10 @@ int kthr_init(void)
 
 	data_init(p);
 
+	lockprof_register(&reader_site);
+	lockprof_register(&writer_site);
+	lockprof_debugfs_create("kthread_mutex");
+
 	t1 = kthread_run(kthr_writer, NULL, "Kwriter");
 	if(IS_ERR(t1)){
                 pr_err("%s: unable to start kernel thread\n",__func__);
@@ -93,6 +105,7 @@ int kthr_init(void)
 
 void kthr_exit(void)
 {
+	lockprof_debugfs_remove();
 	kfree(p);
 }
 
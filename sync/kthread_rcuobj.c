@@ -0,0 +1,128 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/delay.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/jiffies.h>
+
+#include "loadgen.h"
+#include "rcu_obj.h"
+
+#define MODNAME "[SYNC_RCUOBJ]: "
+
+/*
+ * shared data: the counter of kthread_rwspin.c, published through RCU
+ * together with the time of the update that produced it
+ */
+struct counter_cfg {
+	unsigned int counter;
+	unsigned long updated;	/* jiffies */
+};
+
+static RCU_OBJ(struct counter_cfg) counter_cfg;
+
+struct task_struct *read_thread1, *read_thread2, *read_thread3, *write_thread;
+
+static int writer_function(void *data)
+{
+	typeof(*counter_cfg.ptr) *new;
+	struct loadgen lg;
+
+	loadgen_init(&lg, rate_hz, 500);
+	while (loadgen_wait(&lg)) {
+		/* copy, update the copy, publish it; readers still on
+		 * the old one keep it until the grace period ends */
+		new = rcu_obj_copy(&counter_cfg);
+		if (!new)
+			continue;
+		new->data.counter++;
+		new->data.updated = jiffies;
+		rcu_obj_publish(&counter_cfg, new);
+	}
+	loadgen_report(&lg, MODNAME "writer");
+	do_exit(0);
+}
+
+static int read_function(void *data)
+{
+	struct counter_cfg *cfg;
+	struct loadgen lg;
+	unsigned int val;
+	unsigned long updated;
+
+	loadgen_init(&lg, rate_hz, 500);
+	while (loadgen_wait(&lg)) {
+		rcu_read_lock();
+		cfg = rcu_obj_deref(&counter_cfg);
+		val = cfg->counter;
+		updated = cfg->updated;
+		rcu_read_unlock();
+		if (!rate_hz)
+			pr_info("%s:counter: %u (%u ms old)\n", __func__, val,
+				jiffies_to_msecs(jiffies - updated));
+	}
+	loadgen_report(&lg, MODNAME "reader");
+	do_exit(0);
+}
+
+static int __init my_mod_init(void)
+{
+	struct counter_cfg cfg = { .counter = 0, .updated = jiffies };
+
+	pr_info(MODNAME "Entering module.\n");
+	if (rcu_obj_init(&counter_cfg, &cfg))
+		return -ENOMEM;
+	read_thread1 = kthread_run(read_function, NULL, "read-thread1");
+	read_thread2 = kthread_run(read_function, NULL, "read-thread2");
+	read_thread3 = kthread_run(read_function, NULL, "read-thread3");
+	write_thread = kthread_run(writer_function, NULL, "write-thread");
+	return 0;
+}
+
+
+static void __exit my_mod_exit(void)
+{
+	kthread_stop(read_thread3);
+	kthread_stop(read_thread2);
+	kthread_stop(read_thread1);
+	kthread_stop(write_thread);
+	rcu_obj_free(&counter_cfg);
+	pr_info(MODNAME"Exiting module.\n");
+}
+
+module_init(my_mod_init);
+module_exit(my_mod_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("RCU-published object");
+MODULE_LICENSE("Dual MIT/GPL");
@@ -35,6 +35,9 @@
 #include <linux/sched.h>
 #include <linux/rwsem.h>
 
+#include "lockprof.h"
+#include "loadgen.h"
+
 #define MODNAME "[SYNC_RWSEM] "
 
 /* shared data: */
@@ -42,29 +45,46 @@ unsigned int counter;
 
 struct rw_semaphore *counter_rwsem;
 
+DEFINE_LOCKPROF_SITE(reader_site);
+DEFINE_LOCKPROF_SITE(writer_site);
+DEFINE_LOCKPROF_SITE(downgraded_site);
+
 struct task_struct *read_thread, *read_thread2, *write_thread;
 
 static int writer_function(void *data)
 {
-	while (!kthread_should_stop()) {
-		down_write(counter_rwsem);
+	struct loadgen lg;
+	u64 t;
+
+	loadgen_init(&lg, rate_hz, 500);
+	while (loadgen_wait(&lg)) {
+		t = lockprof_down_write(counter_rwsem, &writer_site);
 		counter++;
-		downgrade_write(counter_rwsem);
-		pr_info(MODNAME "(writer) counter: %d\n", counter);
-		up_read(counter_rwsem);
-		msleep(500);
+		t = lockprof_downgrade_write(counter_rwsem, &writer_site,
+					     &downgraded_site, t);
+		if (!rate_hz)
+			pr_info(MODNAME "(writer) counter: %d\n", counter);
+		lockprof_up_read(counter_rwsem, &downgraded_site, t);
 	}
+	loadgen_report(&lg, MODNAME "writer");
 	do_exit(0);
 }
 
 static int read_function(void *data)
 {
-	while (!kthread_should_stop()) {
-		down_read(counter_rwsem);
-		pr_info(MODNAME "counter: %d\n", counter);
-		up_read(counter_rwsem);
-		msleep(500);
+	struct loadgen lg;
+	unsigned int val;
+	u64 t;
+
+	loadgen_init(&lg, rate_hz, 500);
+	while (loadgen_wait(&lg)) {
+		t = lockprof_down_read(counter_rwsem, &reader_site);
+		val = counter;
+		lockprof_up_read(counter_rwsem, &reader_site, t);
+		if (!rate_hz)
+			pr_info(MODNAME "counter: %u\n", val);
 	}
+	loadgen_report(&lg, MODNAME "reader");
 	do_exit(0);
 }
 
@@ -75,6 +95,10 @@ static int __init my_mod_init(void)
 	if (!counter_rwsem)
 		return -1;
 	init_rwsem(counter_rwsem);
+	lockprof_register(&reader_site);
+	lockprof_register(&writer_site);
+	lockprof_register(&downgraded_site);
+	lockprof_debugfs_create("kthread_rwsem");
 	read_thread = kthread_run(read_function, NULL, "read-thread");
 	read_thread2 = kthread_run(read_function, NULL, "read-thread2");
 	write_thread = kthread_run(writer_function, NULL, "write-thread");
@@ -86,6 +110,7 @@ static void __exit my_mod_exit(void)
 	kthread_stop(read_thread);
 	kthread_stop(write_thread);
 	kthread_stop(read_thread2);
+	lockprof_debugfs_remove();
 	kfree(counter_rwsem);
 }
 
@@ -35,6 +35,8 @@
 #include <linux/kthread.h>
 #include <linux/sched.h>
 
+#include "loadgen.h"
+
 #define MODNAME "[SYNC_RWSPINLOCK]: "
 
 /* shared data: */
@@ -46,23 +48,32 @@ struct task_struct *read_thread1, *read_thread2, *read_thread3, *write_thread;
 
 static int writer_function(void *data)
 {
-	while(!kthread_should_stop()) {
+	struct loadgen lg;
+
+	loadgen_init(&lg, rate_hz, 500);
+	while (loadgen_wait(&lg)) {
 		write_lock(&counter_lock);
 		counter++;
 		write_unlock(&counter_lock);
-		msleep(500);
 	}
+	loadgen_report(&lg, MODNAME "writer");
 	do_exit(0);
 }
 
 static int read_function(void *data)
 {
-	while(!kthread_should_stop()) {
+	struct loadgen lg;
+	unsigned int val;
+
+	loadgen_init(&lg, rate_hz, 500);
+	while (loadgen_wait(&lg)) {
 		read_lock(&counter_lock);
-		pr_info("%s:counter: %d\n",__func__, counter);
+		val = counter;
 		read_unlock(&counter_lock);
-		msleep(500);
+		if (!rate_hz)
+			pr_info("%s:counter: %u\n", __func__, val);
 	}
+	loadgen_report(&lg, MODNAME "reader");
 	do_exit(0);
 }
 
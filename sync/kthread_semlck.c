@@ -33,6 +33,8 @@
 #include <linux/semaphore.h>
 #include <linux/slab.h>
 
+#include "lockprof.h"
+
 typedef struct {
 	int a;
 	int b;
@@ -42,24 +44,30 @@ static priv_data *p;
 struct task_struct *t1, *t2;
 
 DEFINE_SEMAPHORE(sem);
+DEFINE_LOCKPROF_SITE(reader_site);
+DEFINE_LOCKPROF_SITE(writer_site);
 
 int kthr_reader(void *arg)
 {
+	u64 t;
+
 	pr_info("%s: attempting to lock \n",__func__);
-	down_interruptible(&sem); //lock
+	lockprof_down_interruptible(&sem, &reader_site, &t); //lock
 	pr_info("%s: read a = %d, b = %d\n", __func__, p->a, p->b);
-	up(&sem);// unlock
+	lockprof_up(&sem, &reader_site, t);// unlock
 
 	do_exit(0);
 }
 
 int kthr_writer(void *arg)
 {
-	down_interruptible(&sem);//lock
+	u64 t;
+
+	lockprof_down_interruptible(&sem, &writer_site, &t);//lock
 	p->a = 10;
 	ssleep(10);
 	p->b = 20;
-	up(&sem);//unlock
+	lockprof_up(&sem, &writer_site, t);//unlock
 	do_exit(0);
 }
 
@@ -74,6 +82,10 @@ int kthr_init(void)
 
 	data_init(p);
 
+	lockprof_register(&reader_site);
+	lockprof_register(&writer_site);
+	lockprof_debugfs_create("kthread_semlck");
+
 	t1 = kthread_run(kthr_writer, NULL, "Kwriter");
 	if(IS_ERR(t1)){
                 pr_err("%s: unable to start kernel thread\n",__func__);
@@ -91,6 +103,7 @@ int kthr_init(void)
 
 void kthr_exit(void)
 {
+	lockprof_debugfs_remove();
 	kfree(p);
 }
 
@@ -32,43 +32,118 @@
 #include <linux/delay.h>
 #include <linux/spinlock.h>
 #include <linux/slab.h>
+#include <linux/string.h>
+
+#include "lockprof.h"
+#include "qlocks.h"
+
+static char *lock_type = "spinlock";
+module_param(lock_type, charp, 0444);
+MODULE_PARM_DESC(lock_type, "spinlock, ticket, mcs or clh (see qlocks.h)");
+
+enum { PRIV_SPIN, PRIV_TICKET, PRIV_MCS, PRIV_CLH, PRIV_NR_LOCKS };
+
+static const char * const priv_lock_names[PRIV_NR_LOCKS] = {
+	"spinlock", "ticket", "mcs", "clh",
+};
 
 typedef struct {
 	int a;
 	int b;
 	spinlock_t lock;
+	struct ticket_spin ticket;
+	struct mcs_spin mcs;
+	struct clh_spin clh;
 } priv_data;
 
 static priv_data *p;
+static int priv_lock_type;
 struct task_struct *t1, *t2;
 
+/* per thread lock state; CLH nodes change hands, so keep them global */
+struct priv_ctx {
+	struct mcs_node mcs;
+	struct clh_handle clh;
+};
+
+static struct priv_ctx reader_ctx, writer_ctx;
+
+DEFINE_LOCKPROF_SITE(reader_site);
+DEFINE_LOCKPROF_SITE(writer_site);
+
+static u64 priv_lock(struct priv_ctx *c, struct lockprof_site *site)
+{
+	switch (priv_lock_type) {
+	case PRIV_TICKET:
+		return __lockprof_lock(site, ticket_spin_lock(&p->ticket));
+	case PRIV_MCS:
+		return __lockprof_lock(site, mcs_spin_lock(&p->mcs, &c->mcs));
+	case PRIV_CLH:
+		return __lockprof_lock(site, clh_spin_lock(&p->clh, &c->clh));
+	}
+	return lockprof_spin_lock(&p->lock, site);
+}
+
+static void priv_unlock(struct priv_ctx *c, struct lockprof_site *site, u64 t)
+{
+	switch (priv_lock_type) {
+	case PRIV_TICKET:
+		__lockprof_unlock(site, t, ticket_spin_unlock(&p->ticket));
+		return;
+	case PRIV_MCS:
+		__lockprof_unlock(site, t, mcs_spin_unlock(&p->mcs, &c->mcs));
+		return;
+	case PRIV_CLH:
+		__lockprof_unlock(site, t, clh_spin_unlock(&c->clh));
+		return;
+	}
+	lockprof_spin_unlock(&p->lock, site, t);
+}
+
 int kthr_reader(void *arg)
 {
+	u64 t;
+
 	pr_info("%s: attempting to lock \n", __func__);
-	spin_lock(&p->lock);
+	t = priv_lock(&reader_ctx, &reader_site);
 	pr_info("%s: read a = %d, b = %d\n", __func__, p->a, p->b);
-	spin_unlock(&p->lock);
+	priv_unlock(&reader_ctx, &reader_site, t);
 	do_exit(0);
 }
 
 int kthr_writer(void *arg)
 {
-	spin_lock(&p->lock);
+	u64 t;
+
+	t = priv_lock(&writer_ctx, &writer_site);
 	p->a = 10;
 	p->b = 20;
-	spin_unlock(&p->lock);
+	priv_unlock(&writer_ctx, &writer_site, t);
 	do_exit(0);
 }
 
 void data_init(priv_data * data)
 {
 	spin_lock_init(&data->lock);
+	ticket_spin_init(&data->ticket);
+	mcs_spin_init(&data->mcs);
+	clh_spin_init(&data->clh);
+	clh_handle_init(&reader_ctx.clh);
+	clh_handle_init(&writer_ctx.clh);
 	data->a = 0;
 	data->b = 0;
 }
 
 int kthr_init(void)
 {
+	for (priv_lock_type = 0; priv_lock_type < PRIV_NR_LOCKS; priv_lock_type++)
+		if (!strcmp(lock_type, priv_lock_names[priv_lock_type]))
+			break;
+	if (priv_lock_type == PRIV_NR_LOCKS) {
+		pr_err("%s: unknown lock_type '%s'\n", __func__, lock_type);
+		return -EINVAL;
+	}
+
 	p = (priv_data *) kmalloc(sizeof(priv_data), GFP_KERNEL);
 	if(IS_ERR(p)){
                 pr_err("%s: unable to allocate memory\n",__func__);
@@ -77,6 +152,10 @@ int kthr_init(void)
 
 	data_init(p);
 
+	lockprof_register(&reader_site);
+	lockprof_register(&writer_site);
+	lockprof_debugfs_create("kthread_spin");
+
 	t1 = kthread_run(kthr_writer, NULL, "Kwriter");
 	if(IS_ERR(t1)){
                 pr_err("%s: unable to start kernel thread\n",__func__);
@@ -94,6 +173,7 @@ int kthr_init(void)
 
 void kthr_exit(void)
 {
+	lockprof_debugfs_remove();
 	kfree(p);
 }
 
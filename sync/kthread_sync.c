@@ -34,6 +34,9 @@
 #include <linux/semaphore.h>    
 #include <linux/delay.h>	
 
+#include "adaptive_wait.h"
+#include "rtsched.h"
+
 /*
  * data package passed to threads
  */
@@ -47,6 +50,12 @@ static struct kthr_data prod, cons;
 static struct semaphore psem, csem;
 static struct task_struct *pthr, *cthr;
 
+static bool spin_wait;
+module_param(spin_wait, bool, 0444);
+MODULE_PARM_DESC(spin_wait, "Consumer polls briefly before sleeping (see adaptive_wait.h)");
+
+static struct adaptive_wait cons_aw;
+
 int prod_fct(void *data)
 {
 	struct kthr_data *pdata = (struct kthr_data*)data;
@@ -66,7 +75,10 @@ int cons_fct(void *data)
 {
         struct kthr_data *pdata = (struct kthr_data*)data;
         while(1) {
-                down(pdata->sem1);// wait for producer
+		if (spin_wait)
+			adaptive_down(&cons_aw, pdata->sem1);
+		else
+			down(pdata->sem1);// wait for producer
                 pr_info("%s: signal recvd form producer\n", pdata->name);
                 mdelay(100);
                 pr_info("%s: Done consuming, notify producer & wait for next chunck\n",pdata->name);
@@ -79,6 +91,12 @@ int cons_fct(void *data)
 
 int __init kthr_init(void)
 {
+	int ret = rtsched_init();
+
+	if (ret)
+		return ret;
+
+	adaptive_wait_init(&cons_aw, 20 * NSEC_PER_USEC);
 	sema_init(&psem, 1); 
 	sema_init(&csem, 0);
 
@@ -91,19 +109,37 @@ int __init kthr_init(void)
 	cons.sem1 = &csem; 
 	cons.sem2 = &psem;
 
-	pthr = kthread_run(prod_fct, &prod,"producer");
-	if(IS_ERR(pthr)){
-                pr_err("%s: unable to start kernel thread\n",__func__);
-                return PTR_ERR(pthr);
-        }
-
-	cthr = kthread_run(cons_fct, &cons,"consumer");
-	if(IS_ERR(cthr)){
-                pr_err("%s: unable to start kernel thread\n",__func__);
-                return PTR_ERR(cthr);
-        }
-
+	/*
+	 * Both threads are created stopped and only woken once they are in
+	 * their class: a lone producer would block on its peer forever and
+	 * could not be stopped.
+	 */
+	pthr = kthread_create(prod_fct, &prod, "producer");
+	if (IS_ERR(pthr)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		return PTR_ERR(pthr);
+	}
+	cthr = kthread_create(cons_fct, &cons, "consumer");
+	if (IS_ERR(cthr)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		ret = PTR_ERR(cthr);
+		goto out_pthr;
+	}
+	ret = rtsched_apply(pthr);
+	if (!ret)
+		ret = rtsched_apply(cthr);
+	if (ret)
+		goto out_cthr;
+
+	wake_up_process(pthr);
+	wake_up_process(cthr);
 	return 0;
+
+out_cthr:
+	kthread_stop(cthr);
+out_pthr:
+	kthread_stop(pthr);
+	return ret;
 }
 
 void __exit kthr_exit(void)
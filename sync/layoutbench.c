@@ -0,0 +1,396 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * False sharing: the same workloads with different data layouts
+ *
+ * Each workload runs with three layouts of the data its threads touch:
+ *
+ *   packed	next to each other, as kthread_spin.c's priv_data or the
+ *		bare globals of kthread_at.c and kthread_counter.c
+ *   aligned	every hot object in its own ____cacheline_aligned line
+ *   percpu	DEFINE_PER_CPU, the thread uses its CPU's copy
+ *
+ * Workloads:
+ *
+ *   counter	every thread increments its own counter
+ *   lock	every thread takes its own spinlock and updates a, b
+ *		under it (priv_data from kthread_spin.c, one per thread)
+ *   readmostly	thread 0 increments a hit counter, the others read a
+ *		limit that is only written at init
+ *
+ * No data is shared between threads in the first two, so any slowdown
+ * of packed over aligned is false sharing. The results also list which
+ * of the module's own globals share a cache line (cacheline.h).
+ *
+ *   insmod layoutbench.ko nthreads=8 placement=scatter
+ *   cat /sys/kernel/debug/layoutbench/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/cache.h>
+
+#include "bench.h"
+#include "cacheline.h"
+
+#define MODNAME "[LAYOUTBENCH] "
+
+#define LY_MAX_THREADS	256
+
+static char *workload = "all";
+module_param(workload, charp, 0444);
+MODULE_PARM_DESC(workload, "all, counter, lock or readmostly");
+
+static int nthreads;
+module_param(nthreads, int, 0444);
+MODULE_PARM_DESC(nthreads, "Worker threads (0 = one per online CPU, at most 256)");
+
+static int duration_ms = 2000;
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Run length per workload and layout in ms");
+
+enum { LY_COUNTER, LY_LOCK, LY_READMOSTLY, LY_NR_WORKLOADS };
+enum { LY_PACKED, LY_ALIGNED, LY_PERCPU, LY_NR_LAYOUTS };
+
+static const char * const ly_workload_names[LY_NR_WORKLOADS] = {
+	[LY_COUNTER]	= "counter",
+	[LY_LOCK]	= "lock",
+	[LY_READMOSTLY]	= "readmostly",
+};
+
+static const char * const ly_layout_names[LY_NR_LAYOUTS] = {
+	[LY_PACKED]	= "packed",
+	[LY_ALIGNED]	= "aligned",
+	[LY_PERCPU]	= "percpu",
+};
+
+/* counter */
+static u64 ly_count_packed[LY_MAX_THREADS];
+static struct ly_count {
+	u64 v;
+} ____cacheline_aligned_in_smp ly_count_aligned[LY_MAX_THREADS];
+static DEFINE_PER_CPU(u64, ly_count_pcpu);
+
+/* lock, priv_data of kthread_spin.c */
+struct ly_locked {
+	int a;
+	int b;
+	spinlock_t lock;
+};
+
+static struct ly_locked ly_lock_packed[LY_MAX_THREADS];
+static struct ly_locked_aligned {
+	struct ly_locked d;
+} ____cacheline_aligned_in_smp ly_lock_aligned[LY_MAX_THREADS];
+static DEFINE_PER_CPU(struct ly_locked, ly_lock_pcpu);
+
+/* readmostly */
+static struct {
+	u64 hits;
+	u64 limit;
+} ly_rm_packed;
+static struct {
+	u64 hits ____cacheline_aligned_in_smp;
+	u64 limit ____cacheline_aligned_in_smp;
+} ly_rm_aligned;
+static DEFINE_PER_CPU(u64, ly_rm_hits_pcpu);
+static u64 ly_rm_limit __read_mostly;
+
+static const struct cacheline_obj ly_globals[] = {
+	CACHELINE_OBJ(ly_count_packed[0]),
+	CACHELINE_OBJ(ly_count_packed[1]),
+	CACHELINE_OBJ(ly_count_aligned[0]),
+	CACHELINE_OBJ(ly_count_aligned[1]),
+	CACHELINE_OBJ(ly_lock_packed[0]),
+	CACHELINE_OBJ(ly_lock_packed[1]),
+	CACHELINE_OBJ(ly_lock_aligned[0]),
+	CACHELINE_OBJ(ly_lock_aligned[1]),
+	CACHELINE_OBJ(ly_rm_packed.hits),
+	CACHELINE_OBJ(ly_rm_packed.limit),
+	CACHELINE_OBJ(ly_rm_aligned.hits),
+	CACHELINE_OBJ(ly_rm_aligned.limit),
+	CACHELINE_OBJ(ly_rm_limit),
+};
+
+static inline void ly_inc(u64 *v)
+{
+	WRITE_ONCE(*v, READ_ONCE(*v) + 1);
+}
+
+static void ly_locked_update(struct ly_locked *d)
+{
+	spin_lock(&d->lock);
+	d->a++;
+	d->b = d->a;
+	spin_unlock(&d->lock);
+}
+
+/* thread 0 writes the hit counter, the others read the limit */
+static void ly_readmostly(u64 *hits, u64 *limit, int id, u64 *sink)
+{
+	if (!id)
+		ly_inc(hits);
+	else
+		*sink += READ_ONCE(*limit);
+}
+
+static void ly_op(int w, int l, int id, u64 *sink)
+{
+	switch (w * LY_NR_LAYOUTS + l) {
+	case LY_COUNTER * LY_NR_LAYOUTS + LY_PACKED:
+		ly_inc(&ly_count_packed[id]);
+		break;
+	case LY_COUNTER * LY_NR_LAYOUTS + LY_ALIGNED:
+		ly_inc(&ly_count_aligned[id].v);
+		break;
+	case LY_COUNTER * LY_NR_LAYOUTS + LY_PERCPU:
+		this_cpu_inc(ly_count_pcpu);
+		break;
+	case LY_LOCK * LY_NR_LAYOUTS + LY_PACKED:
+		ly_locked_update(&ly_lock_packed[id]);
+		break;
+	case LY_LOCK * LY_NR_LAYOUTS + LY_ALIGNED:
+		ly_locked_update(&ly_lock_aligned[id].d);
+		break;
+	case LY_LOCK * LY_NR_LAYOUTS + LY_PERCPU:
+		/* the lock makes it safe if we migrate after picking the CPU */
+		ly_locked_update(raw_cpu_ptr(&ly_lock_pcpu));
+		break;
+	case LY_READMOSTLY * LY_NR_LAYOUTS + LY_PACKED:
+		ly_readmostly(&ly_rm_packed.hits, &ly_rm_packed.limit, id, sink);
+		break;
+	case LY_READMOSTLY * LY_NR_LAYOUTS + LY_ALIGNED:
+		ly_readmostly(&ly_rm_aligned.hits, &ly_rm_aligned.limit, id,
+			      sink);
+		break;
+	case LY_READMOSTLY * LY_NR_LAYOUTS + LY_PERCPU:
+		if (!id)
+			this_cpu_inc(ly_rm_hits_pcpu);
+		else
+			*sink += READ_ONCE(ly_rm_limit);
+		break;
+	}
+}
+
+struct ly_thread {
+	struct task_struct *task;
+	int id;
+	u64 ops;
+} ____cacheline_aligned_in_smp;
+
+struct ly_result {
+	bool ran;
+	u64 ops;
+	u64 ns;
+	struct bench_perf_sum perf;
+};
+
+static struct ly_thread *ly_threads;
+static struct ly_result ly_results[LY_NR_WORKLOADS][LY_NR_LAYOUTS];
+static int ly_workload, ly_layout;
+static struct bench_ctl ly_ctl;
+static struct task_struct *ly_task;
+static DECLARE_COMPLETION(ly_all_done);
+static struct dentry *ly_dir;
+
+static int ly_worker(void *arg)
+{
+	struct ly_thread *t = arg;
+	struct bench_perf perf;
+	u64 n = 0, sink = 0;
+
+	bench_perf_open(&perf);
+	bench_gate(&ly_ctl);
+	bench_perf_start(&perf);
+	while (bench_running(&ly_ctl)) {
+		ly_op(ly_workload, ly_layout, t->id, &sink);
+		if (++n % 1024 == 0)
+			cond_resched();
+	}
+	barrier_data(&sink);
+	bench_perf_stop(&perf, &ly_ctl);
+	t->ops = n;
+	bench_done(&ly_ctl);
+	return 0;
+}
+
+static int ly_run(int w, int l)
+{
+	struct ly_result *r = &ly_results[w][l];
+	int i, ret = 0;
+
+	ly_workload = w;
+	ly_layout = l;
+	bench_ctl_init(&ly_ctl, nthreads, duration_ms);
+	for (i = 0; i < nthreads; i++) {
+		ly_threads[i].id = i;
+		ly_threads[i].ops = 0;
+		ly_threads[i].task = bench_kthread_run(ly_worker, &ly_threads[i],
+						       "layoutbench", i);
+		if (IS_ERR(ly_threads[i].task)) {
+			ret = PTR_ERR(ly_threads[i].task);
+			pr_err("%s: unable to start kernel thread\n", __func__);
+			while (--i >= 0)
+				kthread_stop(ly_threads[i].task);
+			goto out;
+		}
+	}
+
+	wait_for_completion(&ly_ctl.finished);
+	for (i = 0; i < nthreads; i++) {
+		kthread_stop(ly_threads[i].task);
+		r->ops += ly_threads[i].ops;
+	}
+	r->ns = bench_elapsed_ns(&ly_ctl);
+	r->perf = ly_ctl.perf;
+	r->ran = true;
+out:
+	bench_ctl_cleanup(&ly_ctl);
+	return ret;
+}
+
+static int ly_main(void *arg)
+{
+	int w, l;
+
+	for (w = 0; w < LY_NR_WORKLOADS; w++) {
+		if (strcmp(workload, "all") &&
+		    strcmp(workload, ly_workload_names[w]))
+			continue;
+		for (l = 0; l < LY_NR_LAYOUTS; l++)
+			if (kthread_should_stop() || ly_run(w, l))
+				goto out;
+	}
+out:
+	complete(&ly_all_done);
+	bench_park();
+	return 0;
+}
+
+static int ly_results_show(struct seq_file *m, void *v)
+{
+	struct ly_result *r;
+	u64 rate, packed, x;
+	int w, l;
+
+	if (!completion_done(&ly_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_printf(m, "threads %d duration_ms %d cache_line %d\n",
+		   nthreads, duration_ms, SMP_CACHE_BYTES);
+	bench_placement_show(m);
+	seq_printf(m, "%-12s %-8s %14s %10s\n", "workload", "layout",
+		   "ops/s", "vs_packed");
+	for (w = 0; w < LY_NR_WORKLOADS; w++) {
+		packed = bench_rate(ly_results[w][LY_PACKED].ops,
+				    ly_results[w][LY_PACKED].ns);
+		for (l = 0; l < LY_NR_LAYOUTS; l++) {
+			r = &ly_results[w][l];
+			if (!r->ran)
+				continue;
+			rate = bench_rate(r->ops, r->ns);
+			x = bench_milli(rate, packed);
+			seq_printf(m, "%-12s %-8s %14llu "
+				   BENCH_MILLI_FMTW(5) "x",
+				   ly_workload_names[w], ly_layout_names[l],
+				   rate, BENCH_MILLI_ARG(x));
+			bench_perf_show(m, &r->perf, r->ops);
+			seq_putc(m, '\n');
+		}
+	}
+
+	seq_puts(m, "\nglobals sharing a cache line:\n");
+	if (!cacheline_report(m, "", ly_globals, ARRAY_SIZE(ly_globals)))
+		seq_puts(m, "none\n");
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ly_results);
+
+static int __init ly_init(void)
+{
+	int i, cpu, ret;
+
+	if (nthreads <= 0)
+		nthreads = num_online_cpus();
+	nthreads = min(nthreads, LY_MAX_THREADS);
+
+	for (i = 0; i < LY_MAX_THREADS; i++) {
+		spin_lock_init(&ly_lock_packed[i].lock);
+		spin_lock_init(&ly_lock_aligned[i].d.lock);
+	}
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu(ly_lock_pcpu, cpu).lock);
+	ly_rm_packed.limit = ly_rm_aligned.limit = ly_rm_limit = 1000;
+
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+	ly_threads = kcalloc(nthreads, sizeof(*ly_threads), GFP_KERNEL);
+	if (!ly_threads) {
+		bench_placement_free();
+		return -ENOMEM;
+	}
+
+	ly_task = kthread_run(ly_main, NULL, "layoutbench");
+	if (IS_ERR(ly_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		kfree(ly_threads);
+		bench_placement_free();
+		return PTR_ERR(ly_task);
+	}
+
+	ly_dir = debugfs_create_dir("layoutbench", NULL);
+	debugfs_create_file("results", 0444, ly_dir, NULL, &ly_results_fops);
+	return 0;
+}
+
+static void __exit ly_exit(void)
+{
+	debugfs_remove_recursive(ly_dir);
+	kthread_stop(ly_task);
+	kfree(ly_threads);
+	bench_placement_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(ly_init);
+module_exit(ly_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("false sharing layout benchmark");
+MODULE_LICENSE("Dual MIT/GPL");
@@ -0,0 +1,317 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Open-loop load benchmark
+ *
+ * nthreads generator threads together issue rate_hz operations per
+ * second on a schedule fixed in advance (loadgen.h), each thread taking
+ * every nthreads-th slot. An operation takes a shared spinlock or mutex
+ * and holds it for cs_ns (or does nothing with op=none). Because the
+ * schedule does not wait for slow operations, latency is measured from
+ * the time the operation was due, so it includes the time spent queued
+ * behind earlier ones. Sweeping the rate towards what the lock can
+ * sustain shows the queueing knee.
+ *
+ *   insmod loadbench.ko rate_hz=10000,100000,1000000 nthreads=4 op=mutex
+ *   cat /sys/kernel/debug/loadbench/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+
+#include "bench.h"
+/* rate_hz= is the list of total rates below */
+#define LOADGEN_NO_RATE_PARAM
+#include "loadgen.h"
+
+#define MODNAME "[LOADBENCH] "
+
+#define LD_MAX_RATES	16
+
+static char *op = "spinlock";
+module_param(op, charp, 0444);
+MODULE_PARM_DESC(op, "Operation: none, spinlock or mutex");
+
+static uint rate_hz[LD_MAX_RATES] = { 1000, 10000, 100000, 1000000 };
+static int nr_rates = 4;
+module_param_array(rate_hz, uint, &nr_rates, 0444);
+MODULE_PARM_DESC(rate_hz, "Total operation rates to run, in Hz");
+
+static int nthreads = 1;
+module_param(nthreads, int, 0444);
+MODULE_PARM_DESC(nthreads, "Generator threads sharing the rate");
+
+static int cs_ns = 500;
+module_param(cs_ns, int, 0444);
+MODULE_PARM_DESC(cs_ns, "Time each operation holds the lock in ns");
+
+static int duration_ms = 2000;
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Run length per rate in ms");
+
+enum { LD_NONE, LD_SPINLOCK, LD_MUTEX, LD_NR_OPS };
+
+static const char * const ld_op_names[LD_NR_OPS] = {
+	[LD_NONE]	= "none",
+	[LD_SPINLOCK]	= "spinlock",
+	[LD_MUTEX]	= "mutex",
+};
+
+static int ld_op;
+static DEFINE_SPINLOCK(ld_spin);
+static DEFINE_MUTEX(ld_mutex);
+
+struct ld_thread {
+	struct task_struct *task;
+	int id;
+	u64 ops;
+	u64 late;
+	struct bench_hist slip;
+	struct bench_hist lat;
+} ____cacheline_aligned_in_smp;
+
+struct ld_result {
+	bool ran;
+	u64 ns;
+	u64 ops;
+	u64 late;
+	struct bench_hist slip;
+	struct bench_hist lat;
+	struct bench_perf_sum perf;
+};
+
+static struct ld_thread *ld_threads;
+static struct ld_result *ld_results;
+static u64 ld_rate;
+static struct bench_ctl ld_ctl;
+static struct task_struct *ld_task;
+static DECLARE_COMPLETION(ld_all_done);
+static struct dentry *ld_dir;
+
+static void ld_do_op(void)
+{
+	switch (ld_op) {
+	case LD_SPINLOCK:
+		spin_lock(&ld_spin);
+		bench_spin_ns(cs_ns);
+		spin_unlock(&ld_spin);
+		break;
+	case LD_MUTEX:
+		mutex_lock(&ld_mutex);
+		bench_spin_ns(cs_ns);
+		mutex_unlock(&ld_mutex);
+		break;
+	}
+}
+
+static int ld_thread_fn(void *arg)
+{
+	struct ld_thread *t = arg;
+	struct bench_perf perf;
+	struct loadgen lg;
+	u64 t0;
+
+	loadgen_init(&lg, div_u64(ld_rate, nthreads), 0);
+	bench_perf_open(&perf);
+	bench_gate(&ld_ctl);
+	bench_perf_start(&perf);
+	/* thread n takes the n-th slot of every nthreads */
+	loadgen_start_at(&lg, ktime_to_ns(ld_ctl.start) +
+			 div_u64(lg.period_ns * t->id, nthreads));
+	/* the last wait may end after the run, that slot is not used */
+	while (loadgen_wait(&lg) && bench_running(&ld_ctl)) {
+		t0 = ktime_get_ns();
+		ld_do_op();
+		bench_hist_add(&t->slip, t0 - lg.sched_ns);
+		bench_hist_add(&t->lat, ktime_get_ns() - lg.sched_ns);
+		t->ops++;
+	}
+	t->late = lg.late;
+	bench_perf_stop(&perf, &ld_ctl);
+	bench_done(&ld_ctl);
+	return 0;
+}
+
+static int ld_run(int step)
+{
+	struct ld_result *r = &ld_results[step];
+	int i, ret = 0;
+
+	ld_rate = max_t(u64, rate_hz[step], nthreads);
+	for (i = 0; i < nthreads; i++) {
+		memset(&ld_threads[i], 0, sizeof(ld_threads[i]));
+		ld_threads[i].id = i;
+		bench_hist_init(&ld_threads[i].slip);
+		bench_hist_init(&ld_threads[i].lat);
+	}
+
+	bench_ctl_init(&ld_ctl, nthreads, duration_ms);
+	for (i = 0; i < nthreads; i++) {
+		ld_threads[i].task = bench_kthread_run(ld_thread_fn,
+					&ld_threads[i], "loadbench", i);
+		if (IS_ERR(ld_threads[i].task)) {
+			ret = PTR_ERR(ld_threads[i].task);
+			pr_err("%s: unable to start kernel thread\n", __func__);
+			while (--i >= 0)
+				kthread_stop(ld_threads[i].task);
+			goto out;
+		}
+	}
+
+	wait_for_completion(&ld_ctl.finished);
+	/* not bench_elapsed_ns(): slow rates sleep past the end of the run */
+	r->ns = ld_ctl.duration_ns;
+	bench_hist_init(&r->slip);
+	bench_hist_init(&r->lat);
+	for (i = 0; i < nthreads; i++) {
+		kthread_stop(ld_threads[i].task);
+		r->ops += ld_threads[i].ops;
+		r->late += ld_threads[i].late;
+		bench_hist_merge(&r->slip, &ld_threads[i].slip);
+		bench_hist_merge(&r->lat, &ld_threads[i].lat);
+	}
+	r->perf = ld_ctl.perf;
+	r->ran = true;
+out:
+	bench_ctl_cleanup(&ld_ctl);
+	return ret;
+}
+
+static int ld_main(void *arg)
+{
+	int s;
+
+	for (s = 0; s < nr_rates; s++)
+		if (kthread_should_stop() || ld_run(s))
+			break;
+	complete(&ld_all_done);
+	bench_park();
+	return 0;
+}
+
+static int ld_results_show(struct seq_file *m, void *v)
+{
+	int s;
+
+	if (!completion_done(&ld_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_printf(m, "op %s cs_ns %d threads %d duration_ms %d\n",
+		   ld_op_names[ld_op], cs_ns, nthreads, duration_ms);
+	bench_placement_show(m);
+	seq_printf(m, "%10s %10s %7s %10s %10s %12s %10s %10s %12s\n",
+		   "target_hz", "achieved", "late%", "slip_p50", "slip_p99",
+		   "slip_max", "lat_p50", "lat_p99", "lat_max");
+	for (s = 0; s < nr_rates; s++) {
+		struct ld_result *r = &ld_results[s];
+		u64 late = bench_milli(r->late * 100, r->ops);
+
+		if (!r->ran)
+			continue;
+		seq_printf(m, "%10u %10llu " BENCH_MILLI_FMTW(3)
+			   " %10llu %10llu %12llu %10llu %10llu %12llu",
+			   rate_hz[s], bench_rate(r->ops, r->ns),
+			   BENCH_MILLI_ARG(late),
+			   bench_hist_pct(&r->slip, 500),
+			   bench_hist_pct(&r->slip, 990), r->slip.max,
+			   bench_hist_pct(&r->lat, 500),
+			   bench_hist_pct(&r->lat, 990), r->lat.max);
+		bench_perf_show(m, &r->perf, r->ops);
+		seq_putc(m, '\n');
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ld_results);
+
+static int __init ld_init(void)
+{
+	int ret;
+
+	for (ld_op = 0; ld_op < LD_NR_OPS; ld_op++)
+		if (!strcmp(op, ld_op_names[ld_op]))
+			break;
+	if (ld_op == LD_NR_OPS) {
+		pr_err(MODNAME "unknown op '%s'\n", op);
+		return -EINVAL;
+	}
+	if (nthreads <= 0)
+		nthreads = 1;
+
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+	ld_threads = vzalloc(array_size(nthreads, sizeof(*ld_threads)));
+	ld_results = vzalloc(array_size(LD_MAX_RATES, sizeof(*ld_results)));
+	if (!ld_threads || !ld_results) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	ld_task = kthread_run(ld_main, NULL, "loadbench");
+	if (IS_ERR(ld_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		ret = PTR_ERR(ld_task);
+		goto fail;
+	}
+
+	ld_dir = debugfs_create_dir("loadbench", NULL);
+	debugfs_create_file("results", 0444, ld_dir, NULL, &ld_results_fops);
+	return 0;
+fail:
+	vfree(ld_threads);
+	vfree(ld_results);
+	bench_placement_free();
+	return ret;
+}
+
+static void __exit ld_exit(void)
+{
+	debugfs_remove_recursive(ld_dir);
+	kthread_stop(ld_task);
+	vfree(ld_threads);
+	vfree(ld_results);
+	bench_placement_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(ld_init);
+module_exit(ld_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("open-loop hrtimer paced load against a shared lock");
+MODULE_LICENSE("Dual MIT/GPL");
@@ -0,0 +1,170 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Open-loop, hrtimer paced load generation.
+ *
+ * The demo threads pace themselves with msleep(500): at most 2 Hz,
+ * jiffy granular, and closed loop, i.e. a slow operation delays the
+ * next one, so queueing never shows. A loadgen schedules operation k at
+ * start + k * period no matter how long the previous ones took. An
+ * operation that starts late keeps its slot: the generator catches up
+ * instead of skipping, and the lateness is reported as slippage.
+ *
+ * Waits longer than LOADGEN_SPIN_NS sleep on an absolute hrtimer and
+ * spin the rest, so periods from seconds down to a few hundred ns
+ * (several MHz per thread) are kept. A rate of 0 falls back to
+ * msleep(idle_ms) between operations, the old behaviour.
+ *
+ * Usage (one struct per thread):
+ *	loadgen_init(&lg, rate_hz, 500);
+ *	while (loadgen_wait(&lg))
+ *		do_op();
+ *	loadgen_report(&lg, "writer");
+ *
+ * Including this header gives the module a rate_hz= param for the demos
+ * to pass in. They only log every operation when rate_hz is 0, since
+ * anything faster would flood the log. Modules with a rate param of
+ * their own define LOADGEN_NO_RATE_PARAM before the include.
+ */
+#ifndef _SYNC_LOADGEN_H
+#define _SYNC_LOADGEN_H
+
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/moduleparam.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+
+#define LOADGEN_SPIN_NS	(20 * NSEC_PER_USEC)
+
+#ifndef LOADGEN_NO_RATE_PARAM
+static unsigned int rate_hz;
+module_param(rate_hz, uint, 0444);
+MODULE_PARM_DESC(rate_hz, "Open-loop operations per second per thread (0 = msleep(500) between them)");
+#endif
+
+struct loadgen {
+	u64 period_ns;		/* 0: msleep(idle_ms) paced */
+	unsigned int idle_ms;
+	u64 start_ns;
+	u64 next_ns;		/* when the next operation is due */
+	u64 sched_ns;		/* when the current one was due */
+
+	/* statistics */
+	u64 ops;
+	u64 late;		/* started more than one period late */
+	u64 slip_sum;
+	u64 slip_max;
+};
+
+static inline void loadgen_init(struct loadgen *lg, u64 hz,
+				unsigned int idle_ms)
+{
+	memset(lg, 0, sizeof(*lg));
+	if (hz)
+		lg->period_ns = max_t(u64, div64_u64(NSEC_PER_SEC, hz), 1);
+	lg->idle_ms = idle_ms;
+}
+
+/* first operation at @start_ns instead of the first loadgen_wait() */
+static inline void loadgen_start_at(struct loadgen *lg, u64 start_ns)
+{
+	lg->start_ns = lg->next_ns = start_ns;
+}
+
+/*
+ * Wait until the next operation is due. Returns false when the calling
+ * kthread is being stopped.
+ */
+static inline bool loadgen_wait(struct loadgen *lg)
+{
+	u64 now, slip;
+
+	if (!lg->period_ns) {
+		if (lg->ops++)
+			msleep(lg->idle_ms);
+		return !kthread_should_stop();
+	}
+
+	now = ktime_get_ns();
+	if (!lg->start_ns)
+		loadgen_start_at(lg, now);
+
+	if (lg->next_ns > now + LOADGEN_SPIN_NS) {
+		ktime_t expires = ns_to_ktime(lg->next_ns - LOADGEN_SPIN_NS);
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_hrtimeout_range(&expires, 0, HRTIMER_MODE_ABS);
+	} else {
+		cond_resched();
+	}
+	while ((now = ktime_get_ns()) < lg->next_ns) {
+		if (kthread_should_stop())
+			return false;
+		cpu_relax();
+	}
+	if (kthread_should_stop())
+		return false;
+
+	slip = now - lg->next_ns;
+	lg->ops++;
+	lg->slip_sum += slip;
+	lg->slip_max = max(lg->slip_max, slip);
+	if (slip > lg->period_ns)
+		lg->late++;
+	lg->sched_ns = lg->next_ns;
+	lg->next_ns += lg->period_ns;
+	return true;
+}
+
+/* achieved operations per second so far */
+static inline u64 loadgen_rate(const struct loadgen *lg)
+{
+	u64 ns = ktime_get_ns() - lg->start_ns;
+
+	if (!lg->start_ns || !ns)
+		return 0;
+	return mul_u64_u64_div_u64(lg->ops, NSEC_PER_SEC, ns);
+}
+
+static inline void loadgen_report(const struct loadgen *lg, const char *name)
+{
+	if (!lg->period_ns)
+		return;
+	pr_info("%s: target %llu Hz achieved %llu Hz ops %llu slip avg %llu max %llu ns late %llu\n",
+		name, div64_u64(NSEC_PER_SEC, lg->period_ns), loadgen_rate(lg),
+		lg->ops, lg->ops ? div64_u64(lg->slip_sum, lg->ops) : 0,
+		lg->slip_max, lg->late);
+}
+
+#endif /* _SYNC_LOADGEN_H */
@@ -0,0 +1,474 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Lock primitive contention benchmark
+ *
+ * One module covering the primitives demonstrated one by one in
+ * kthread_spin.c, kthread_mutex.c, kthread_semlck.c, kthread_rwspin.c,
+ * kthread_rwsem.c, kthread_seq.c and list_rcu.c, plus the ticket, MCS,
+ * CLH and reader-biased locks of qlocks.h.
+ *
+ * nthreads workers loop for duration_ms; each iteration is a read
+ * section with probability read_pct (primitives with a shared side
+ * only) or a write section otherwise, followed by think_ns of work
+ * outside the lock. Critical sections burn cs_ns while touching the
+ * shared data. Acquire latency is the time from the lock call until
+ * the lock is held (for seqlock readers: until the attempt that did
+ * not retry began). Exclusive sections also count lock handoffs to a
+ * different CPU and to a different NUMA node, the cache line transfers
+ * the lock algorithm causes.
+ *
+ *   insmod lockbench.ko prim=rwsem nthreads=16 read_pct=95 cs_ns=200
+ *   cat /sys/kernel/debug/lockbench/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/rtmutex.h>
+#include <linux/semaphore.h>
+#include <linux/rwsem.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
+#include <linux/random.h>
+
+#include "bench.h"
+#include "qlocks.h"
+
+#define MODNAME "[LOCKBENCH] "
+
+static char *prim = "spinlock";
+module_param(prim, charp, 0444);
+MODULE_PARM_DESC(prim, "spinlock, mutex, rt_mutex, semaphore, rwlock, rwsem, seqlock, rcu, ticket, mcs, clh or rbias");
+
+static int nthreads;
+module_param(nthreads, int, 0444);
+MODULE_PARM_DESC(nthreads, "Worker threads (0 = one per online CPU)");
+
+static int read_pct = 90;
+module_param(read_pct, int, 0444);
+MODULE_PARM_DESC(read_pct, "Percentage of read sections (rwlock, rwsem, seqlock, rcu)");
+
+static int cs_ns = 100;
+module_param(cs_ns, int, 0444);
+MODULE_PARM_DESC(cs_ns, "Critical section length in ns");
+
+static int think_ns;
+module_param(think_ns, int, 0444);
+MODULE_PARM_DESC(think_ns, "Work done outside the lock per iteration in ns");
+
+static int duration_ms = 5000;
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Run length in ms");
+
+/* shared data: a == b whenever no writer is inside */
+struct lb_data {
+	u64 a;
+	u64 b;
+	struct rcu_head rcu;
+};
+
+static struct lb_data lb_shared;
+static struct lb_data __rcu *lb_rcu_data;
+static atomic64_t lb_torn;
+
+static DEFINE_SPINLOCK(lb_spin);
+static DEFINE_MUTEX(lb_mutex);
+static DEFINE_RT_MUTEX(lb_rtmutex);
+static struct semaphore lb_sem;
+static DEFINE_RWLOCK(lb_rwlock);
+static DECLARE_RWSEM(lb_rwsem);
+static DEFINE_SEQLOCK(lb_seqlock);
+static DEFINE_MUTEX(lb_rcu_mutex);	/* serialises RCU updaters */
+static struct ticket_spin lb_ticket;
+static struct mcs_spin lb_mcs;
+static struct clh_spin lb_clh;
+static struct rbias_rwlock lb_rbias;
+
+/*
+ * Last exclusive holder and handoff counts, written under the lock. Kept
+ * on their own line so the writers do not drag the lock words around.
+ */
+static struct {
+	int last_cpu;
+	u64 cpu;
+	u64 node;
+} ____cacheline_aligned_in_smp lb_handoffs = { .last_cpu = -1 };
+
+static void lb_write_cs(struct lb_data *d)
+{
+	int cpu = raw_smp_processor_id();
+
+	if (cpu != lb_handoffs.last_cpu) {
+		if (lb_handoffs.last_cpu >= 0 &&
+		    cpu_to_node(cpu) != cpu_to_node(lb_handoffs.last_cpu))
+			lb_handoffs.node++;
+		lb_handoffs.cpu++;
+		lb_handoffs.last_cpu = cpu;
+	}
+	WRITE_ONCE(d->a, d->a + 1);
+	bench_spin_ns(cs_ns);
+	WRITE_ONCE(d->b, d->a);
+}
+
+static void lb_read_cs(const struct lb_data *d)
+{
+	u64 a = READ_ONCE(d->a);
+
+	bench_spin_ns(cs_ns);
+	if (a != READ_ONCE(d->b))
+		atomic64_inc(&lb_torn);
+}
+
+struct lb_thread;
+
+/*
+ * Each op returns its acquire latency in ns.
+ */
+#define LB_LOCKED_OP(fn, lock, unlock, cs)	\
+static u64 fn(struct lb_thread *lt)		\
+{						\
+	u64 t0, t1;				\
+						\
+	t0 = ktime_get_ns();			\
+	lock;					\
+	t1 = ktime_get_ns();			\
+	cs;					\
+	unlock;					\
+	return t1 - t0;				\
+}
+
+LB_LOCKED_OP(spin_write, spin_lock(&lb_spin), spin_unlock(&lb_spin),
+	     lb_write_cs(&lb_shared))
+LB_LOCKED_OP(mutex_write, mutex_lock(&lb_mutex), mutex_unlock(&lb_mutex),
+	     lb_write_cs(&lb_shared))
+LB_LOCKED_OP(rtmutex_write, rt_mutex_lock(&lb_rtmutex),
+	     rt_mutex_unlock(&lb_rtmutex), lb_write_cs(&lb_shared))
+LB_LOCKED_OP(sem_write, down(&lb_sem), up(&lb_sem), lb_write_cs(&lb_shared))
+LB_LOCKED_OP(rwlock_read, read_lock(&lb_rwlock), read_unlock(&lb_rwlock),
+	     lb_read_cs(&lb_shared))
+LB_LOCKED_OP(rwlock_write, write_lock(&lb_rwlock), write_unlock(&lb_rwlock),
+	     lb_write_cs(&lb_shared))
+LB_LOCKED_OP(rwsem_read, down_read(&lb_rwsem), up_read(&lb_rwsem),
+	     lb_read_cs(&lb_shared))
+LB_LOCKED_OP(rwsem_write, down_write(&lb_rwsem), up_write(&lb_rwsem),
+	     lb_write_cs(&lb_shared))
+LB_LOCKED_OP(seqlock_write, write_seqlock(&lb_seqlock),
+	     write_sequnlock(&lb_seqlock), lb_write_cs(&lb_shared))
+LB_LOCKED_OP(ticket_write, ticket_spin_lock(&lb_ticket),
+	     ticket_spin_unlock(&lb_ticket), lb_write_cs(&lb_shared))
+LB_LOCKED_OP(clh_write, clh_spin_lock(&lb_clh, &lt->clh),
+	     clh_spin_unlock(&lt->clh), lb_write_cs(&lb_shared))
+LB_LOCKED_OP(rbias_read, rbias_read_lock(&lb_rbias),
+	     rbias_read_unlock(&lb_rbias), lb_read_cs(&lb_shared))
+LB_LOCKED_OP(rbias_write, rbias_write_lock(&lb_rbias),
+	     rbias_write_unlock(&lb_rbias), lb_write_cs(&lb_shared))
+
+/* the queue node only lives while the lock is held */
+static u64 mcs_write(struct lb_thread *lt)
+{
+	struct mcs_node node;
+	u64 t0, t1;
+
+	t0 = ktime_get_ns();
+	mcs_spin_lock(&lb_mcs, &node);
+	t1 = ktime_get_ns();
+	lb_write_cs(&lb_shared);
+	mcs_spin_unlock(&lb_mcs, &node);
+	return t1 - t0;
+}
+
+static u64 seqlock_read(struct lb_thread *lt)
+{
+	unsigned int seq;
+	u64 t0, t1, a, b;
+
+	t0 = ktime_get_ns();
+	do {
+		seq = read_seqbegin(&lb_seqlock);
+		t1 = ktime_get_ns();
+		a = READ_ONCE(lb_shared.a);
+		bench_spin_ns(cs_ns);
+		b = READ_ONCE(lb_shared.b);
+	} while (read_seqretry(&lb_seqlock, seq));
+
+	if (a != b)
+		atomic64_inc(&lb_torn);
+	return t1 - t0;
+}
+
+static u64 rcu_read(struct lb_thread *lt)
+{
+	u64 t0, t1;
+
+	t0 = ktime_get_ns();
+	rcu_read_lock();
+	t1 = ktime_get_ns();
+	lb_read_cs(rcu_dereference(lb_rcu_data));
+	rcu_read_unlock();
+	return t1 - t0;
+}
+
+/* copy, update the copy, publish it and free the old one after a grace period */
+static u64 rcu_write(struct lb_thread *lt)
+{
+	struct lb_data *old, *new;
+	u64 t0, t1;
+
+	new = kmalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		return 0;
+
+	t0 = ktime_get_ns();
+	mutex_lock(&lb_rcu_mutex);
+	t1 = ktime_get_ns();
+	old = rcu_dereference_protected(lb_rcu_data,
+					lockdep_is_held(&lb_rcu_mutex));
+	*new = *old;
+	lb_write_cs(new);
+	rcu_assign_pointer(lb_rcu_data, new);
+	mutex_unlock(&lb_rcu_mutex);
+
+	kfree_rcu(old, rcu);
+	return t1 - t0;
+}
+
+struct lb_ops {
+	const char *name;
+	u64 (*read)(struct lb_thread *lt);	/* NULL: exclusive only */
+	u64 (*write)(struct lb_thread *lt);
+};
+
+static const struct lb_ops lb_ops_table[] = {
+	{ "spinlock",	NULL,		spin_write },
+	{ "mutex",	NULL,		mutex_write },
+	{ "rt_mutex",	NULL,		rtmutex_write },
+	{ "semaphore",	NULL,		sem_write },
+	{ "rwlock",	rwlock_read,	rwlock_write },
+	{ "rwsem",	rwsem_read,	rwsem_write },
+	{ "seqlock",	seqlock_read,	seqlock_write },
+	{ "rcu",	rcu_read,	rcu_write },
+	{ "ticket",	NULL,		ticket_write },
+	{ "mcs",	NULL,		mcs_write },
+	{ "clh",	NULL,		clh_write },
+	{ "rbias",	rbias_read,	rbias_write },
+};
+
+static const struct lb_ops *lb_ops;
+
+struct lb_thread {
+	struct task_struct *task;
+	u32 seed;
+	struct clh_handle clh;	/* may sit in lb_clh's queue until rmmod */
+	u64 reads;
+	u64 writes;
+	struct bench_hist rlat;
+	struct bench_hist wlat;
+} ____cacheline_aligned_in_smp;
+
+static struct lb_thread *lb_threads;
+static struct bench_ctl lb_ctl;
+static struct dentry *lb_dir;
+
+static int lb_thread_fn(void *arg)
+{
+	struct lb_thread *lt = arg;
+	struct bench_perf perf;
+
+	bench_perf_open(&perf);
+	bench_gate(&lb_ctl);
+	bench_perf_start(&perf);
+	while (bench_running(&lb_ctl)) {
+		if (lb_ops->read && bench_rand(&lt->seed) % 100 < read_pct) {
+			bench_hist_add(&lt->rlat, lb_ops->read(lt));
+			lt->reads++;
+		} else {
+			bench_hist_add(&lt->wlat, lb_ops->write(lt));
+			lt->writes++;
+		}
+		bench_spin_ns(think_ns);
+		cond_resched();
+	}
+	bench_perf_stop(&perf, &lb_ctl);
+	bench_done(&lb_ctl);
+	return 0;
+}
+
+static int lb_results_show(struct seq_file *m, void *v)
+{
+	struct bench_hist *rlat, *wlat;
+	u64 reads = 0, writes = 0, ns, ops, min_ops = U64_MAX, max_ops = 0;
+	int i;
+
+	if (!bench_finished(&lb_ctl)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	rlat = kmalloc_array(2, sizeof(*rlat), GFP_KERNEL);
+	if (!rlat)
+		return -ENOMEM;
+	wlat = rlat + 1;
+	bench_hist_init(rlat);
+	bench_hist_init(wlat);
+
+	for (i = 0; i < nthreads; i++) {
+		ops = lb_threads[i].reads + lb_threads[i].writes;
+		min_ops = min(min_ops, ops);
+		max_ops = max(max_ops, ops);
+		reads += lb_threads[i].reads;
+		writes += lb_threads[i].writes;
+		bench_hist_merge(rlat, &lb_threads[i].rlat);
+		bench_hist_merge(wlat, &lb_threads[i].wlat);
+	}
+	ns = bench_elapsed_ns(&lb_ctl);
+
+	seq_printf(m, "primitive %s threads %d read_pct %d cs_ns %d think_ns %d\n",
+		   lb_ops->name, nthreads, lb_ops->read ? read_pct : 0,
+		   cs_ns, think_ns);
+	bench_placement_show(m);
+	seq_printf(m, "elapsed_ms %llu\n", div_u64(ns, NSEC_PER_MSEC));
+	seq_printf(m, "reads %llu writes %llu ops/s %llu",
+		   reads, writes, bench_rate(reads + writes, ns));
+	bench_perf_show(m, &lb_ctl.perf, reads + writes);
+	seq_putc(m, '\n');
+	seq_printf(m, "torn_reads %lld\n", atomic64_read(&lb_torn));
+	seq_printf(m, "handoffs cpu %llu node %llu per_write " BENCH_MILLI_FMT
+		   " " BENCH_MILLI_FMT "\n", lb_handoffs.cpu, lb_handoffs.node,
+		   BENCH_MILLI_ARG(bench_milli(lb_handoffs.cpu, writes)),
+		   BENCH_MILLI_ARG(bench_milli(lb_handoffs.node, writes)));
+	seq_printf(m, "fairness min/max " BENCH_MILLI_FMT "\n",
+		   BENCH_MILLI_ARG(bench_milli(min_ops, max_ops)));
+	bench_hist_show(m, "read_acq_ns", rlat);
+	bench_hist_show(m, "write_acq_ns", wlat);
+
+	seq_puts(m, "per_thread_ops");
+	for (i = 0; i < nthreads; i++)
+		seq_printf(m, " %llu", lb_threads[i].reads + lb_threads[i].writes);
+	seq_putc(m, '\n');
+
+	kfree(rlat);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lb_results);
+
+static void lb_stop_threads(int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		kthread_stop(lb_threads[i].task);
+}
+
+static int __init lb_init(void)
+{
+	struct lb_data *d;
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(lb_ops_table); i++)
+		if (!strcmp(prim, lb_ops_table[i].name))
+			lb_ops = &lb_ops_table[i];
+	if (!lb_ops) {
+		pr_err(MODNAME "unknown primitive '%s'\n", prim);
+		return -EINVAL;
+	}
+	if (nthreads <= 0)
+		nthreads = num_online_cpus();
+	read_pct = clamp(read_pct, 0, 100);
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+
+	sema_init(&lb_sem, 1);
+	ticket_spin_init(&lb_ticket);
+	mcs_spin_init(&lb_mcs);
+	clh_spin_init(&lb_clh);
+	rbias_init(&lb_rbias);
+	d = kzalloc(sizeof(*d), GFP_KERNEL);
+	lb_threads = vzalloc(array_size(nthreads, sizeof(*lb_threads)));
+	if (!d || !lb_threads) {
+		vfree(lb_threads);
+		kfree(d);
+		bench_placement_free();
+		return -ENOMEM;
+	}
+	RCU_INIT_POINTER(lb_rcu_data, d);
+
+	bench_ctl_init(&lb_ctl, nthreads, duration_ms);
+	for (i = 0; i < nthreads; i++) {
+		struct lb_thread *lt = &lb_threads[i];
+
+		lt->seed = get_random_u32() | 1;
+		clh_handle_init(&lt->clh);
+		bench_hist_init(&lt->rlat);
+		bench_hist_init(&lt->wlat);
+		lt->task = bench_kthread_run(lb_thread_fn, lt, "lockbench", i);
+		if (IS_ERR(lt->task)) {
+			pr_err("%s: unable to start kernel thread\n", __func__);
+			lb_stop_threads(i);
+			bench_ctl_cleanup(&lb_ctl);
+			vfree(lb_threads);
+			kfree(d);
+			bench_placement_free();
+			return PTR_ERR(lt->task);
+		}
+	}
+
+	lb_dir = debugfs_create_dir("lockbench", NULL);
+	debugfs_create_file("results", 0444, lb_dir, NULL, &lb_results_fops);
+
+	pr_info(MODNAME "%s: %d threads, %d ms\n", lb_ops->name, nthreads,
+		duration_ms);
+	return 0;
+}
+
+static void __exit lb_exit(void)
+{
+	debugfs_remove_recursive(lb_dir);
+	lb_stop_threads(nthreads);
+	bench_ctl_cleanup(&lb_ctl);
+	vfree(lb_threads);
+	kfree(rcu_dereference_protected(lb_rcu_data, 1));
+	bench_placement_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(lb_init);
+module_exit(lb_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("lock primitive contention benchmark");
+MODULE_LICENSE("Dual MIT/GPL");
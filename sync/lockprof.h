@@ -0,0 +1,344 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Lightweight lock hold-time and wait-time profiling.
+ *
+ * Wrap the lock and unlock calls of a lock site to get per-CPU log2
+ * histograms of how long the site waited for the lock and how long it
+ * held it. Profiling is off by default and sits behind a static key, so
+ * a disabled wrapper costs a patched-out jump and nothing else.
+ *
+ * Usage:
+ *	DEFINE_LOCKPROF_SITE(writer);
+ *
+ *	lockprof_register(&writer);		(module init)
+ *	lockprof_debugfs_create("kthread_mutex");
+ *
+ *	u64 t = lockprof_mutex_lock(&lock, &writer);
+ *	...
+ *	lockprof_mutex_unlock(&lock, &writer, t);
+ *
+ *	lockprof_debugfs_remove();		(module exit)
+ *
+ * Switch on at load time with lockprof=1, or at run time through
+ * /sys/kernel/debug/<name>/lockprof_enable. Results are in
+ * /sys/kernel/debug/<name>/lockprof; writing to that file clears them.
+ */
+#ifndef _SYNC_LOCKPROF_H
+#define _SYNC_LOCKPROF_H
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/jump_label.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/mutex.h>
+#include <linux/semaphore.h>
+#include <linux/spinlock.h>
+#include <linux/rwsem.h>
+
+#define LOCKPROF_BUCKETS	64	/* bucket b counts [2^(b-1), 2^b) ns */
+
+struct lockprof_stats {
+	u64 count;
+	u64 wait_sum;
+	u64 hold_sum;
+	u64 wait[LOCKPROF_BUCKETS];
+	u64 hold[LOCKPROF_BUCKETS];
+};
+
+struct lockprof_site {
+	const char *name;
+	struct lockprof_stats __percpu *stats;
+	struct list_head node;
+};
+
+#define DEFINE_LOCKPROF_SITE(_name)					\
+	static DEFINE_PER_CPU(struct lockprof_stats, _name##_lockprof);	\
+	static struct lockprof_site _name = {				\
+		.name	= #_name,					\
+		.stats	= &_name##_lockprof,				\
+	}
+
+static DEFINE_STATIC_KEY_FALSE(lockprof_key);
+static LIST_HEAD(lockprof_sites);
+static struct dentry *lockprof_dir;
+
+static bool lockprof;
+module_param(lockprof, bool, 0444);
+MODULE_PARM_DESC(lockprof, "Profile lock wait and hold times from load time on");
+
+static inline void lockprof_register(struct lockprof_site *site)
+{
+	list_add_tail(&site->node, &lockprof_sites);
+	if (lockprof)
+		static_branch_enable(&lockprof_key);
+}
+
+/* start of a lock attempt, 0 when profiling is off */
+static __always_inline u64 lockprof_now(void)
+{
+	if (static_branch_unlikely(&lockprof_key))
+		return ktime_get_ns();
+	return 0;
+}
+
+/* lock taken: account the wait, return the token for the release */
+static __always_inline u64 lockprof_acquired(struct lockprof_site *site,
+					     u64 t0)
+{
+	u64 now, d;
+
+	if (!t0)
+		return 0;
+	now = ktime_get_ns();
+	d = now - t0;
+	this_cpu_inc(site->stats->count);
+	this_cpu_add(site->stats->wait_sum, d);
+	this_cpu_inc(site->stats->wait[min(fls64(d), LOCKPROF_BUCKETS - 1)]);
+	return now;
+}
+
+static __always_inline void lockprof_released(struct lockprof_site *site,
+					      u64 t)
+{
+	u64 d;
+
+	if (!t)
+		return;
+	d = ktime_get_ns() - t;
+	this_cpu_add(site->stats->hold_sum, d);
+	this_cpu_inc(site->stats->hold[min(fls64(d), LOCKPROF_BUCKETS - 1)]);
+}
+
+#define __lockprof_lock(site, lock_call)				\
+({									\
+	u64 __lp_t = lockprof_now();					\
+									\
+	lock_call;							\
+	lockprof_acquired(site, __lp_t);				\
+})
+
+#define __lockprof_unlock(site, t, unlock_call)				\
+do {									\
+	unlock_call;							\
+	lockprof_released(site, t);					\
+} while (0)
+
+#define lockprof_mutex_lock(m, site)					\
+	__lockprof_lock(site, mutex_lock(m))
+#define lockprof_mutex_unlock(m, site, t)				\
+	__lockprof_unlock(site, t, mutex_unlock(m))
+
+#define lockprof_down(sem, site)					\
+	__lockprof_lock(site, down(sem))
+#define lockprof_up(sem, site, t)					\
+	__lockprof_unlock(site, t, up(sem))
+
+/* returns down_interruptible()'s result, the token goes to *@tp */
+#define lockprof_down_interruptible(sem, site, tp)			\
+({									\
+	u64 __lp_t = lockprof_now();					\
+	int __lp_ret = down_interruptible(sem);				\
+									\
+	*(tp) = __lp_ret ? 0 : lockprof_acquired(site, __lp_t);		\
+	__lp_ret;							\
+})
+
+#define lockprof_spin_lock(l, site)					\
+	__lockprof_lock(site, spin_lock(l))
+#define lockprof_spin_unlock(l, site, t)				\
+	__lockprof_unlock(site, t, spin_unlock(l))
+
+#define lockprof_down_read(sem, site)					\
+	__lockprof_lock(site, down_read(sem))
+#define lockprof_up_read(sem, site, t)					\
+	__lockprof_unlock(site, t, up_read(sem))
+#define lockprof_down_write(sem, site)					\
+	__lockprof_lock(site, down_write(sem))
+#define lockprof_up_write(sem, site, t)					\
+	__lockprof_unlock(site, t, up_write(sem))
+
+/*
+ * Ends the write hold of @wsite and starts a read hold of @rsite, which
+ * is accounted as acquired without waiting. Returns the read token.
+ */
+#define lockprof_downgrade_write(sem, wsite, rsite, t)			\
+({									\
+	downgrade_write(sem);						\
+	lockprof_released(wsite, t);					\
+	lockprof_acquired(rsite, (t) ? ktime_get_ns() : 0);		\
+})
+
+/* debugfs */
+
+static inline u64 lockprof_pct(const u64 *b, u64 count, unsigned int permille)
+{
+	u64 want = div_u64(count * permille + 999, 1000), seen = 0;
+	int i;
+
+	for (i = 0; i < LOCKPROF_BUCKETS; i++) {
+		seen += b[i];
+		if (seen >= want)
+			return i ? 1ULL << (i - 1) : 0;
+	}
+	return 0;
+}
+
+static inline void lockprof_show_hist(struct seq_file *m, const char *what,
+				      const u64 *b, u64 sum, u64 count)
+{
+	int i;
+
+	seq_printf(m, "  %s_ns avg %llu p50 %llu p99 %llu |", what,
+		   div64_u64(sum, count), lockprof_pct(b, count, 500),
+		   lockprof_pct(b, count, 990));
+	for (i = 0; i < LOCKPROF_BUCKETS; i++)
+		if (b[i])
+			seq_printf(m, " %llu:%llu", i ? 1ULL << (i - 1) : 0, b[i]);
+	seq_putc(m, '\n');
+}
+
+static int lockprof_show(struct seq_file *m, void *v)
+{
+	struct lockprof_stats *sum;
+	struct lockprof_site *site;
+	int cpu, i;
+
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	seq_printf(m, "enabled %d (buckets: lower bound ns:count)\n",
+		   static_key_enabled(&lockprof_key));
+	list_for_each_entry(site, &lockprof_sites, node) {
+		memset(sum, 0, sizeof(*sum));
+		for_each_possible_cpu(cpu) {
+			struct lockprof_stats *s = per_cpu_ptr(site->stats, cpu);
+
+			sum->count += s->count;
+			sum->wait_sum += s->wait_sum;
+			sum->hold_sum += s->hold_sum;
+			for (i = 0; i < LOCKPROF_BUCKETS; i++) {
+				sum->wait[i] += s->wait[i];
+				sum->hold[i] += s->hold[i];
+			}
+		}
+		seq_printf(m, "%s: acquisitions %llu\n", site->name, sum->count);
+		if (!sum->count)
+			continue;
+		lockprof_show_hist(m, "wait", sum->wait, sum->wait_sum,
+				   sum->count);
+		lockprof_show_hist(m, "hold", sum->hold, sum->hold_sum,
+				   sum->count);
+	}
+	kfree(sum);
+	return 0;
+}
+
+static int lockprof_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lockprof_show, NULL);
+}
+
+/* any write clears the statistics */
+static ssize_t lockprof_reset(struct file *file, const char __user *ubuf,
+			      size_t count, loff_t *ppos)
+{
+	struct lockprof_site *site;
+	int cpu;
+
+	list_for_each_entry(site, &lockprof_sites, node)
+		for_each_possible_cpu(cpu)
+			memset(per_cpu_ptr(site->stats, cpu), 0,
+			       sizeof(struct lockprof_stats));
+	return count;
+}
+
+static const struct file_operations lockprof_fops = {
+	.owner		= THIS_MODULE,
+	.open		= lockprof_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+	.write		= lockprof_reset,
+};
+
+static ssize_t lockprof_enable_read(struct file *file, char __user *ubuf,
+				    size_t count, loff_t *ppos)
+{
+	char buf[2] = { static_key_enabled(&lockprof_key) ? '1' : '0', '\n' };
+
+	return simple_read_from_buffer(ubuf, count, ppos, buf, sizeof(buf));
+}
+
+static ssize_t lockprof_enable_write(struct file *file,
+				     const char __user *ubuf,
+				     size_t count, loff_t *ppos)
+{
+	bool on;
+	int ret;
+
+	ret = kstrtobool_from_user(ubuf, count, &on);
+	if (ret)
+		return ret;
+	if (on)
+		static_branch_enable(&lockprof_key);
+	else
+		static_branch_disable(&lockprof_key);
+	return count;
+}
+
+static const struct file_operations lockprof_enable_fops = {
+	.owner	= THIS_MODULE,
+	.read	= lockprof_enable_read,
+	.write	= lockprof_enable_write,
+	.llseek	= default_llseek,
+};
+
+static inline void lockprof_debugfs_create(const char *name)
+{
+	lockprof_dir = debugfs_create_dir(name, NULL);
+	debugfs_create_file("lockprof", 0644, lockprof_dir, NULL,
+			    &lockprof_fops);
+	debugfs_create_file("lockprof_enable", 0644, lockprof_dir, NULL,
+			    &lockprof_enable_fops);
+}
+
+static inline void lockprof_debugfs_remove(void)
+{
+	debugfs_remove_recursive(lockprof_dir);
+}
+
+#endif /* _SYNC_LOCKPROF_H */
@@ -0,0 +1,671 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Multi-producer multi-consumer queue benchmark
+ *
+ * Generalises the single producer/consumer pair of kthread_sync_waitq.c
+ * to nprod producers and ncons consumers sharing one queue. Backends:
+ *
+ *   list	list_head protected by a spinlock (baseline)
+ *   ptr_ring	bounded ptr_ring, producer and consumer locks split
+ *   llist	lock-free llist; a consumer takes the whole queue with
+ *		llist_del_all() and works through it in batch sized chunks
+ *
+ * Every producer owns a pool of pool_size items; consumers hand items
+ * back through the owner's lock-free return list, so the pools also act
+ * as backpressure. Consumers sleep on a shared exclusive waitqueue when
+ * the queue is empty.
+ *
+ * Every backend runs for each combination of producer and consumer
+ * counts in nprod= and ncons= (default 1, 2, 4, ... up to the online
+ * CPUs). Reported per run: items/s, enqueue to dequeue latency, and the
+ * spread of items across consumers (min/max and Jain's fairness index,
+ * 1.000 = perfectly even).
+ *
+ *   insmod mpmcbench.ko nprod=1,4,16 ncons=1,4,16
+ *   cat /sys/kernel/debug/mpmcbench/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/list.h>
+#include <linux/llist.h>
+#include <linux/ptr_ring.h>
+#include <linux/spinlock.h>
+
+#include "bench.h"
+
+#define MODNAME "[MPMCBENCH] "
+
+#define MQ_MAX_STEPS	16
+
+static char *backend = "all";
+module_param(backend, charp, 0444);
+MODULE_PARM_DESC(backend, "all, list, ptr_ring or llist");
+
+static int nprod[MQ_MAX_STEPS];
+static int nr_nprod;
+module_param_array(nprod, int, &nr_nprod, 0444);
+MODULE_PARM_DESC(nprod, "Producer counts to run (default 1, 2, 4, ... online CPUs)");
+
+static int ncons[MQ_MAX_STEPS];
+static int nr_ncons;
+module_param_array(ncons, int, &nr_ncons, 0444);
+MODULE_PARM_DESC(ncons, "Consumer counts to run (default 1, 2, 4, ... online CPUs)");
+
+static int pool_size = 1024;
+module_param(pool_size, int, 0444);
+MODULE_PARM_DESC(pool_size, "Items owned by each producer");
+
+static int ring_size = 4096;
+module_param(ring_size, int, 0444);
+MODULE_PARM_DESC(ring_size, "ptr_ring slots");
+
+static int batch = 16;
+module_param(batch, int, 0444);
+MODULE_PARM_DESC(batch, "Items a consumer takes per dequeue");
+
+static int cons_ns;
+module_param(cons_ns, int, 0444);
+MODULE_PARM_DESC(cons_ns, "Work to consume one item in ns");
+
+static int duration_ms = 2000;
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Run length per backend and thread counts in ms");
+
+struct mq_prod;
+
+struct mq_item {
+	struct list_head node;		/* list backend */
+	struct llist_node lnode;	/* llist backend, or the free lists */
+	u64 ts;
+	struct mq_prod *owner;
+};
+
+struct mq_prod {
+	struct task_struct *task;
+	struct mq_item *pool;
+	struct llist_head returned;	/* filled by consumers */
+	struct llist_node *free;	/* producer private */
+	u64 produced;
+	u64 starved;			/* pool empty: backpressure */
+	u64 full;			/* queue full (ptr_ring) */
+} ____cacheline_aligned_in_smp;
+
+struct mq_cons {
+	struct task_struct *task;
+	struct llist_node *pending;	/* llist backend leftovers */
+	struct mq_item **buf;
+	u64 consumed;
+	u64 sleeps;
+	struct bench_hist lat;
+} ____cacheline_aligned_in_smp;
+
+struct mq_backend {
+	const char *name;
+	int (*init)(void);
+	void (*destroy)(void);
+	bool (*enqueue)(struct mq_item *it);
+	int (*dequeue)(struct mq_cons *c, struct mq_item **items, int max);
+	bool (*empty)(void);
+};
+
+struct mq_result {
+	bool ran;
+	u64 ns;
+	u64 items;
+	u64 starved;
+	u64 full;
+	u64 sleeps;
+	u64 min_cons;
+	u64 max_cons;
+	u64 jain;		/* thousandths */
+	struct bench_hist lat;
+	struct bench_perf_sum perf;	/* producers and consumers */
+};
+
+static const struct mq_backend *mq_be;
+static int mq_nprod, mq_ncons;		/* this run */
+static int mq_max_prod, mq_max_cons;	/* largest of nprod= and ncons= */
+static struct mq_prod *mq_prods;
+static struct mq_cons *mq_conss;
+static struct bench_ctl mq_ctl;
+static atomic_t mq_prod_done;
+static DECLARE_WAIT_QUEUE_HEAD(mq_wq);
+static struct task_struct *mq_task;
+static DECLARE_COMPLETION(mq_all_done);
+static struct dentry *mq_dir;
+
+/* list: spinlock protected list_head */
+static LIST_HEAD(mq_list);
+static DEFINE_SPINLOCK(mq_list_lock);
+
+static int mqlist_init(void)
+{
+	INIT_LIST_HEAD(&mq_list);
+	return 0;
+}
+
+static void mqlist_destroy(void)
+{
+}
+
+static bool mqlist_enqueue(struct mq_item *it)
+{
+	spin_lock(&mq_list_lock);
+	list_add_tail(&it->node, &mq_list);
+	spin_unlock(&mq_list_lock);
+	return true;
+}
+
+static int mqlist_dequeue(struct mq_cons *c, struct mq_item **items,
+			  int max)
+{
+	struct mq_item *it, *tmp;
+	int n = 0;
+
+	spin_lock(&mq_list_lock);
+	list_for_each_entry_safe(it, tmp, &mq_list, node) {
+		list_del(&it->node);
+		items[n++] = it;
+		if (n == max)
+			break;
+	}
+	spin_unlock(&mq_list_lock);
+	return n;
+}
+
+static bool mqlist_empty(void)
+{
+	return list_empty(&mq_list);
+}
+
+/* ptr_ring */
+static struct ptr_ring mq_ring;
+
+static int mqring_init(void)
+{
+	return ptr_ring_init(&mq_ring, ring_size, GFP_KERNEL);
+}
+
+static void mqring_destroy(void)
+{
+	ptr_ring_cleanup(&mq_ring, NULL);
+}
+
+static bool mqring_enqueue(struct mq_item *it)
+{
+	return ptr_ring_produce(&mq_ring, it) == 0;
+}
+
+static int mqring_dequeue(struct mq_cons *c, struct mq_item **items,
+			  int max)
+{
+	return ptr_ring_consume_batched(&mq_ring, (void **)items, max);
+}
+
+static bool mqring_empty(void)
+{
+	return ptr_ring_empty(&mq_ring);
+}
+
+/* llist: lock-free push, batched drain */
+static LLIST_HEAD(mq_llist);
+
+static int mqllist_init(void)
+{
+	init_llist_head(&mq_llist);
+	return 0;
+}
+
+static void mqllist_destroy(void)
+{
+}
+
+static bool mqllist_enqueue(struct mq_item *it)
+{
+	llist_add(&it->lnode, &mq_llist);
+	return true;
+}
+
+static int mqllist_dequeue(struct mq_cons *c, struct mq_item **items,
+			   int max)
+{
+	int n = 0;
+
+	if (!c->pending)
+		c->pending = llist_reverse_order(llist_del_all(&mq_llist));
+	while (c->pending && n < max) {
+		items[n++] = llist_entry(c->pending, struct mq_item, lnode);
+		c->pending = c->pending->next;
+	}
+	return n;
+}
+
+static bool mqllist_empty(void)
+{
+	return llist_empty(&mq_llist);
+}
+
+static const struct mq_backend mq_backends[] = {
+	{ "list", mqlist_init, mqlist_destroy, mqlist_enqueue,
+	  mqlist_dequeue, mqlist_empty },
+	{ "ptr_ring", mqring_init, mqring_destroy, mqring_enqueue,
+	  mqring_dequeue, mqring_empty },
+	{ "llist", mqllist_init, mqllist_destroy, mqllist_enqueue,
+	  mqllist_dequeue, mqllist_empty },
+};
+
+/* [backend][nprod step][ncons step] */
+static struct mq_result *mq_results;
+
+static struct mq_result *mq_result(int b, int pi, int ci)
+{
+	return &mq_results[(b * MQ_MAX_STEPS + pi) * MQ_MAX_STEPS + ci];
+}
+
+static struct mq_item *mq_get_item(struct mq_prod *p)
+{
+	struct mq_item *it;
+
+	if (!p->free)
+		p->free = llist_del_all(&p->returned);
+	if (!p->free)
+		return NULL;
+	it = llist_entry(p->free, struct mq_item, lnode);
+	p->free = p->free->next;
+	return it;
+}
+
+static void mq_put_item(struct mq_item *it)
+{
+	llist_add(&it->lnode, &it->owner->returned);
+}
+
+static int mq_producer(void *arg)
+{
+	struct mq_prod *p = arg;
+	struct bench_perf perf;
+	struct mq_item *it;
+
+	bench_perf_open(&perf);
+	bench_gate(&mq_ctl);
+	bench_perf_start(&perf);
+	while (bench_running(&mq_ctl)) {
+		it = mq_get_item(p);
+		if (!it) {
+			p->starved++;
+			cond_resched();
+			continue;
+		}
+		it->ts = ktime_get_ns();
+		while (!mq_be->enqueue(it)) {
+			p->full++;
+			if (!bench_running(&mq_ctl)) {
+				mq_put_item(it);
+				goto out;
+			}
+			cond_resched();
+		}
+		p->produced++;
+		if (wq_has_sleeper(&mq_wq))
+			wake_up_interruptible(&mq_wq);
+	}
+out:
+	/* order the last enqueue before the count the consumers exit on */
+	smp_mb__before_atomic();
+	atomic_inc(&mq_prod_done);
+	wake_up_interruptible_all(&mq_wq);
+	bench_perf_stop(&perf, &mq_ctl);
+	bench_done(&mq_ctl);
+	return 0;
+}
+
+static bool mq_drained(struct mq_cons *c)
+{
+	return atomic_read_acquire(&mq_prod_done) >= mq_nprod &&
+	       mq_be->empty() && !c->pending;
+}
+
+static int mq_consumer(void *arg)
+{
+	struct mq_cons *c = arg;
+	struct bench_perf perf;
+	int i, n;
+
+	bench_perf_open(&perf);
+	bench_gate(&mq_ctl);
+	bench_perf_start(&perf);
+	for (;;) {
+		n = mq_be->dequeue(c, c->buf, batch);
+		if (n) {
+			u64 now = ktime_get_ns();
+
+			for (i = 0; i < n; i++) {
+				bench_hist_add(&c->lat, now - c->buf[i]->ts);
+				bench_spin_ns(cons_ns);
+				mq_put_item(c->buf[i]);
+			}
+			c->consumed += n;
+			cond_resched();
+			continue;
+		}
+		if (mq_drained(c))
+			break;
+		c->sleeps++;
+		wait_event_interruptible_exclusive(mq_wq, !mq_be->empty() ||
+				atomic_read(&mq_prod_done) >= mq_nprod);
+	}
+	bench_perf_stop(&perf, &mq_ctl);
+	bench_done(&mq_ctl);
+	return 0;
+}
+
+static void mq_collect(struct mq_result *r)
+{
+	u64 sum = 0, sq = 0, y;
+	int i;
+
+	bench_hist_init(&r->lat);
+	r->min_cons = U64_MAX;
+	r->max_cons = 0;
+	for (i = 0; i < mq_nprod; i++) {
+		r->starved += mq_prods[i].starved;
+		r->full += mq_prods[i].full;
+	}
+	for (i = 0; i < mq_ncons; i++) {
+		struct mq_cons *c = &mq_conss[i];
+
+		r->items += c->consumed;
+		r->sleeps += c->sleeps;
+		r->min_cons = min(r->min_cons, c->consumed);
+		r->max_cons = max(r->max_cons, c->consumed);
+		bench_hist_merge(&r->lat, &c->lat);
+	}
+
+	/* Jain's index on shares scaled to 0..1000 of the busiest consumer */
+	for (i = 0; i < mq_ncons && r->max_cons; i++) {
+		y = div64_u64(mq_conss[i].consumed * 1000, r->max_cons);
+		sum += y;
+		sq += y * y;
+	}
+	r->jain = sq ? div64_u64(sum * sum * 1000, mq_ncons * sq) : 0;
+}
+
+static void mq_stop_threads(void)
+{
+	int i;
+
+	for (i = 0; i < mq_nprod; i++)
+		if (!IS_ERR_OR_NULL(mq_prods[i].task))
+			kthread_stop(mq_prods[i].task);
+	for (i = 0; i < mq_ncons; i++)
+		if (!IS_ERR_OR_NULL(mq_conss[i].task))
+			kthread_stop(mq_conss[i].task);
+}
+
+static int mq_run(int b, int pi, int ci)
+{
+	struct mq_result *r = mq_result(b, pi, ci);
+	int i, j, ret;
+
+	mq_be = &mq_backends[b];
+	mq_nprod = nprod[pi];
+	mq_ncons = ncons[ci];
+	ret = mq_be->init();
+	if (ret)
+		return ret;
+
+	atomic_set(&mq_prod_done, 0);
+	for (i = 0; i < mq_nprod; i++) {
+		struct mq_prod *p = &mq_prods[i];
+		struct mq_item *pool = p->pool;
+
+		memset(p, 0, sizeof(*p));
+		p->pool = pool;
+		init_llist_head(&p->returned);
+		for (j = 0; j < pool_size; j++) {
+			pool[j].owner = p;
+			pool[j].lnode.next = j + 1 < pool_size ?
+					     &pool[j + 1].lnode : NULL;
+		}
+		p->free = &pool[0].lnode;
+	}
+	for (i = 0; i < mq_ncons; i++) {
+		struct mq_cons *c = &mq_conss[i];
+		struct mq_item **buf = c->buf;
+
+		memset(c, 0, sizeof(*c));
+		c->buf = buf;
+		bench_hist_init(&c->lat);
+	}
+
+	bench_ctl_init(&mq_ctl, mq_nprod + mq_ncons, duration_ms);
+	for (i = 0; i < mq_ncons; i++) {
+		mq_conss[i].task = bench_kthread_place(mq_consumer,
+						&mq_conss[i], "mpmcbench-cons",
+						i, mq_nprod + i);
+		if (IS_ERR(mq_conss[i].task)) {
+			ret = PTR_ERR(mq_conss[i].task);
+			goto fail;
+		}
+	}
+	for (i = 0; i < mq_nprod; i++) {
+		mq_prods[i].task = bench_kthread_place(mq_producer,
+						&mq_prods[i], "mpmcbench-prod",
+						i, i);
+		if (IS_ERR(mq_prods[i].task)) {
+			ret = PTR_ERR(mq_prods[i].task);
+			goto fail;
+		}
+	}
+
+	wait_for_completion(&mq_ctl.finished);
+	mq_stop_threads();
+
+	r->ns = bench_elapsed_ns(&mq_ctl);
+	mq_collect(r);
+	r->perf = mq_ctl.perf;
+	r->ran = true;
+	goto out;
+fail:
+	pr_err("%s: unable to start kernel thread\n", __func__);
+	/* the gate never opened: make the consumers give up as well */
+	atomic_set(&mq_prod_done, mq_nprod);
+	mq_stop_threads();
+out:
+	bench_ctl_cleanup(&mq_ctl);
+	mq_be->destroy();
+	return ret;
+}
+
+static int mq_main(void *arg)
+{
+	int b, pi, ci;
+
+	for (b = 0; b < ARRAY_SIZE(mq_backends); b++) {
+		if (strcmp(backend, "all") &&
+		    strcmp(backend, mq_backends[b].name))
+			continue;
+		for (pi = 0; pi < nr_nprod; pi++)
+			for (ci = 0; ci < nr_ncons; ci++)
+				if (kthread_should_stop() || mq_run(b, pi, ci))
+					goto out;
+	}
+out:
+	complete(&mq_all_done);
+	bench_park();
+	return 0;
+}
+
+static int mq_results_show(struct seq_file *m, void *v)
+{
+	int b, pi, ci;
+
+	if (!completion_done(&mq_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_printf(m, "pool_size %d batch %d cons_ns %d duration_ms %d\n",
+		   pool_size, batch, cons_ns, duration_ms);
+	bench_placement_show(m);
+	seq_printf(m, "%-8s %5s %5s %12s %10s %10s %11s %10s %10s %6s %10s %10s\n",
+		   "backend", "nprod", "ncons", "items/s", "starved", "full",
+		   "sleeps/item", "cons_min", "cons_max", "jain", "lat_p50",
+		   "lat_p99");
+	for (b = 0; b < ARRAY_SIZE(mq_backends); b++) {
+		for (pi = 0; pi < nr_nprod; pi++) {
+			for (ci = 0; ci < nr_ncons; ci++) {
+				struct mq_result *r = mq_result(b, pi, ci);
+
+				if (!r->ran)
+					continue;
+				seq_printf(m, "%-8s %5d %5d %12llu %10llu %10llu "
+					   BENCH_MILLI_FMTW(7) " %10llu %10llu "
+					   BENCH_MILLI_FMTW(2) " %10llu %10llu",
+					   mq_backends[b].name, nprod[pi],
+					   ncons[ci], bench_rate(r->items, r->ns),
+					   r->starved, r->full,
+					   BENCH_MILLI_ARG(bench_milli(r->sleeps,
+								       r->items)),
+					   r->min_cons, r->max_cons,
+					   BENCH_MILLI_ARG(r->jain),
+					   bench_hist_pct(&r->lat, 500),
+					   bench_hist_pct(&r->lat, 990));
+				bench_perf_show(m, &r->perf, r->items);
+				seq_putc(m, '\n');
+			}
+		}
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mq_results);
+
+static void mq_free(void)
+{
+	int i;
+
+	for (i = 0; mq_prods && i < mq_max_prod; i++)
+		kvfree(mq_prods[i].pool);
+	for (i = 0; mq_conss && i < mq_max_cons; i++)
+		kfree(mq_conss[i].buf);
+	vfree(mq_prods);
+	vfree(mq_conss);
+	vfree(mq_results);
+	bench_placement_free();
+}
+
+/* default sweep 1, 2, 4, ... online CPUs; returns the largest count */
+static int mq_steps(int *v, int *nr)
+{
+	int i, max_v = 0;
+
+	if (!*nr) {
+		for (i = 1; i <= num_online_cpus() && *nr < MQ_MAX_STEPS;
+		     i *= 2)
+			v[(*nr)++] = i;
+		if (v[*nr - 1] != num_online_cpus() && *nr < MQ_MAX_STEPS)
+			v[(*nr)++] = num_online_cpus();
+	}
+	for (i = 0; i < *nr; i++) {
+		v[i] = max(v[i], 1);
+		max_v = max(max_v, v[i]);
+	}
+	return max_v;
+}
+
+static int __init mq_init(void)
+{
+	int i, ret;
+
+	mq_max_prod = mq_steps(nprod, &nr_nprod);
+	mq_max_cons = mq_steps(ncons, &nr_ncons);
+	pool_size = max(pool_size, 1);
+	batch = max(batch, 1);
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+
+	mq_prods = vzalloc(array_size(mq_max_prod, sizeof(*mq_prods)));
+	mq_conss = vzalloc(array_size(mq_max_cons, sizeof(*mq_conss)));
+	mq_results = vzalloc(array3_size(ARRAY_SIZE(mq_backends), MQ_MAX_STEPS,
+					 MQ_MAX_STEPS * sizeof(*mq_results)));
+	if (!mq_prods || !mq_conss || !mq_results)
+		goto nomem;
+	for (i = 0; i < mq_max_prod; i++) {
+		mq_prods[i].pool = kvcalloc(pool_size, sizeof(struct mq_item),
+					    GFP_KERNEL);
+		if (!mq_prods[i].pool)
+			goto nomem;
+	}
+	for (i = 0; i < mq_max_cons; i++) {
+		mq_conss[i].buf = kcalloc(batch, sizeof(struct mq_item *),
+					  GFP_KERNEL);
+		if (!mq_conss[i].buf)
+			goto nomem;
+	}
+
+	mq_task = kthread_run(mq_main, NULL, "mpmcbench");
+	if (IS_ERR(mq_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		mq_free();
+		return PTR_ERR(mq_task);
+	}
+
+	mq_dir = debugfs_create_dir("mpmcbench", NULL);
+	debugfs_create_file("results", 0444, mq_dir, NULL, &mq_results_fops);
+	return 0;
+nomem:
+	mq_free();
+	return -ENOMEM;
+}
+
+static void __exit mq_exit(void)
+{
+	debugfs_remove_recursive(mq_dir);
+	kthread_stop(mq_task);
+	mq_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(mq_init);
+module_exit(mq_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("multi-producer multi-consumer queue benchmark");
+MODULE_LICENSE("Dual MIT/GPL");
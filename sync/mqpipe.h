@@ -0,0 +1,317 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Multi-queue pipeline with NAPI style polling and credit backpressure.
+ *
+ * Every producer owns one SPSC queue (spsc_ring.h); queue q is served by
+ * consumer q % ncons, which normally runs one per CPU. Consumers work
+ * the way NAPI drivers do:
+ *
+ *   - while idle, a consumer is "armed": the first item a producer
+ *     queues disarms it and wakes it, like an interrupt that masks
+ *     itself;
+ *   - awake, it polls its queues round-robin, at most weight items from
+ *     one queue and budget items in total per round;
+ *   - a round that used the whole budget means more is waiting, so it
+ *     polls again without being woken; a shorter one means it caught up,
+ *     it re-arms (after polling on for poll_ns if set) and sleeps.
+ *
+ * Under load consumers never sleep and producers never wake anybody;
+ * when idle, every item pays for a wakeup.
+ *
+ * Backpressure: a producer holds credits items per queue. Sending an
+ * item costs one, the consumer hands them back once it has handled the
+ * items, and a producer out of credits waits. A queue therefore never
+ * holds more than credits items, however far the producers are ahead.
+ *
+ * Usage:
+ *	mqpipe_init(&p, ncons, nqueues, credits, handle);
+ *	mqpipe_reset(&p, nqueues_used);		before every run
+ *	consumer thread:	while (mqpipe_consume(&p, c)) ;
+ *	producer thread:	while (... && mqpipe_send(&p, q, item)) ;
+ *				mqpipe_stop(&p);
+ *	mqpipe_free(&p);
+ */
+#ifndef _SYNC_MQPIPE_H
+#define _SYNC_MQPIPE_H
+
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/wait_bit.h>
+
+#include "spsc_ring.h"
+
+#define MQPIPE_BATCH	16
+
+struct mqpipe_cons;
+
+struct mqpipe_queue {
+	struct spsc_ring ring;
+	atomic_t credit;
+	struct mqpipe_cons *cons;
+	/* producer */
+	u64 stalls;		/* sends that waited for credit */
+	u64 wakeups;		/* sends that woke the consumer */
+	/* consumer */
+	unsigned int max_depth;
+};
+
+struct mqpipe_cons {
+	int id;
+	int armed;
+	struct task_struct *task;
+	struct mqpipe_queue **queues;
+	int nr;
+	int next;		/* queue the next round starts with */
+	u64 last_work_ns;
+	u64 items;
+	u64 polls;
+	u64 sleeps;
+} ____cacheline_aligned_in_smp;
+
+struct mqpipe {
+	int budget;		/* items per round over all queues */
+	int weight;		/* items per round from one queue */
+	u64 poll_ns;		/* keep polling this long after the last item */
+	int credits;
+	int stop;
+	void (*handle)(struct mqpipe_cons *c, void *item);
+	struct mqpipe_cons *cons;
+	int ncons;
+	struct mqpipe_queue *queues;
+	int nqueues;
+};
+
+static inline void mqpipe_free(struct mqpipe *p)
+{
+	int i;
+
+	if (p->queues)
+		for (i = 0; i < p->nqueues; i++)
+			spsc_ring_free(&p->queues[i].ring);
+	if (p->cons)
+		for (i = 0; i < p->ncons; i++)
+			kfree(p->cons[i].queues);
+	kfree(p->queues);
+	kfree(p->cons);
+	p->queues = NULL;
+	p->cons = NULL;
+}
+
+static inline int mqpipe_init(struct mqpipe *p, int ncons, int nqueues,
+			      int credits,
+			      void (*handle)(struct mqpipe_cons *c, void *item))
+{
+	int i;
+
+	p->ncons = ncons;
+	p->nqueues = nqueues;
+	p->credits = credits;
+	p->handle = handle;
+	p->budget = 256;
+	p->weight = 64;
+	p->poll_ns = 0;
+	p->stop = 0;
+	p->cons = kcalloc(ncons, sizeof(*p->cons), GFP_KERNEL);
+	p->queues = kcalloc(nqueues, sizeof(*p->queues), GFP_KERNEL);
+	if (!p->cons || !p->queues)
+		goto err;
+	for (i = 0; i < ncons; i++) {
+		p->cons[i].id = i;
+		p->cons[i].queues = kcalloc(DIV_ROUND_UP(nqueues, ncons),
+					    sizeof(*p->cons[i].queues),
+					    GFP_KERNEL);
+		if (!p->cons[i].queues)
+			goto err;
+	}
+	for (i = 0; i < nqueues; i++)
+		if (spsc_ring_init(&p->queues[i].ring, credits))
+			goto err;
+	return 0;
+err:
+	mqpipe_free(p);
+	return -ENOMEM;
+}
+
+/* empty queues, full credits, queues 0..@nqueues-1 spread over consumers */
+static inline void mqpipe_reset(struct mqpipe *p, int nqueues)
+{
+	struct mqpipe_queue *q;
+	struct mqpipe_cons *c;
+	int i;
+
+	p->stop = 0;
+	for (i = 0; i < p->ncons; i++) {
+		c = &p->cons[i];
+		c->armed = 0;
+		c->task = NULL;
+		c->nr = 0;
+		c->next = 0;
+		c->items = c->polls = c->sleeps = 0;
+	}
+	for (i = 0; i < min(nqueues, p->nqueues); i++) {
+		q = &p->queues[i];
+		q->ring.head = q->ring.cached_tail = 0;
+		q->ring.tail = q->ring.cached_head = 0;
+		atomic_set(&q->credit, p->credits);
+		q->stalls = q->wakeups = 0;
+		q->max_depth = 0;
+		c = &p->cons[i % p->ncons];
+		q->cons = c;
+		c->queues[c->nr++] = q;
+	}
+}
+
+/* producer of @q: false if the pipe stopped while waiting for credit */
+static inline bool mqpipe_send(struct mqpipe *p, struct mqpipe_queue *q,
+			       void *item)
+{
+	struct mqpipe_cons *c = q->cons;
+
+	/* only we take credit, so once positive it stays positive */
+	if (atomic_read(&q->credit) <= 0) {
+		q->stalls++;
+		wait_var_event(&q->credit, atomic_read(&q->credit) > 0 ||
+			       READ_ONCE(p->stop) || kthread_should_stop());
+		if (atomic_read(&q->credit) <= 0)
+			return false;
+	}
+	atomic_dec(&q->credit);
+	/* a credit is a free slot, this cannot fail */
+	spsc_ring_push(&q->ring, &item, 1);
+
+	smp_mb();	/* item before armed, pairs with mqpipe_idle() */
+	if (READ_ONCE(c->armed) && xchg(&c->armed, 0)) {
+		q->wakeups++;
+		wake_up_process(c->task);
+	}
+	return true;
+}
+
+static inline bool mqpipe_pending(struct mqpipe_cons *c)
+{
+	int i;
+
+	for (i = 0; i < c->nr; i++)
+		if (!spsc_ring_empty(&c->queues[i]->ring))
+			return true;
+	return false;
+}
+
+/* one round over the queues of @c, returns the items handled */
+static inline int mqpipe_poll(struct mqpipe *p, struct mqpipe_cons *c)
+{
+	void *batch[MQPIPE_BATCH];
+	struct mqpipe_queue *q;
+	unsigned int depth, n;
+	int i, k, done, quota, work = 0;
+
+	for (i = 0; i < c->nr && work < p->budget; i++) {
+		q = c->queues[(c->next + i) % c->nr];
+		depth = smp_load_acquire(&q->ring.head) - q->ring.tail;
+		q->max_depth = max(q->max_depth, depth);
+
+		quota = min(p->weight, p->budget - work);
+		for (done = 0; done < quota; done += n) {
+			n = spsc_ring_pop(&q->ring, batch,
+					  min(quota - done, MQPIPE_BATCH));
+			if (!n)
+				break;
+			for (k = 0; k < n; k++)
+				p->handle(c, batch[k]);
+		}
+		if (done) {
+			atomic_add(done, &q->credit);
+			smp_mb__after_atomic();
+			wake_up_var(&q->credit);
+		}
+		work += done;
+	}
+	if (c->nr)
+		c->next = (c->next + 1) % c->nr;
+	c->items += work;
+	c->polls++;
+	return work;
+}
+
+/* caught up: poll on for poll_ns, then re-arm and sleep until an item */
+static inline void mqpipe_idle(struct mqpipe *p, struct mqpipe_cons *c)
+{
+	if (p->poll_ns && ktime_get_ns() - c->last_work_ns < p->poll_ns) {
+		cpu_relax();
+		return;
+	}
+
+	WRITE_ONCE(c->armed, 1);
+	/* armed before the queue checks, pairs with mqpipe_send() */
+	set_current_state(TASK_INTERRUPTIBLE);
+	if (!mqpipe_pending(c) && !READ_ONCE(p->stop) &&
+	    !kthread_should_stop()) {
+		c->sleeps++;
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+	WRITE_ONCE(c->armed, 0);
+}
+
+/* consumer thread body, false once the pipe is stopped */
+static inline bool mqpipe_consume(struct mqpipe *p, struct mqpipe_cons *c)
+{
+	int work;
+
+	if (READ_ONCE(p->stop) || kthread_should_stop())
+		return false;
+	work = mqpipe_poll(p, c);
+	if (work)
+		c->last_work_ns = ktime_get_ns();
+	if (work < p->budget)
+		mqpipe_idle(p, c);
+	cond_resched();
+	return true;
+}
+
+/* end the run: consumers return from mqpipe_consume(), senders give up */
+static inline void mqpipe_stop(struct mqpipe *p)
+{
+	int i;
+
+	if (xchg(&p->stop, 1))
+		return;
+	for (i = 0; i < p->ncons; i++)
+		if (p->cons[i].task)
+			wake_up_process(p->cons[i].task);
+	for (i = 0; i < p->nqueues; i++)
+		wake_up_var(&p->queues[i].credit);
+}
+
+#endif /* _SYNC_MQPIPE_H */
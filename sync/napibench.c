@@ -0,0 +1,372 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Multi-queue pipeline benchmark
+ *
+ * kthread_sync_waitq.c passes work between one producer and one
+ * consumer through a flag and a waitqueue. This runs the mqpipe.h
+ * pipeline instead: consumers (one per CPU) poll the queues of several
+ * producers with a NAPI style budget, sleep when they catch up, and
+ * producers are held back by per-queue credits.
+ *
+ * The producer count is swept while the consumer count stays fixed.
+ * Each item carries its send time; the consumer burns work_ns on it and
+ * records the latency. Past the point where the consumers are saturated
+ * throughput flattens, the consumers stop sleeping, producers stall on
+ * credits, and the deepest queue stays at credits items.
+ *
+ *   insmod napibench.ko consumers=2 work_ns=500 producers=1,2,4,8,16
+ *   cat /sys/kernel/debug/napibench/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+
+#include "bench.h"
+#include "mqpipe.h"
+
+#define MODNAME "[NAPIBENCH] "
+
+#define NB_MAX_STEPS	16
+
+static int consumers;
+module_param(consumers, int, 0444);
+MODULE_PARM_DESC(consumers, "Consumer threads (0 = half the online CPUs)");
+
+static int producers[NB_MAX_STEPS];
+static int nr_steps;
+module_param_array(producers, int, &nr_steps, 0444);
+MODULE_PARM_DESC(producers, "Producer counts to sweep (default 1, 2, 4, ... up to 4x consumers)");
+
+static int budget = 256;
+module_param(budget, int, 0444);
+MODULE_PARM_DESC(budget, "Items per consumer poll round over all queues");
+
+static int weight = 64;
+module_param(weight, int, 0444);
+MODULE_PARM_DESC(weight, "Items per poll round from one queue");
+
+static int credits = 256;
+module_param(credits, int, 0444);
+MODULE_PARM_DESC(credits, "Items a producer may have queued");
+
+static int poll_us;
+module_param(poll_us, int, 0444);
+MODULE_PARM_DESC(poll_us, "Consumers keep polling this long after the last item before sleeping");
+
+static int work_ns = 200;
+module_param(work_ns, int, 0444);
+MODULE_PARM_DESC(work_ns, "Consumer work per item in ns");
+
+static int gap_ns;
+module_param(gap_ns, int, 0444);
+MODULE_PARM_DESC(gap_ns, "Producer work between items in ns");
+
+static int duration_ms = 2000;
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Run length per producer count in ms");
+
+struct nb_result {
+	bool ran;
+	u64 items;
+	u64 ns;
+	u64 wakeups;
+	u64 sleeps;
+	u64 polls;
+	u64 stalls;
+	u64 sent;
+	unsigned int max_depth;
+	u64 lat_p50;
+	u64 lat_p99;
+	u64 lat_max;
+	struct bench_perf_sum perf;
+};
+
+struct nb_producer {
+	struct task_struct *task;
+	struct mqpipe_queue *q;
+	u64 sent;
+} ____cacheline_aligned_in_smp;
+
+static struct mqpipe nb_pipe;
+static struct bench_hist *nb_lat;	/* per consumer */
+static struct nb_producer *nb_prods;
+static struct nb_result nb_results[NB_MAX_STEPS];
+static struct bench_ctl nb_ctl;
+static struct task_struct *nb_task;
+static DECLARE_COMPLETION(nb_all_done);
+static struct dentry *nb_dir;
+
+/* send times travel as the item pointer; the difference survives wrapping */
+static void nb_handle(struct mqpipe_cons *c, void *item)
+{
+	unsigned long sent = (unsigned long)item;
+
+	bench_spin_ns(work_ns);
+	bench_hist_add(&nb_lat[c->id], (unsigned long)ktime_get_ns() - sent);
+}
+
+static int nb_consumer(void *arg)
+{
+	struct mqpipe_cons *c = arg;
+	struct bench_perf perf;
+
+	bench_perf_open(&perf);
+	bench_gate(&nb_ctl);
+	bench_perf_start(&perf);
+	while (mqpipe_consume(&nb_pipe, c))
+		;
+	bench_perf_stop(&perf, &nb_ctl);
+	bench_done(&nb_ctl);
+	return 0;
+}
+
+static int nb_producer(void *arg)
+{
+	struct nb_producer *pr = arg;
+	struct bench_perf perf;
+	void *item;
+
+	bench_perf_open(&perf);
+	bench_gate(&nb_ctl);
+	bench_perf_start(&perf);
+	while (bench_running(&nb_ctl)) {
+		item = (void *)(unsigned long)ktime_get_ns();
+		if (!mqpipe_send(&nb_pipe, pr->q, item))
+			break;
+		if (++pr->sent % 64 == 0)
+			cond_resched();
+		bench_spin_ns(gap_ns);
+	}
+	mqpipe_stop(&nb_pipe);
+	bench_perf_stop(&perf, &nb_ctl);
+	bench_done(&nb_ctl);
+	return 0;
+}
+
+static int nb_run(int step)
+{
+	struct nb_result *r = &nb_results[step];
+	struct bench_hist *lat;
+	struct task_struct *t;
+	int np = producers[step];
+	int i, started = 0, ret = 0;
+
+	mqpipe_reset(&nb_pipe, np);
+	for (i = 0; i < consumers; i++)
+		bench_hist_init(&nb_lat[i]);
+
+	bench_ctl_init(&nb_ctl, consumers + np, duration_ms);
+	for (i = 0; i < consumers; i++, started++) {
+		t = bench_kthread_run(nb_consumer, &nb_pipe.cons[i],
+				      "napibench-c", i);
+		if (IS_ERR(t)) {
+			ret = PTR_ERR(t);
+			goto out;
+		}
+		nb_pipe.cons[i].task = t;
+	}
+	for (i = 0; i < np; i++, started++) {
+		nb_prods[i].q = &nb_pipe.queues[i];
+		nb_prods[i].sent = 0;
+		t = bench_kthread_place(nb_producer, &nb_prods[i],
+					"napibench-p", i, consumers + i);
+		if (IS_ERR(t)) {
+			ret = PTR_ERR(t);
+			goto out;
+		}
+		nb_prods[i].task = t;
+	}
+	wait_for_completion(&nb_ctl.finished);
+
+	lat = kmalloc(sizeof(*lat), GFP_KERNEL);
+	if (!lat) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	bench_hist_init(lat);
+	memset(r, 0, sizeof(*r));
+	for (i = 0; i < consumers; i++) {
+		struct mqpipe_cons *c = &nb_pipe.cons[i];
+
+		bench_hist_merge(lat, &nb_lat[i]);
+		r->items += c->items;
+		r->sleeps += c->sleeps;
+		r->polls += c->polls;
+	}
+	for (i = 0; i < np; i++) {
+		struct mqpipe_queue *q = &nb_pipe.queues[i];
+
+		r->wakeups += q->wakeups;
+		r->stalls += q->stalls;
+		r->sent += nb_prods[i].sent;
+		r->max_depth = max(r->max_depth, q->max_depth);
+	}
+	r->ns = bench_elapsed_ns(&nb_ctl);
+	r->lat_p50 = bench_hist_pct(lat, 500);
+	r->lat_p99 = bench_hist_pct(lat, 990);
+	r->lat_max = lat->max;
+	r->perf = nb_ctl.perf;
+	r->ran = true;
+	kfree(lat);
+out:
+	if (ret && ret != -ENOMEM)
+		pr_err("%s: unable to start kernel thread\n", __func__);
+	if (ret)
+		mqpipe_stop(&nb_pipe);
+	for (i = 0; i < started; i++)
+		kthread_stop(i < consumers ? nb_pipe.cons[i].task :
+					     nb_prods[i - consumers].task);
+	bench_ctl_cleanup(&nb_ctl);
+	return ret;
+}
+
+static int nb_main(void *arg)
+{
+	int s;
+
+	for (s = 0; s < nr_steps; s++)
+		if (kthread_should_stop() || nb_run(s))
+			break;
+	complete(&nb_all_done);
+	bench_park();
+	return 0;
+}
+
+static int nb_results_show(struct seq_file *m, void *v)
+{
+	struct nb_result *r;
+	u64 per_k;
+	int s;
+
+	if (!completion_done(&nb_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_printf(m, "consumers %d budget %d weight %d credits %d poll_us %d work_ns %d gap_ns %d\n",
+		   consumers, budget, weight, credits, poll_us, work_ns,
+		   gap_ns);
+	bench_placement_show(m);
+	seq_printf(m, "%9s %12s %10s %10s %10s %10s %10s %10s %9s\n",
+		   "producers", "items/s", "lat_p50", "lat_p99", "lat_max",
+		   "wake/1k", "sleep/1k", "stall/1k", "max_depth");
+	for (s = 0; s < nr_steps; s++) {
+		r = &nb_results[s];
+		if (!r->ran)
+			continue;
+		per_k = max(r->items, 1ULL);
+		seq_printf(m, "%9d %12llu %10llu %10llu %10llu %10llu %10llu %10llu %9u",
+			   producers[s], bench_rate(r->items, r->ns),
+			   r->lat_p50, r->lat_p99, r->lat_max,
+			   div64_u64(r->wakeups * 1000, per_k),
+			   div64_u64(r->sleeps * 1000, per_k),
+			   div64_u64(r->stalls * 1000, per_k), r->max_depth);
+		bench_perf_show(m, &r->perf, r->items);
+		seq_putc(m, '\n');
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(nb_results);
+
+static int __init nb_init(void)
+{
+	int i, ret, max_prods = 0;
+
+	if (consumers <= 0)
+		consumers = max(num_online_cpus() / 2, 1U);
+	if (!nr_steps) {
+		for (i = 1; i <= 4 * consumers && nr_steps < NB_MAX_STEPS;
+		     i *= 2)
+			producers[nr_steps++] = i;
+	}
+	for (i = 0; i < nr_steps; i++) {
+		producers[i] = max(producers[i], 1);
+		max_prods = max(max_prods, producers[i]);
+	}
+	credits = max(credits, 1);
+
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+	ret = mqpipe_init(&nb_pipe, consumers, max_prods, credits, nb_handle);
+	if (ret)
+		goto err_place;
+	nb_pipe.budget = max(budget, 1);
+	nb_pipe.weight = max(weight, 1);
+	nb_pipe.poll_ns = (u64)max(poll_us, 0) * NSEC_PER_USEC;
+
+	ret = -ENOMEM;
+	nb_lat = kcalloc(consumers, sizeof(*nb_lat), GFP_KERNEL);
+	nb_prods = kcalloc(max_prods, sizeof(*nb_prods), GFP_KERNEL);
+	if (!nb_lat || !nb_prods)
+		goto err_pipe;
+
+	nb_task = kthread_run(nb_main, NULL, "napibench");
+	if (IS_ERR(nb_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		ret = PTR_ERR(nb_task);
+		goto err_pipe;
+	}
+
+	nb_dir = debugfs_create_dir("napibench", NULL);
+	debugfs_create_file("results", 0444, nb_dir, NULL, &nb_results_fops);
+	return 0;
+
+err_pipe:
+	kfree(nb_prods);
+	kfree(nb_lat);
+	mqpipe_free(&nb_pipe);
+err_place:
+	bench_placement_free();
+	return ret;
+}
+
+static void __exit nb_exit(void)
+{
+	debugfs_remove_recursive(nb_dir);
+	kthread_stop(nb_task);
+	kfree(nb_prods);
+	kfree(nb_lat);
+	mqpipe_free(&nb_pipe);
+	bench_placement_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(nb_init);
+module_exit(nb_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("multi-queue NAPI style pipeline benchmark");
+MODULE_LICENSE("Dual MIT/GPL");
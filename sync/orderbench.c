@@ -0,0 +1,547 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Memory ordering cost benchmark
+ *
+ * Per-op cost: every op variant below runs for duration_ms on one
+ * thread (uncontended) and then on nthreads threads hammering the same
+ * word (contended). Every op has its own loop with the op expanded
+ * inline, so no indirect call is timed with it; the "none" op measures
+ * the bare loop and can be subtracted from the others.
+ *
+ *   once			READ_ONCE() + WRITE_ONCE()
+ *   load_acquire		smp_load_acquire()
+ *   store_release		smp_store_release()
+ *   wmb, rmb, mb		WRITE_ONCE() + smp_wmb(), READ_ONCE() +
+ *				smp_rmb(), WRITE_ONCE() + smp_mb()
+ *   inc			atomic_inc(), no ordering
+ *   add_return[_relaxed]	fully ordered / relaxed
+ *   fetch_add[_relaxed,	fully ordered / relaxed / acquire / release
+ *   _acquire,_release]
+ *   xchg, cmpxchg		atomic_xchg(), atomic_cmpxchg()
+ *
+ * Message passing latency: two threads bounce a message. The sender
+ * writes the data and then publishes a flag, the receiver waits for the
+ * flag and checks the data, then answers the same way. Flavors:
+ *
+ *   once	WRITE_ONCE() / READ_ONCE(), no ordering at all: the data
+ *		check can fail on weakly ordered CPUs
+ *   acqrel	smp_store_release() / smp_load_acquire()
+ *   wmb_rmb	smp_wmb() before the flag / smp_rmb() after it
+ *   mb		smp_mb() on both sides
+ *   xchg	xchg() to publish, smp_load_acquire() to read
+ *
+ *   insmod orderbench.ko nthreads=8 placement=scatter
+ *   cat /sys/kernel/debug/orderbench/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/atomic.h>
+#include <linux/cache.h>
+
+#include "bench.h"
+
+#define MODNAME "[ORDERBENCH] "
+
+static char *op = "all";
+module_param(op, charp, 0444);
+MODULE_PARM_DESC(op, "all, or one op: none, once, load_acquire, store_release, wmb, rmb, mb, inc, add_return, ...");
+
+static char *mp = "all";
+module_param(mp, charp, 0444);
+MODULE_PARM_DESC(mp, "all, none, or one message passing flavor: once, acqrel, wmb_rmb, mb or xchg");
+
+static int nthreads;
+module_param(nthreads, int, 0444);
+MODULE_PARM_DESC(nthreads, "Threads for the contended runs (0 = one per online CPU)");
+
+static int duration_ms = 1000;
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Run length per op, contention level and flavor in ms");
+
+/* per-op cost */
+
+struct ob_word {
+	long v;
+	atomic_t a;
+} ____cacheline_aligned_in_smp;
+
+static struct ob_word ob_word;
+static struct bench_ctl ob_ctl;
+
+/* the timed loop of one op, returns the number of ops run */
+#define OB_OP(name, expr)					\
+static long ob_##name(struct ob_word *w)			\
+{								\
+	long i, sink = 0;					\
+								\
+	for (i = 0; bench_running(&ob_ctl); i++) {		\
+		sink += (expr);					\
+		if (i % 4096 == 4095)				\
+			cond_resched();				\
+	}							\
+	barrier_data(&sink);					\
+	return i;						\
+}
+
+OB_OP(none, i)
+OB_OP(once, ({ WRITE_ONCE(w->v, READ_ONCE(w->v) + 1); i; }))
+OB_OP(load_acquire, smp_load_acquire(&w->v))
+OB_OP(store_release, ({ smp_store_release(&w->v, i); i; }))
+OB_OP(wmb, ({ WRITE_ONCE(w->v, i); smp_wmb(); i; }))
+OB_OP(rmb, ({ long v = READ_ONCE(w->v); smp_rmb(); v; }))
+OB_OP(mb, ({ WRITE_ONCE(w->v, i); smp_mb(); i; }))
+OB_OP(inc, ({ atomic_inc(&w->a); i; }))
+OB_OP(add_return, atomic_add_return(1, &w->a))
+OB_OP(add_return_relaxed, atomic_add_return_relaxed(1, &w->a))
+OB_OP(fetch_add, atomic_fetch_add(1, &w->a))
+OB_OP(fetch_add_relaxed, atomic_fetch_add_relaxed(1, &w->a))
+OB_OP(fetch_add_acquire, atomic_fetch_add_acquire(1, &w->a))
+OB_OP(fetch_add_release, atomic_fetch_add_release(1, &w->a))
+OB_OP(xchg, atomic_xchg(&w->a, i))
+OB_OP(cmpxchg, atomic_cmpxchg(&w->a, i, i + 1))
+
+struct ob_op {
+	const char *name;
+	long (*loop)(struct ob_word *w);
+};
+
+#define OB_OP_ENTRY(name)	{ #name, ob_##name }
+
+static const struct ob_op ob_ops[] = {
+	OB_OP_ENTRY(none),
+	OB_OP_ENTRY(once),
+	OB_OP_ENTRY(load_acquire),
+	OB_OP_ENTRY(store_release),
+	OB_OP_ENTRY(wmb),
+	OB_OP_ENTRY(rmb),
+	OB_OP_ENTRY(mb),
+	OB_OP_ENTRY(inc),
+	OB_OP_ENTRY(add_return),
+	OB_OP_ENTRY(add_return_relaxed),
+	OB_OP_ENTRY(fetch_add),
+	OB_OP_ENTRY(fetch_add_relaxed),
+	OB_OP_ENTRY(fetch_add_acquire),
+	OB_OP_ENTRY(fetch_add_release),
+	OB_OP_ENTRY(xchg),
+	OB_OP_ENTRY(cmpxchg),
+};
+
+#define OB_NR_OPS	ARRAY_SIZE(ob_ops)
+
+enum { OB_UNCONTENDED, OB_CONTENDED, OB_NR_LEVELS };
+
+struct ob_result {
+	bool ran;
+	u64 ops;
+	u64 ns;			/* summed over the threads */
+	struct bench_perf_sum perf;
+};
+
+/* message passing */
+
+struct ob_chan {
+	int data;
+	int flag;
+} ____cacheline_aligned_in_smp;
+
+static void mp_pub_once(int *flag, int v)
+{
+	WRITE_ONCE(*flag, v);
+}
+
+static int mp_sub_once(int *flag)
+{
+	return READ_ONCE(*flag);
+}
+
+static void mp_pub_acqrel(int *flag, int v)
+{
+	smp_store_release(flag, v);
+}
+
+static int mp_sub_acqrel(int *flag)
+{
+	return smp_load_acquire(flag);
+}
+
+static void mp_pub_wmb(int *flag, int v)
+{
+	smp_wmb();
+	WRITE_ONCE(*flag, v);
+}
+
+static int mp_sub_rmb(int *flag)
+{
+	int v = READ_ONCE(*flag);
+
+	smp_rmb();
+	return v;
+}
+
+static void mp_pub_mb(int *flag, int v)
+{
+	smp_mb();
+	WRITE_ONCE(*flag, v);
+}
+
+static int mp_sub_mb(int *flag)
+{
+	int v = READ_ONCE(*flag);
+
+	smp_mb();
+	return v;
+}
+
+static void mp_pub_xchg(int *flag, int v)
+{
+	xchg(flag, v);
+}
+
+struct ob_mp {
+	const char *name;
+	void (*pub)(int *flag, int v);
+	int (*sub)(int *flag);
+};
+
+static const struct ob_mp ob_mps[] = {
+	{ "once",	mp_pub_once,	mp_sub_once },
+	{ "acqrel",	mp_pub_acqrel,	mp_sub_acqrel },
+	{ "wmb_rmb",	mp_pub_wmb,	mp_sub_rmb },
+	{ "mb",		mp_pub_mb,	mp_sub_mb },
+	{ "xchg",	mp_pub_xchg,	mp_sub_acqrel },
+};
+
+#define OB_NR_MPS	ARRAY_SIZE(ob_mps)
+
+struct ob_mp_result {
+	bool ran;
+	u64 reordered;		/* flag seen before the data */
+	struct bench_hist rtt;
+};
+
+struct ob_thread {
+	struct task_struct *task;
+	u64 ops;
+	u64 ns;
+} ____cacheline_aligned_in_smp;
+
+static struct ob_result ob_results[OB_NR_OPS][OB_NR_LEVELS];
+static struct ob_mp_result *ob_mp_results;
+static struct ob_thread *ob_threads;
+static const struct ob_op *ob_cur_op;
+static const struct ob_mp *ob_cur_mp;
+static struct ob_mp_result *ob_cur_mp_result;
+static struct ob_chan ob_ping, ob_pong;
+static struct task_struct *ob_task;
+static DECLARE_COMPLETION(ob_all_done);
+static struct dentry *ob_dir;
+
+static int ob_worker(void *arg)
+{
+	struct ob_thread *t = arg;
+	struct bench_perf perf;
+	u64 t0;
+
+	bench_perf_open(&perf);
+	bench_gate(&ob_ctl);
+	bench_perf_start(&perf);
+	t0 = ktime_get_ns();
+	t->ops = ob_cur_op->loop(&ob_word);
+	t->ns = ktime_get_ns() - t0;
+	bench_perf_stop(&perf, &ob_ctl);
+	bench_done(&ob_ctl);
+	return 0;
+}
+
+/* wait for @v on @c, false when the run ended first */
+static bool ob_mp_wait(struct ob_chan *c, int v)
+{
+	while (ob_cur_mp->sub(&c->flag) != v) {
+		if (!bench_running(&ob_ctl))
+			return false;
+		cpu_relax();
+	}
+	return true;
+}
+
+static int ob_mp_pinger(void *arg)
+{
+	struct ob_mp_result *r = ob_cur_mp_result;
+	int v;
+	u64 t0;
+
+	bench_gate(&ob_ctl);
+	for (v = 1; bench_running(&ob_ctl); v++) {
+		t0 = ktime_get_ns();
+		WRITE_ONCE(ob_ping.data, v);
+		ob_cur_mp->pub(&ob_ping.flag, v);
+		if (!ob_mp_wait(&ob_pong, v))
+			break;
+		if (READ_ONCE(ob_pong.data) != v)
+			r->reordered++;
+		bench_hist_add(&r->rtt, ktime_get_ns() - t0);
+		if (v % 4096 == 0)
+			cond_resched();
+	}
+	bench_done(&ob_ctl);
+	return 0;
+}
+
+/* counts its reordered messages in t->ops, the pinger owns the result */
+static int ob_mp_ponger(void *arg)
+{
+	struct ob_thread *t = arg;
+	int v;
+
+	bench_gate(&ob_ctl);
+	for (v = 1; ob_mp_wait(&ob_ping, v); v++) {
+		if (READ_ONCE(ob_ping.data) != v)
+			t->ops++;
+		WRITE_ONCE(ob_pong.data, v);
+		ob_cur_mp->pub(&ob_pong.flag, v);
+	}
+	bench_done(&ob_ctl);
+	return 0;
+}
+
+static void ob_stop_threads(int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		kthread_stop(ob_threads[i].task);
+}
+
+static int ob_start(int n, int (*fn)(void *), const char *name)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		ob_threads[i].ops = 0;
+		ob_threads[i].task = bench_kthread_run(fn, &ob_threads[i],
+						       name, i);
+		if (IS_ERR(ob_threads[i].task)) {
+			pr_err("%s: unable to start kernel thread\n", __func__);
+			ob_stop_threads(i);
+			return PTR_ERR(ob_threads[i].task);
+		}
+	}
+	return 0;
+}
+
+static int ob_run_op(int o, int level)
+{
+	struct ob_result *r = &ob_results[o][level];
+	int n = level == OB_CONTENDED ? nthreads : 1;
+	int i, ret;
+
+	ob_cur_op = &ob_ops[o];
+	bench_ctl_init(&ob_ctl, n, duration_ms);
+	ret = ob_start(n, ob_worker, "orderbench");
+	if (ret)
+		goto out;
+	wait_for_completion(&ob_ctl.finished);
+	ob_stop_threads(n);
+	for (i = 0; i < n; i++) {
+		r->ops += ob_threads[i].ops;
+		r->ns += ob_threads[i].ns;
+	}
+	r->perf = ob_ctl.perf;
+	r->ran = true;
+out:
+	bench_ctl_cleanup(&ob_ctl);
+	return ret;
+}
+
+static int ob_run_mp(int f)
+{
+	struct ob_mp_result *r = &ob_mp_results[f];
+	int ret;
+
+	ob_cur_mp = &ob_mps[f];
+	ob_cur_mp_result = r;
+	bench_hist_init(&r->rtt);
+	memset(&ob_ping, 0, sizeof(ob_ping));
+	memset(&ob_pong, 0, sizeof(ob_pong));
+
+	bench_ctl_init(&ob_ctl, 2, duration_ms);
+	ob_threads[1].ops = 0;
+	ob_threads[0].task = bench_kthread_run(ob_mp_pinger, NULL,
+					       "orderbench-ping", 0);
+	if (IS_ERR(ob_threads[0].task)) {
+		ret = PTR_ERR(ob_threads[0].task);
+		goto err;
+	}
+	ob_threads[1].task = bench_kthread_run(ob_mp_ponger, &ob_threads[1],
+					       "orderbench-pong", 1);
+	if (IS_ERR(ob_threads[1].task)) {
+		ret = PTR_ERR(ob_threads[1].task);
+		kthread_stop(ob_threads[0].task);
+		goto err;
+	}
+	wait_for_completion(&ob_ctl.finished);
+	ob_stop_threads(2);
+	bench_ctl_cleanup(&ob_ctl);
+	r->reordered += ob_threads[1].ops;
+	r->ran = true;
+	return 0;
+err:
+	pr_err("%s: unable to start kernel thread\n", __func__);
+	bench_ctl_cleanup(&ob_ctl);
+	return ret;
+}
+
+static int ob_main(void *arg)
+{
+	int i, level;
+
+	for (i = 0; i < OB_NR_OPS; i++) {
+		if (strcmp(op, "all") && strcmp(op, ob_ops[i].name))
+			continue;
+		for (level = 0; level < OB_NR_LEVELS; level++)
+			if (kthread_should_stop() || ob_run_op(i, level))
+				goto out;
+	}
+	for (i = 0; i < OB_NR_MPS; i++) {
+		if (strcmp(mp, "all") && strcmp(mp, ob_mps[i].name))
+			continue;
+		if (kthread_should_stop() || ob_run_mp(i))
+			goto out;
+	}
+out:
+	complete(&ob_all_done);
+	bench_park();
+	return 0;
+}
+
+static int ob_results_show(struct seq_file *m, void *v)
+{
+	struct ob_result *u, *c;
+	u64 un, cn;
+	int i;
+
+	if (!completion_done(&ob_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_printf(m, "contended_threads %d duration_ms %d\n", nthreads,
+		   duration_ms);
+	bench_placement_show(m);
+	seq_printf(m, "%-20s %12s %12s\n", "op", "ns/op", "contended");
+	for (i = 0; i < OB_NR_OPS; i++) {
+		u = &ob_results[i][OB_UNCONTENDED];
+		c = &ob_results[i][OB_CONTENDED];
+		if (!u->ran)
+			continue;
+		un = bench_milli(u->ns, u->ops);
+		cn = bench_milli(c->ns, c->ops);
+		seq_printf(m, "%-20s " BENCH_MILLI_FMTW(8) " "
+			   BENCH_MILLI_FMTW(8), ob_ops[i].name,
+			   BENCH_MILLI_ARG(un), BENCH_MILLI_ARG(cn));
+		bench_perf_show(m, &u->perf, u->ops);
+		seq_putc(m, '\n');
+	}
+
+	seq_printf(m, "\n%-10s %10s %10s %10s %10s %10s\n", "mp", "rounds",
+		   "rtt_p50", "rtt_p99", "rtt_max", "reordered");
+	for (i = 0; i < OB_NR_MPS; i++) {
+		struct ob_mp_result *r = &ob_mp_results[i];
+
+		if (!r->ran)
+			continue;
+		seq_printf(m, "%-10s %10llu %10llu %10llu %10llu %10llu\n",
+			   ob_mps[i].name, r->rtt.count,
+			   bench_hist_pct(&r->rtt, 500),
+			   bench_hist_pct(&r->rtt, 990), r->rtt.max,
+			   r->reordered);
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ob_results);
+
+static int __init ob_init(void)
+{
+	int ret;
+
+	if (nthreads <= 0)
+		nthreads = num_online_cpus();
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+
+	ob_threads = kcalloc(max(nthreads, 2), sizeof(*ob_threads),
+			     GFP_KERNEL);
+	ob_mp_results = kcalloc(OB_NR_MPS, sizeof(*ob_mp_results),
+				GFP_KERNEL);
+	if (!ob_threads || !ob_mp_results) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	ob_task = kthread_run(ob_main, NULL, "orderbench");
+	if (IS_ERR(ob_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		ret = PTR_ERR(ob_task);
+		goto err;
+	}
+
+	ob_dir = debugfs_create_dir("orderbench", NULL);
+	debugfs_create_file("results", 0444, ob_dir, NULL, &ob_results_fops);
+	return 0;
+err:
+	kfree(ob_mp_results);
+	kfree(ob_threads);
+	bench_placement_free();
+	return ret;
+}
+
+static void __exit ob_exit(void)
+{
+	debugfs_remove_recursive(ob_dir);
+	kthread_stop(ob_task);
+	kfree(ob_mp_results);
+	kfree(ob_threads);
+	bench_placement_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(ob_init);
+module_exit(ob_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("memory ordering cost benchmark");
+MODULE_LICENSE("Dual MIT/GPL");
@@ -0,0 +1,215 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * CPU hotplug aware per-CPU statistics.
+ *
+ * kthread_pcpu.c sums its per-CPU data with for_each_possible_cpu(),
+ * which on a VM that can hotplug up to hundreds of vCPUs but runs with a
+ * handful walks mostly empty slots on every read, and it loses nothing
+ * only because it never cares about CPUs going away. pcpu_stats keeps
+ * @nr u64 counters per CPU plus a global accumulator:
+ *
+ *   - updates are a this_cpu_add() on the local slot, no lock;
+ *   - when a CPU goes offline, a CPU hotplug callback folds its slots
+ *     into the accumulator once the CPU is dead, and zeroes them;
+ *   - reads add the accumulator to the slots of the CPUs in a "live"
+ *     mask (online, or offline but not yet folded), so they cost one
+ *     step per online CPU instead of one per possible CPU. They take no
+ *     lock: the hotplug callbacks change the accumulator and the mask
+ *     inside a seqcount, and a read that overlaps one retries.
+ *
+ * The hotplug state is shared by all instances of a module: call
+ * pcpu_stats_setup() from module init before the first
+ * pcpu_stats_init(), and pcpu_stats_cleanup() on exit after the last
+ * pcpu_stats_destroy().
+ *
+ * Usage:
+ *	pcpu_stats_setup("mymod");
+ *	pcpu_stats_init(&st, NR_MY_STATS);
+ *	pcpu_stats_add(&st, MY_STAT_RX, len);
+ *	total = pcpu_stats_read(&st, MY_STAT_RX);
+ *	pcpu_stats_destroy(&st);
+ *	pcpu_stats_cleanup();
+ */
+#ifndef _SYNC_PCPU_STATS_H
+#define _SYNC_PCPU_STATS_H
+
+#include <linux/kernel.h>
+#include <linux/cpu.h>
+#include <linux/cpuhotplug.h>
+#include <linux/cpumask.h>
+#include <linux/percpu.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+
+struct pcpu_stats {
+	unsigned int nr;
+	u64 __percpu *vals;	/* @nr counters per CPU */
+	u64 *folded;		/* counts of CPUs that went offline */
+	cpumask_var_t live;	/* CPUs whose slots may be non-zero */
+	spinlock_t lock;	/* hotplug callbacks */
+	seqcount_spinlock_t seq; /* readers of folded and live */
+	struct hlist_node node;
+};
+
+static enum cpuhp_state pcpu_stats_state;
+
+/* before @cpu comes up: its slots are zero, start summing them */
+static inline int pcpu_stats_cpu_prepare(unsigned int cpu,
+					 struct hlist_node *node)
+{
+	struct pcpu_stats *s = hlist_entry(node, struct pcpu_stats, node);
+
+	spin_lock(&s->lock);
+	write_seqcount_begin(&s->seq);
+	cpumask_set_cpu(cpu, s->live);
+	write_seqcount_end(&s->seq);
+	spin_unlock(&s->lock);
+	return 0;
+}
+
+/* @cpu is dead, nothing can update its slots any more */
+static inline int pcpu_stats_cpu_dead(unsigned int cpu,
+				      struct hlist_node *node)
+{
+	struct pcpu_stats *s = hlist_entry(node, struct pcpu_stats, node);
+	u64 *v = per_cpu_ptr(s->vals, cpu);
+	unsigned int i;
+
+	spin_lock(&s->lock);
+	write_seqcount_begin(&s->seq);
+	for (i = 0; i < s->nr; i++) {
+		s->folded[i] += v[i];
+		v[i] = 0;
+	}
+	cpumask_clear_cpu(cpu, s->live);
+	write_seqcount_end(&s->seq);
+	spin_unlock(&s->lock);
+	return 0;
+}
+
+static inline int pcpu_stats_setup(const char *name)
+{
+	int ret;
+
+	ret = cpuhp_setup_state_multi(CPUHP_BP_PREPARE_DYN, name,
+				      pcpu_stats_cpu_prepare,
+				      pcpu_stats_cpu_dead);
+	if (ret < 0)
+		return ret;
+	pcpu_stats_state = ret;
+	return 0;
+}
+
+static inline void pcpu_stats_cleanup(void)
+{
+	cpuhp_remove_multi_state(pcpu_stats_state);
+}
+
+static inline void pcpu_stats_destroy(struct pcpu_stats *s)
+{
+	cpuhp_state_remove_instance_nocalls(pcpu_stats_state, &s->node);
+	free_cpumask_var(s->live);
+	kfree(s->folded);
+	free_percpu(s->vals);
+}
+
+static inline int pcpu_stats_init(struct pcpu_stats *s, unsigned int nr)
+{
+	int ret;
+
+	s->nr = nr;
+	spin_lock_init(&s->lock);
+	seqcount_spinlock_init(&s->seq, &s->lock);
+	s->vals = __alloc_percpu(nr * sizeof(u64), __alignof__(u64));
+	s->folded = kcalloc(nr, sizeof(u64), GFP_KERNEL);
+	if (!s->vals || !s->folded ||
+	    !zalloc_cpumask_var(&s->live, GFP_KERNEL)) {
+		kfree(s->folded);
+		free_percpu(s->vals);
+		return -ENOMEM;
+	}
+
+	/* runs pcpu_stats_cpu_prepare() for every CPU that is up */
+	ret = cpuhp_state_add_instance(pcpu_stats_state, &s->node);
+	if (ret) {
+		free_cpumask_var(s->live);
+		kfree(s->folded);
+		free_percpu(s->vals);
+	}
+	return ret;
+}
+
+static inline void pcpu_stats_add(struct pcpu_stats *s, unsigned int idx,
+				  u64 v)
+{
+	this_cpu_add(s->vals[idx], v);
+}
+
+static inline void pcpu_stats_inc(struct pcpu_stats *s, unsigned int idx)
+{
+	this_cpu_inc(s->vals[idx]);
+}
+
+static inline u64 pcpu_stats_read(struct pcpu_stats *s, unsigned int idx)
+{
+	unsigned int seq;
+	u64 sum;
+	int cpu;
+
+	do {
+		seq = read_seqcount_begin(&s->seq);
+		sum = READ_ONCE(s->folded[idx]);
+		for_each_cpu(cpu, s->live)
+			sum += READ_ONCE(per_cpu_ptr(s->vals, cpu)[idx]);
+	} while (read_seqcount_retry(&s->seq, seq));
+	return sum;
+}
+
+/* all @nr counters in one pass over the CPUs */
+static inline void pcpu_stats_read_all(struct pcpu_stats *s, u64 *out)
+{
+	unsigned int i, seq;
+	u64 *v;
+	int cpu;
+
+	do {
+		seq = read_seqcount_begin(&s->seq);
+		for (i = 0; i < s->nr; i++)
+			out[i] = READ_ONCE(s->folded[i]);
+		for_each_cpu(cpu, s->live) {
+			v = per_cpu_ptr(s->vals, cpu);
+			for (i = 0; i < s->nr; i++)
+				out[i] += READ_ONCE(v[i]);
+		}
+	} while (read_seqcount_retry(&s->seq, seq));
+}
+
+#endif /* _SYNC_PCPU_STATS_H */
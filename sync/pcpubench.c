@@ -0,0 +1,355 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Per-CPU statistics read cost
+ *
+ * Times one read of a per-CPU count, and one read of nr counts, done
+ * the ways the tree knows:
+ *
+ *   possible		sum over for_each_possible_cpu() (kthread_pcpu.c)
+ *   online		sum over for_each_online_cpu(), cheap but loses the
+ *			counts of CPUs that went offline
+ *   percpu_counter	percpu_counter_sum()
+ *   pcpu_stats		pcpu_stats.h, live CPUs plus folded counts
+ *
+ * The interesting case is a VM with many more possible than online
+ * CPUs. With hotplug_cpu set, the module also adds to every count on
+ * that CPU, takes it offline and back and shows what each method reads.
+ *
+ *   insmod pcpubench.ko nr=16 hotplug_cpu=3
+ *   cat /sys/kernel/debug/pcpubench/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/slab.h>
+#include <linux/debugfs.h>
+#include <linux/percpu.h>
+#include <linux/percpu_counter.h>
+#include <linux/workqueue.h>
+#include <linux/cpu.h>
+
+/* one reader thread, the controller; placement= would not apply */
+#define BENCH_NO_PLACEMENT
+#include "bench.h"
+#include "pcpu_stats.h"
+
+#define MODNAME "[PCPUBENCH] "
+
+#define PC_HOTPLUG_ADD	1000
+
+static int nr = 8;
+module_param(nr, int, 0444);
+MODULE_PARM_DESC(nr, "Counters per CPU");
+
+static int loops = 100000;
+module_param(loops, int, 0444);
+MODULE_PARM_DESC(loops, "Reads timed per method");
+
+static int hotplug_cpu = -1;
+module_param(hotplug_cpu, int, 0444);
+MODULE_PARM_DESC(hotplug_cpu, "CPU to offline and online again to check folding (-1 = none)");
+
+enum { PC_POSSIBLE, PC_ONLINE, PC_PCPU_COUNTER, PC_PCPU_STATS, PC_NR_METHODS };
+
+static const char * const pc_names[PC_NR_METHODS] = {
+	[PC_POSSIBLE]		= "possible",
+	[PC_ONLINE]		= "online",
+	[PC_PCPU_COUNTER]	= "percpu_counter",
+	[PC_PCPU_STATS]		= "pcpu_stats",
+};
+
+static u64 __percpu *pc_plain;		/* nr counters, summed by hand */
+static struct percpu_counter pc_counter;
+static struct pcpu_stats pc_stats;
+
+static u64 pc_read_ns[PC_NR_METHODS];
+static u64 pc_read_all_ns[PC_NR_METHODS];
+static struct bench_perf_sum pc_read_perf[PC_NR_METHODS];
+static struct bench_perf_sum pc_read_all_perf[PC_NR_METHODS];
+static bool pc_hp_ran;
+static int pc_hp_err;
+static u64 pc_hp_before[PC_NR_METHODS];
+static u64 pc_hp_offline[PC_NR_METHODS];
+static u64 pc_hp_after[PC_NR_METHODS];
+
+static struct task_struct *pc_task;
+static DECLARE_COMPLETION(pc_all_done);
+static struct dentry *pc_dir;
+
+static u64 pc_read(int method, unsigned int idx)
+{
+	u64 sum = 0;
+	int cpu;
+
+	switch (method) {
+	case PC_POSSIBLE:
+		for_each_possible_cpu(cpu)
+			sum += READ_ONCE(per_cpu_ptr(pc_plain, cpu)[idx]);
+		return sum;
+	case PC_ONLINE:
+		for_each_online_cpu(cpu)
+			sum += READ_ONCE(per_cpu_ptr(pc_plain, cpu)[idx]);
+		return sum;
+	case PC_PCPU_COUNTER:
+		return percpu_counter_sum(&pc_counter);
+	case PC_PCPU_STATS:
+		return pcpu_stats_read(&pc_stats, idx);
+	}
+	return 0;
+}
+
+static void pc_read_all(int method, u64 *out)
+{
+	u64 *v;
+	int cpu, i;
+
+	switch (method) {
+	case PC_POSSIBLE:
+	case PC_ONLINE:
+		memset(out, 0, nr * sizeof(*out));
+		for_each_cpu(cpu, method == PC_POSSIBLE ? cpu_possible_mask :
+						       cpu_online_mask) {
+			v = per_cpu_ptr(pc_plain, cpu);
+			for (i = 0; i < nr; i++)
+				out[i] += READ_ONCE(v[i]);
+		}
+		break;
+	case PC_PCPU_COUNTER:
+		/* one percpu_counter per count would sum nr times */
+		for (i = 0; i < nr; i++)
+			out[i] = percpu_counter_sum(&pc_counter);
+		break;
+	case PC_PCPU_STATS:
+		pcpu_stats_read_all(&pc_stats, out);
+		break;
+	}
+}
+
+static void pc_add(u64 v)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		this_cpu_add(pc_plain[i], v);
+		pcpu_stats_add(&pc_stats, i, v);
+	}
+	percpu_counter_add(&pc_counter, v);
+}
+
+static void pc_add_one(void *arg)
+{
+	pc_add(1);
+}
+
+static long pc_add_hotplug(void *arg)
+{
+	pc_add(PC_HOTPLUG_ADD);
+	return 0;
+}
+
+static void pc_snapshot(u64 *vals)
+{
+	int m;
+
+	for (m = 0; m < PC_NR_METHODS; m++)
+		vals[m] = pc_read(m, 0);
+}
+
+static void pc_hotplug(void)
+{
+	if (hotplug_cpu < 0)
+		return;
+	if (hotplug_cpu >= nr_cpu_ids || !cpu_online(hotplug_cpu)) {
+		pc_hp_err = -EINVAL;
+		return;
+	}
+
+	work_on_cpu(hotplug_cpu, pc_add_hotplug, NULL);
+	pc_snapshot(pc_hp_before);
+	pc_hp_err = remove_cpu(hotplug_cpu);
+	if (pc_hp_err)
+		return;
+	pc_snapshot(pc_hp_offline);
+	pc_hp_err = add_cpu(hotplug_cpu);
+	pc_snapshot(pc_hp_after);
+	pc_hp_ran = true;
+}
+
+static int pc_main(void *arg)
+{
+	struct bench_perf perf;
+	u64 *out, t0, sink = 0;
+	int m, i;
+
+	out = kcalloc(nr, sizeof(*out), GFP_KERNEL);
+	if (!out)
+		goto done;
+
+	/* every online CPU has something to sum */
+	on_each_cpu(pc_add_one, NULL, 1);
+
+	for (m = 0; m < PC_NR_METHODS && !kthread_should_stop(); m++) {
+		bench_perf_open(&perf);
+		bench_perf_start(&perf);
+		t0 = ktime_get_ns();
+		for (i = 0; i < loops; i++)
+			sink += pc_read(m, i % nr);
+		pc_read_ns[m] = div_u64(ktime_get_ns() - t0, loops);
+		bench_perf_stop_sum(&perf, &pc_read_perf[m], NULL);
+
+		bench_perf_open(&perf);
+		bench_perf_start(&perf);
+		t0 = ktime_get_ns();
+		for (i = 0; i < loops; i++) {
+			pc_read_all(m, out);
+			sink += out[0];
+		}
+		pc_read_all_ns[m] = div_u64(ktime_get_ns() - t0, loops);
+		bench_perf_stop_sum(&perf, &pc_read_all_perf[m], NULL);
+		cond_resched();
+	}
+	barrier_data(&sink);
+	kfree(out);
+
+	if (!kthread_should_stop())
+		pc_hotplug();
+done:
+	complete(&pc_all_done);
+	bench_park();
+	return 0;
+}
+
+static int pc_results_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	if (!completion_done(&pc_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_printf(m, "nr_cpu_ids %u possible %u online %u counters %d\n",
+		   nr_cpu_ids, num_possible_cpus(), num_online_cpus(), nr);
+	seq_printf(m, "%-16s %10s %12s\n", "method", "read_ns", "read_all_ns");
+	for (i = 0; i < PC_NR_METHODS; i++)
+		seq_printf(m, "%-16s %10llu %12llu\n", pc_names[i],
+			   pc_read_ns[i], pc_read_all_ns[i]);
+	if (perf) {
+		for (i = 0; i < PC_NR_METHODS; i++) {
+			seq_printf(m, "%-16s read    ", pc_names[i]);
+			bench_perf_show(m, &pc_read_perf[i], loops);
+			seq_printf(m, "\n%-16s read_all", pc_names[i]);
+			bench_perf_show(m, &pc_read_all_perf[i], loops);
+			seq_putc(m, '\n');
+		}
+	}
+
+	if (hotplug_cpu < 0)
+		return 0;
+	seq_printf(m, "\nhotplug cpu %d", hotplug_cpu);
+	if (pc_hp_err)
+		seq_printf(m, " error %d", pc_hp_err);
+	seq_putc(m, '\n');
+	if (!pc_hp_ran)
+		return 0;
+	seq_printf(m, "%-16s %10s %10s %10s\n", "method", "before",
+		   "offline", "after");
+	for (i = 0; i < PC_NR_METHODS; i++)
+		seq_printf(m, "%-16s %10llu %10llu %10llu %s\n", pc_names[i],
+			   pc_hp_before[i], pc_hp_offline[i], pc_hp_after[i],
+			   pc_hp_offline[i] == pc_hp_before[i] ? "ok" : "LOST");
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pc_results);
+
+static void pc_free(void)
+{
+	pcpu_stats_destroy(&pc_stats);
+	pcpu_stats_cleanup();
+	percpu_counter_destroy(&pc_counter);
+	free_percpu(pc_plain);
+}
+
+static int __init pc_init(void)
+{
+	int ret;
+
+	nr = max(nr, 1);
+	loops = max(loops, 1);
+
+	pc_plain = __alloc_percpu(nr * sizeof(u64), __alignof__(u64));
+	if (!pc_plain)
+		return -ENOMEM;
+	ret = percpu_counter_init(&pc_counter, 0, GFP_KERNEL);
+	if (ret)
+		goto err_plain;
+	ret = pcpu_stats_setup("sync/pcpubench:dead");
+	if (ret)
+		goto err_counter;
+	ret = pcpu_stats_init(&pc_stats, nr);
+	if (ret)
+		goto err_setup;
+
+	pc_task = kthread_run(pc_main, NULL, "pcpubench");
+	if (IS_ERR(pc_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		pc_free();
+		return PTR_ERR(pc_task);
+	}
+
+	pc_dir = debugfs_create_dir("pcpubench", NULL);
+	debugfs_create_file("results", 0444, pc_dir, NULL, &pc_results_fops);
+	return 0;
+
+err_setup:
+	pcpu_stats_cleanup();
+err_counter:
+	percpu_counter_destroy(&pc_counter);
+err_plain:
+	free_percpu(pc_plain);
+	return ret;
+}
+
+static void __exit pc_exit(void)
+{
+	debugfs_remove_recursive(pc_dir);
+	kthread_stop(pc_task);
+	pc_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(pc_init);
+module_exit(pc_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("hotplug aware per-CPU stats read cost");
+MODULE_LICENSE("Dual MIT/GPL");
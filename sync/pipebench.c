@@ -0,0 +1,605 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Producer/consumer pipeline benchmark
+ *
+ * mode=sem is the hand-off of kthread_sync.c: one item at a time,
+ * producer and consumer ping-pong a pair of semaphores, so every item
+ * can cost up to two wakeups and two context switches.
+ *
+ * mode=ring passes items through a lock-free SPSC ring (spsc_ring.h).
+ * The producer pushes batch items at a time and only wakes the consumer
+ * when it is actually asleep; the consumer sleeps only when the ring is
+ * empty (the producer likewise only when it is full).
+ *
+ * The consumer either sleeps as soon as the ring is empty or its
+ * semaphore is taken (wait=sleep), or polls first with
+ * adaptive_wait_event() or adaptive_down() (wait=adaptive, see
+ * adaptive_wait.h). Load is set with gap_ns, the idle time of the
+ * producer between batches (between items in sem mode); give several
+ * values to sweep load levels in one go.
+ *
+ * prod_ns / cons_ns model the per-item work (mdelay(100) in the demo).
+ * Every run reports items per second, the consumer's CPU usage, wakeups
+ * (counted in both modes only when the other side was asleep) and
+ * context switches per item, production to consumption latency and,
+ * for adaptive waits, how often polling caught the next item.
+ *
+ *   insmod pipebench.ko prod_cpu=2 cons_cpu=3 gap_ns=0,500,5000,50000
+ *   cat /sys/kernel/debug/pipebench/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/semaphore.h>
+#include <linux/wait.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+
+#include "bench.h"
+#include "spsc_ring.h"
+#include "adaptive_wait.h"
+
+#define MODNAME "[PIPEBENCH] "
+
+#define PB_MAX_GAPS	8
+/* gaps up to this long are spun, longer ones slept */
+#define PB_SPIN_GAP_NS	(20 * NSEC_PER_USEC)
+
+static char *mode = "all";
+module_param(mode, charp, 0444);
+MODULE_PARM_DESC(mode, "all, sem or ring");
+
+static char *wait = "all";
+module_param(wait, charp, 0444);
+MODULE_PARM_DESC(wait, "Consumer wait: all, sleep or adaptive");
+
+static int batch = 32;
+module_param(batch, int, 0444);
+MODULE_PARM_DESC(batch, "Items moved per ring push/pop");
+
+static int ring_size = 1024;
+module_param(ring_size, int, 0444);
+MODULE_PARM_DESC(ring_size, "Ring slots (rounded up to a power of two)");
+
+static int prod_ns;
+module_param(prod_ns, int, 0444);
+MODULE_PARM_DESC(prod_ns, "Work to generate one item in ns");
+
+static int cons_ns;
+module_param(cons_ns, int, 0444);
+MODULE_PARM_DESC(cons_ns, "Work to consume one item in ns");
+
+static int gap_ns[PB_MAX_GAPS];
+static int nr_gaps = 1;
+module_param_array(gap_ns, int, &nr_gaps, 0444);
+MODULE_PARM_DESC(gap_ns, "Producer idle time between batches in ns, one run per value");
+
+static int max_spin_ns = 20000;
+module_param(max_spin_ns, int, 0444);
+MODULE_PARM_DESC(max_spin_ns, "Upper bound for adaptive polling in ns");
+
+static int prod_cpu = -1;
+module_param(prod_cpu, int, 0444);
+MODULE_PARM_DESC(prod_cpu, "CPU to pin the producer to (-1 = use placement=)");
+
+static int cons_cpu = -1;
+module_param(cons_cpu, int, 0444);
+MODULE_PARM_DESC(cons_cpu, "CPU to pin the consumer to (-1 = use placement=)");
+
+static int duration_ms = 2000;
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Run length per mode in ms");
+
+enum {
+	PB_SEM,
+	PB_RING,
+	PB_NR_MODES,
+};
+
+static const char * const pb_mode_names[PB_NR_MODES] = {
+	[PB_SEM]	= "sem",
+	[PB_RING]	= "ring",
+};
+
+enum {
+	PB_SLEEP,
+	PB_ADAPTIVE,
+	PB_NR_WAITS,
+};
+
+static const char * const pb_wait_names[PB_NR_WAITS] = {
+	[PB_SLEEP]	= "sleep",
+	[PB_ADAPTIVE]	= "adaptive",
+};
+
+/* per-thread accounting */
+struct pb_side {
+	struct task_struct *task;
+	u64 items;
+	u64 sleeps;	/* times this side had to block */
+	u64 wakeups;	/* wakeups of a sleeping other side */
+	u64 ctxsw;
+	u64 runtime;	/* CPU time in ns */
+} ____cacheline_aligned_in_smp;
+
+struct pb_result {
+	bool ran;
+	int mode;
+	int wait;
+	int gap;
+	u64 ns;
+	u64 out_of_order;
+	struct pb_side prod;
+	struct pb_side cons;
+	struct adaptive_wait aw;
+	struct bench_hist lat;
+	struct bench_perf_sum perf;	/* producer and consumer */
+};
+
+static struct pb_result *pb_results;
+static int pb_nr_results;
+static struct pb_result *pb_cur;
+static int pb_gap;
+static struct pb_side pb_prod, pb_cons;
+static struct bench_ctl pb_ctl;
+static struct task_struct *pb_task;
+static DECLARE_COMPLETION(pb_all_done);
+static struct dentry *pb_dir;
+
+/* mode=sem: single item slot handed over with two semaphores */
+static struct semaphore pb_psem, pb_csem;
+static int pb_psleeping, pb_csleeping;	/* a side is blocked in down() */
+static unsigned long pb_slot;
+
+/* mode=ring */
+static struct spsc_ring pb_ring;
+static void **pb_pbuf, **pb_cbuf;
+static DECLARE_WAIT_QUEUE_HEAD(pb_prod_wq);
+static DECLARE_WAIT_QUEUE_HEAD(pb_cons_wq);
+static int pb_prod_done;
+
+static void pb_idle(int ns)
+{
+	if (ns <= 0)
+		return;
+	if (ns <= PB_SPIN_GAP_NS)
+		ndelay(ns);
+	else
+		usleep_range(ns / NSEC_PER_USEC, ns / NSEC_PER_USEC + 1);
+}
+
+/* items are their production timestamps, so order and latency checks are free */
+static void pb_consumed(unsigned long item, unsigned long now,
+			unsigned long *last)
+{
+	if (item < *last)
+		pb_cur->out_of_order++;
+	*last = item;
+	bench_hist_add(&pb_cur->lat, now - item);
+	bench_spin_ns(cons_ns);
+}
+
+static void pb_down(struct semaphore *sem, int *sleeping, struct pb_side *s)
+{
+	if (down_trylock(sem)) {
+		s->sleeps++;
+		smp_store_mb(*sleeping, 1);
+		down(sem);
+		WRITE_ONCE(*sleeping, 0);
+	}
+}
+
+/*
+ * Count a wakeup only if the other side sleeps on the semaphore, as ring
+ * mode does with wq_has_sleeper(). The waiter flags itself just before
+ * down(): one that flags after the check is missed, like with
+ * wq_has_sleeper(), and one that flagged but has not blocked yet is
+ * counted anyway.
+ */
+static void pb_up(struct semaphore *sem, int *sleeping, struct pb_side *s)
+{
+	bool sleeper = READ_ONCE(*sleeping);
+
+	up(sem);
+	if (sleeper)
+		s->wakeups++;
+}
+
+static void pb_side_begin(u64 *cs, u64 *rt)
+{
+	*cs = bench_ctxsw();
+	*rt = bench_runtime_ns();
+}
+
+static void pb_side_end(struct pb_side *s, u64 cs, u64 rt)
+{
+	s->ctxsw = bench_ctxsw() - cs;
+	s->runtime = bench_runtime_ns() - rt;
+}
+
+/*
+ * The semaphores always hold exactly one token between them, so whichever
+ * side notices the end of the run first has just handed the token over
+ * and the other side can finish its item and notice too.
+ */
+static int pb_sem_prod(void *arg)
+{
+	struct pb_side *s = &pb_prod;
+	struct bench_perf perf;
+	u64 cs, rt;
+
+	bench_perf_open(&perf);
+	bench_gate(&pb_ctl);
+	bench_perf_start(&perf);
+	pb_side_begin(&cs, &rt);
+	while (bench_running(&pb_ctl)) {
+		pb_idle(pb_gap);
+		pb_down(&pb_psem, &pb_psleeping, s);
+		bench_spin_ns(prod_ns);
+		pb_slot = ktime_get_ns();
+		s->items++;
+		pb_up(&pb_csem, &pb_csleeping, s);
+	}
+	pb_side_end(s, cs, rt);
+	bench_perf_stop(&perf, &pb_ctl);
+	bench_done(&pb_ctl);
+	return 0;
+}
+
+static int pb_sem_cons(void *arg)
+{
+	struct pb_side *s = &pb_cons;
+	unsigned long last = 0;
+	struct bench_perf perf;
+	u64 cs, rt;
+
+	bench_perf_open(&perf);
+	bench_gate(&pb_ctl);
+	bench_perf_start(&perf);
+	pb_side_begin(&cs, &rt);
+	while (bench_running(&pb_ctl)) {
+		if (pb_cur->wait == PB_ADAPTIVE)
+			adaptive_down_mark(&pb_cur->aw, &pb_csem,
+					   &pb_csleeping);
+		else
+			pb_down(&pb_csem, &pb_csleeping, s);
+		pb_consumed(pb_slot, ktime_get_ns(), &last);
+		s->items++;
+		pb_up(&pb_psem, &pb_psleeping, s);
+	}
+	if (pb_cur->wait == PB_ADAPTIVE)
+		s->sleeps = pb_cur->aw.sleeps;
+	pb_side_end(s, cs, rt);
+	bench_perf_stop(&perf, &pb_ctl);
+	bench_done(&pb_ctl);
+	return 0;
+}
+
+static int pb_ring_prod(void *arg)
+{
+	struct pb_side *s = &pb_prod;
+	unsigned int i, n, sent;
+	struct bench_perf perf;
+	u64 cs, rt;
+
+	bench_perf_open(&perf);
+	bench_gate(&pb_ctl);
+	bench_perf_start(&perf);
+	pb_side_begin(&cs, &rt);
+	while (bench_running(&pb_ctl)) {
+		pb_idle(pb_gap);
+		for (i = 0; i < batch; i++) {
+			bench_spin_ns(prod_ns);
+			pb_pbuf[i] = (void *)(unsigned long)ktime_get_ns();
+		}
+		for (sent = 0; sent < batch; sent += n) {
+			n = spsc_ring_push(&pb_ring, pb_pbuf + sent, batch - sent);
+			if (n) {
+				if (wq_has_sleeper(&pb_cons_wq)) {
+					wake_up_interruptible(&pb_cons_wq);
+					s->wakeups++;
+				}
+				continue;
+			}
+			s->sleeps++;
+			wait_event_interruptible(pb_prod_wq,
+						 !spsc_ring_full(&pb_ring));
+		}
+		s->items += batch;
+		cond_resched();
+	}
+	pb_side_end(s, cs, rt);
+	bench_perf_stop(&perf, &pb_ctl);
+
+	smp_store_release(&pb_prod_done, 1);
+	wake_up_interruptible(&pb_cons_wq);
+	bench_done(&pb_ctl);
+	return 0;
+}
+
+static bool pb_ring_ready(void)
+{
+	return !spsc_ring_empty(&pb_ring) || READ_ONCE(pb_prod_done);
+}
+
+/* runs until the producer is done and the ring is drained */
+static int pb_ring_cons(void *arg)
+{
+	struct pb_side *s = &pb_cons;
+	unsigned long last = 0, now;
+	unsigned int i, n;
+	struct bench_perf perf;
+	u64 cs, rt;
+
+	bench_perf_open(&perf);
+	bench_gate(&pb_ctl);
+	bench_perf_start(&perf);
+	pb_side_begin(&cs, &rt);
+	for (;;) {
+		n = spsc_ring_pop(&pb_ring, pb_cbuf, batch);
+		if (n) {
+			if (wq_has_sleeper(&pb_prod_wq)) {
+				wake_up_interruptible(&pb_prod_wq);
+				s->wakeups++;
+			}
+			now = ktime_get_ns();
+			for (i = 0; i < n; i++)
+				pb_consumed((unsigned long)pb_cbuf[i], now, &last);
+			s->items += n;
+			cond_resched();
+			continue;
+		}
+		if (smp_load_acquire(&pb_prod_done)) {
+			if (spsc_ring_empty(&pb_ring))
+				break;
+			continue;
+		}
+		if (pb_cur->wait == PB_ADAPTIVE) {
+			adaptive_wait_event(&pb_cur->aw, pb_cons_wq,
+					    pb_ring_ready());
+		} else {
+			s->sleeps++;
+			wait_event_interruptible(pb_cons_wq, pb_ring_ready());
+		}
+	}
+	if (pb_cur->wait == PB_ADAPTIVE)
+		s->sleeps = pb_cur->aw.sleeps;
+	pb_side_end(s, cs, rt);
+	bench_perf_stop(&perf, &pb_ctl);
+	bench_done(&pb_ctl);
+	return 0;
+}
+
+/* explicit prod_cpu/cons_cpu win over placement=, slot 0 produces */
+static struct task_struct *pb_start(int (*fn)(void *), const char *name,
+				    int cpu, int slot)
+{
+	if (cpu >= 0 && cpu < nr_cpu_ids && cpu_online(cpu))
+		return bench_kthread_run_on_cpu(fn, NULL, name, 0, cpu);
+	return bench_kthread_place(fn, NULL, name, 0, slot);
+}
+
+static int pb_run(struct pb_result *r)
+{
+	int ret;
+
+	pb_cur = r;
+	pb_gap = gap_ns[r->gap];
+	bench_hist_init(&r->lat);
+	adaptive_wait_init(&r->aw, max_spin_ns);
+	memset(&pb_prod, 0, sizeof(pb_prod));
+	memset(&pb_cons, 0, sizeof(pb_cons));
+	pb_prod_done = 0;
+	pb_slot = 0;
+	sema_init(&pb_psem, 1);
+	sema_init(&pb_csem, 0);
+	if (r->mode == PB_RING) {
+		ret = spsc_ring_init(&pb_ring, ring_size);
+		if (ret)
+			return ret;
+	}
+
+	bench_ctl_init(&pb_ctl, 2, duration_ms);
+	pb_prod.task = pb_start(r->mode == PB_SEM ? pb_sem_prod : pb_ring_prod,
+				"pipebench-prod", prod_cpu, 0);
+	if (IS_ERR(pb_prod.task)) {
+		ret = PTR_ERR(pb_prod.task);
+		goto out;
+	}
+	pb_cons.task = pb_start(r->mode == PB_SEM ? pb_sem_cons : pb_ring_cons,
+				"pipebench-cons", cons_cpu, 1);
+	if (IS_ERR(pb_cons.task)) {
+		ret = PTR_ERR(pb_cons.task);
+		kthread_stop(pb_prod.task);
+		goto out;
+	}
+
+	wait_for_completion(&pb_ctl.finished);
+	kthread_stop(pb_prod.task);
+	kthread_stop(pb_cons.task);
+
+	r->ns = bench_elapsed_ns(&pb_ctl);
+	r->prod = pb_prod;
+	r->cons = pb_cons;
+	r->perf = pb_ctl.perf;
+	r->ran = true;
+	ret = 0;
+out:
+	if (ret)
+		pr_err("%s: unable to start kernel thread\n", __func__);
+	bench_ctl_cleanup(&pb_ctl);
+	if (r->mode == PB_RING)
+		spsc_ring_free(&pb_ring);
+	return ret;
+}
+
+static bool pb_selected(const char *param, const char *name)
+{
+	return !strcmp(param, "all") || !strcmp(param, name);
+}
+
+static int pb_main(void *arg)
+{
+	struct pb_result *r;
+	int m, w, g;
+
+	for (m = 0; m < PB_NR_MODES; m++) {
+		if (!pb_selected(mode, pb_mode_names[m]))
+			continue;
+		for (w = 0; w < PB_NR_WAITS; w++) {
+			if (!pb_selected(wait, pb_wait_names[w]))
+				continue;
+			for (g = 0; g < nr_gaps; g++) {
+				r = &pb_results[pb_nr_results];
+				r->mode = m;
+				r->wait = w;
+				r->gap = g;
+				if (kthread_should_stop() || pb_run(r))
+					goto out;
+				pb_nr_results++;
+			}
+		}
+	}
+out:
+	complete(&pb_all_done);
+	bench_park();
+	return 0;
+}
+
+static int pb_results_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	if (!completion_done(&pb_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_printf(m, "batch %d ring_size %d prod_ns %d cons_ns %d max_spin_ns %d\n",
+		   batch, ring_size, prod_ns, cons_ns, max_spin_ns);
+	bench_placement_show(m);
+	seq_printf(m, "%-5s %-8s %8s %11s %9s %12s %12s %12s %10s %10s %9s %s\n",
+		   "mode", "wait", "gap_ns", "items/s", "cons_cpu%",
+		   "sleeps/item", "wakeups/item", "ctxsw/item", "lat_p50",
+		   "lat_p99", "spin_hit%", "order");
+	for (i = 0; i < pb_nr_results; i++) {
+		struct pb_result *r = &pb_results[i];
+		u64 items = r->cons.items;
+		u64 cpu = bench_milli(r->cons.runtime * 100, r->ns);
+		u64 sl = bench_milli(r->prod.sleeps + r->cons.sleeps, items);
+		u64 wk = bench_milli(r->prod.wakeups + r->cons.wakeups, items);
+		u64 sw = bench_milli(r->prod.ctxsw + r->cons.ctxsw, items);
+		u64 hit = bench_milli(r->aw.spin_hits * 100, r->aw.waits);
+
+		seq_printf(m, "%-5s %-8s %8d %11llu " BENCH_MILLI_FMTW(5)
+			   " " BENCH_MILLI_FMTW(8) " " BENCH_MILLI_FMTW(8)
+			   " " BENCH_MILLI_FMTW(8) " %10llu %10llu " BENCH_MILLI_FMTW(5)
+			   " %s",
+			   pb_mode_names[r->mode], pb_wait_names[r->wait],
+			   gap_ns[r->gap], bench_rate(items, r->ns),
+			   BENCH_MILLI_ARG(cpu), BENCH_MILLI_ARG(sl),
+			   BENCH_MILLI_ARG(wk), BENCH_MILLI_ARG(sw),
+			   bench_hist_pct(&r->lat, 500),
+			   bench_hist_pct(&r->lat, 990), BENCH_MILLI_ARG(hit),
+			   r->out_of_order ? "BROKEN" : "ok");
+		bench_perf_show(m, &r->perf, items);
+		seq_putc(m, '\n');
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pb_results);
+
+static int __init pb_init(void)
+{
+	int ret;
+
+	if (batch <= 0)
+		batch = 1;
+	if (ring_size < batch)
+		ring_size = batch;
+	if (max_spin_ns < 0)
+		max_spin_ns = 0;
+	if (nr_gaps <= 0)
+		nr_gaps = 1;
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+
+	pb_results = vzalloc(array3_size(PB_NR_MODES, PB_NR_WAITS,
+					 PB_MAX_GAPS * sizeof(*pb_results)));
+	pb_pbuf = kcalloc(batch, sizeof(*pb_pbuf), GFP_KERNEL);
+	pb_cbuf = kcalloc(batch, sizeof(*pb_cbuf), GFP_KERNEL);
+	if (!pb_results || !pb_pbuf || !pb_cbuf)
+		goto nomem;
+
+	pb_task = kthread_run(pb_main, NULL, "pipebench");
+	if (IS_ERR(pb_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		vfree(pb_results);
+		kfree(pb_pbuf);
+		kfree(pb_cbuf);
+		bench_placement_free();
+		return PTR_ERR(pb_task);
+	}
+
+	pb_dir = debugfs_create_dir("pipebench", NULL);
+	debugfs_create_file("results", 0444, pb_dir, NULL, &pb_results_fops);
+	return 0;
+nomem:
+	vfree(pb_results);
+	kfree(pb_pbuf);
+	kfree(pb_cbuf);
+	bench_placement_free();
+	return -ENOMEM;
+}
+
+static void __exit pb_exit(void)
+{
+	debugfs_remove_recursive(pb_dir);
+	kthread_stop(pb_task);
+	vfree(pb_results);
+	kfree(pb_pbuf);
+	kfree(pb_cbuf);
+	bench_placement_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(pb_init);
+module_exit(pb_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("producer/consumer pipeline: semaphores vs SPSC ring");
+MODULE_LICENSE("Dual MIT/GPL");
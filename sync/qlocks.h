@@ -0,0 +1,234 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Alternative spinlock algorithms, for comparison with the kernel's own.
+ *
+ *   ticket_spin	take a number, wait until it is served: FIFO, but
+ *			every waiter spins on the same word
+ *   mcs_spin		waiters queue and each spins on its own node; the
+ *			node lives on the locker's stack for the hold
+ *   clh_spin		waiters spin on their predecessor's node and take
+ *			it over on unlock, so each thread keeps a handle
+ *			whose storage outlives its use of the lock
+ *   rbias_rwlock	reader-biased rwlock: readers get in whenever no
+ *			writer holds it, so writers can starve
+ *
+ * spin_lock() is a qspinlock, itself MCS based, which keeps the fast
+ * path to one word. Like spin_lock(), all of these disable preemption
+ * while held and must not be held across a sleep. There is no lockdep
+ * coverage.
+ *
+ * Usage:
+ *	struct mcs_node node;
+ *
+ *	mcs_spin_lock(&lock, &node);	...	mcs_spin_unlock(&lock, &node);
+ *
+ *	clh_handle_init(&h);		(once per thread)
+ *	clh_spin_lock(&lock, &h);	...	clh_spin_unlock(&h);
+ */
+#ifndef _SYNC_QLOCKS_H
+#define _SYNC_QLOCKS_H
+
+#include <linux/kernel.h>
+#include <linux/atomic.h>
+#include <linux/preempt.h>
+#include <asm/barrier.h>
+#include <asm/processor.h>
+
+/* ticket */
+
+struct ticket_spin {
+	atomic_t next;
+	int owner;
+};
+
+static inline void ticket_spin_init(struct ticket_spin *l)
+{
+	atomic_set(&l->next, 0);
+	l->owner = 0;
+}
+
+static inline void ticket_spin_lock(struct ticket_spin *l)
+{
+	int t;
+
+	preempt_disable();
+	t = atomic_fetch_inc(&l->next);
+	smp_cond_load_acquire(&l->owner, VAL == t);
+}
+
+static inline void ticket_spin_unlock(struct ticket_spin *l)
+{
+	/* only the holder writes owner */
+	smp_store_release(&l->owner, l->owner + 1);
+	preempt_enable();
+}
+
+/* MCS */
+
+struct mcs_node {
+	struct mcs_node *next;
+	int locked;
+};
+
+struct mcs_spin {
+	struct mcs_node *tail;
+};
+
+static inline void mcs_spin_init(struct mcs_spin *l)
+{
+	l->tail = NULL;
+}
+
+static inline void mcs_spin_lock(struct mcs_spin *l, struct mcs_node *node)
+{
+	struct mcs_node *prev;
+
+	node->next = NULL;
+	node->locked = 0;
+	preempt_disable();
+	prev = xchg(&l->tail, node);
+	if (!prev)
+		return;
+	WRITE_ONCE(prev->next, node);
+	smp_cond_load_acquire(&node->locked, VAL);
+}
+
+static inline void mcs_spin_unlock(struct mcs_spin *l, struct mcs_node *node)
+{
+	struct mcs_node *next = READ_ONCE(node->next);
+
+	if (!next) {
+		if (cmpxchg_release(&l->tail, node, NULL) == node)
+			goto out;
+		/* a locker swapped the tail but has not linked in yet */
+		while (!(next = READ_ONCE(node->next)))
+			cpu_relax();
+	}
+	smp_store_release(&next->locked, 1);
+out:
+	preempt_enable();
+}
+
+/* CLH */
+
+struct clh_node {
+	int locked;
+};
+
+struct clh_spin {
+	struct clh_node *tail;
+	struct clh_node dummy;
+};
+
+struct clh_handle {
+	struct clh_node node;
+	struct clh_node *mine;
+	struct clh_node *pred;
+};
+
+static inline void clh_spin_init(struct clh_spin *l)
+{
+	l->dummy.locked = 0;
+	l->tail = &l->dummy;
+}
+
+static inline void clh_handle_init(struct clh_handle *h)
+{
+	h->mine = &h->node;
+	h->pred = NULL;
+}
+
+static inline void clh_spin_lock(struct clh_spin *l, struct clh_handle *h)
+{
+	WRITE_ONCE(h->mine->locked, 1);
+	preempt_disable();
+	h->pred = xchg(&l->tail, h->mine);
+	smp_cond_load_acquire(&h->pred->locked, !VAL);
+}
+
+static inline void clh_spin_unlock(struct clh_handle *h)
+{
+	struct clh_node *n = h->mine;
+
+	/* the predecessor's node is free now, ours goes to our successor */
+	h->mine = h->pred;
+	smp_store_release(&n->locked, 0);
+	preempt_enable();
+}
+
+/* reader-biased rwlock: bit 0 is the writer, readers count in twos */
+
+#define RBIAS_WRITER	1
+#define RBIAS_READER	2
+
+struct rbias_rwlock {
+	atomic_t cnt;
+};
+
+static inline void rbias_init(struct rbias_rwlock *l)
+{
+	atomic_set(&l->cnt, 0);
+}
+
+static inline void rbias_read_lock(struct rbias_rwlock *l)
+{
+	preempt_disable();
+	while (atomic_fetch_add_acquire(RBIAS_READER, &l->cnt) &
+	       RBIAS_WRITER) {
+		atomic_sub(RBIAS_READER, &l->cnt);
+		while (atomic_read(&l->cnt) & RBIAS_WRITER)
+			cpu_relax();
+	}
+}
+
+static inline void rbias_read_unlock(struct rbias_rwlock *l)
+{
+	atomic_sub_return_release(RBIAS_READER, &l->cnt);
+	preempt_enable();
+}
+
+static inline void rbias_write_lock(struct rbias_rwlock *l)
+{
+	preempt_disable();
+	for (;;) {
+		while (atomic_read(&l->cnt))
+			cpu_relax();
+		if (atomic_cmpxchg_acquire(&l->cnt, 0, RBIAS_WRITER) == 0)
+			return;
+	}
+}
+
+static inline void rbias_write_unlock(struct rbias_rwlock *l)
+{
+	atomic_fetch_sub_release(RBIAS_WRITER, &l->cnt);
+	preempt_enable();
+}
+
+#endif /* _SYNC_QLOCKS_H */
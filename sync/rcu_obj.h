@@ -0,0 +1,151 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * RCU-published objects.
+ *
+ * kthread_rwspin.c and kthread_rwsem.c make every reader of counter
+ * write the lock word, and list_rcu.c uses RCU only for list nodes.
+ * RCU_OBJ(type) publishes a whole value of any type, a configuration
+ * block say, through one RCU pointer: readers follow the pointer and
+ * never write shared memory; a writer copies the current object,
+ * changes the copy, publishes it with rcu_assign_pointer() and frees
+ * the old one with kfree_rcu() once every reader that may still see it
+ * is gone. Writers serialise on a mutex and allocate, so they sleep.
+ *
+ * Readers see either the old or the new object, never a mix, but two
+ * reads need not return the same one unless they sit in one
+ * rcu_read_lock() section.
+ *
+ * Usage:
+ *	static RCU_OBJ(struct { int a; int b; }) cfg;
+ *	typeof(cfg.ptr->data) v = { 10, 20 };
+ *	typeof(*cfg.ptr) *new;
+ *
+ *	rcu_obj_init(&cfg, &v);
+ *	rcu_obj_read(&cfg, &v);		(copy out)
+ *
+ *	rcu_read_lock();
+ *	x = rcu_obj_deref(&cfg)->a;	(read in place)
+ *	rcu_read_unlock();
+ *
+ *	new = rcu_obj_copy(&cfg);	(copy-update)
+ *	if (new) {
+ *		new->data.a++;
+ *		rcu_obj_publish(&cfg, new);
+ *	}
+ *
+ *	rcu_obj_free(&cfg);		(no readers or writers left)
+ */
+#ifndef _SYNC_RCU_OBJ_H
+#define _SYNC_RCU_OBJ_H
+
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+
+#define RCU_OBJ(type)						\
+	struct {						\
+		struct mutex lock;				\
+		struct {					\
+			type data;				\
+			struct rcu_head rcu;			\
+		} __rcu *ptr;					\
+	}
+
+/* publish a first copy of *src; 0 or -ENOMEM */
+#define rcu_obj_init(o, src)					\
+({								\
+	typeof(*(o)->ptr) *__new;				\
+								\
+	mutex_init(&(o)->lock);					\
+	__new = kmalloc(sizeof(*__new), GFP_KERNEL);		\
+	if (__new)						\
+		__new->data = *(src);				\
+	RCU_INIT_POINTER((o)->ptr, __new);			\
+	__new ? 0 : -ENOMEM;					\
+})
+
+/* the current value, inside rcu_read_lock() */
+#define rcu_obj_deref(o)					\
+	(&rcu_dereference((o)->ptr)->data)
+
+#define rcu_obj_read(o, dst)					\
+	do {							\
+		rcu_read_lock();				\
+		*(dst) = *rcu_obj_deref(o);			\
+		rcu_read_unlock();				\
+	} while (0)
+
+/*
+ * Take the writer lock and return a private copy of the current object,
+ * or NULL, without the lock, if it cannot be allocated. Finish with
+ * rcu_obj_publish().
+ */
+#define rcu_obj_copy(o)						\
+({								\
+	typeof(*(o)->ptr) *__new;				\
+								\
+	__new = kmalloc(sizeof(*__new), GFP_KERNEL);		\
+	if (__new) {						\
+		mutex_lock(&(o)->lock);				\
+		__new->data = rcu_dereference_protected((o)->ptr, \
+				lockdep_is_held(&(o)->lock))->data; \
+	}							\
+	__new;							\
+})
+
+#define rcu_obj_publish(o, new)					\
+	do {							\
+		typeof(*(o)->ptr) *__old;			\
+								\
+		__old = rcu_dereference_protected((o)->ptr,	\
+				lockdep_is_held(&(o)->lock));	\
+		rcu_assign_pointer((o)->ptr, new);		\
+		mutex_unlock(&(o)->lock);			\
+		kfree_rcu(__old, rcu);				\
+	} while (0)
+
+/* replace the value with *src; 0 or -ENOMEM */
+#define rcu_obj_write(o, src)					\
+({								\
+	typeof(*(o)->ptr) *__w = rcu_obj_copy(o);		\
+								\
+	if (__w) {						\
+		__w->data = *(src);				\
+		rcu_obj_publish(o, __w);			\
+	}							\
+	__w ? 0 : -ENOMEM;					\
+})
+
+/* once readers and writers are gone; old copies go through kfree_rcu() */
+#define rcu_obj_free(o)						\
+	kfree(rcu_dereference_protected((o)->ptr, 1))
+
+#endif /* _SYNC_RCU_OBJ_H */
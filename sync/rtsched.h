@@ -0,0 +1,150 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Scheduling class for the threads of a module, chosen at insmod:
+ *
+ *   sched=normal	SCHED_NORMAL, nice 0 (default)
+ *   sched=fifo		SCHED_FIFO at sched_set_fifo()'s priority
+ *   sched=fifo_low	SCHED_FIFO at the lowest RT priority, above every
+ *			SCHED_NORMAL thread but below other RT work
+ *   sched=deadline	SCHED_DEADLINE with dl_runtime_us of CPU time
+ *			every dl_period_us, due within dl_deadline_us
+ *
+ * The kernel refuses SCHED_DEADLINE for threads bound to fewer CPUs than
+ * their root domain, so deadline threads must not be pinned. Deadline
+ * admission control may also refuse the bandwidth (-EBUSY).
+ *
+ * Usage:
+ *	rtsched_init();			(module init, checks the params)
+ *	t = kthread_run(...);
+ *	rtsched_apply(t);
+ */
+#ifndef _SYNC_RTSCHED_H
+#define _SYNC_RTSCHED_H
+
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/sched/types.h>
+#include <linux/string.h>
+#include <linux/moduleparam.h>
+
+static char *sched = "normal";
+module_param(sched, charp, 0444);
+MODULE_PARM_DESC(sched, "Thread scheduling: normal, fifo, fifo_low or deadline");
+
+static unsigned int dl_runtime_us = 100;
+module_param(dl_runtime_us, uint, 0444);
+MODULE_PARM_DESC(dl_runtime_us, "SCHED_DEADLINE runtime per period in us");
+
+static unsigned int dl_deadline_us = 1000;
+module_param(dl_deadline_us, uint, 0444);
+MODULE_PARM_DESC(dl_deadline_us, "SCHED_DEADLINE relative deadline in us");
+
+static unsigned int dl_period_us = 1000;
+module_param(dl_period_us, uint, 0444);
+MODULE_PARM_DESC(dl_period_us, "SCHED_DEADLINE period in us");
+
+enum rtsched_policy {
+	RTSCHED_NORMAL,
+	RTSCHED_FIFO,
+	RTSCHED_FIFO_LOW,
+	RTSCHED_DEADLINE,
+	RTSCHED_NR,
+};
+
+static const char * const rtsched_names[RTSCHED_NR] = {
+	[RTSCHED_NORMAL]	= "normal",
+	[RTSCHED_FIFO]		= "fifo",
+	[RTSCHED_FIFO_LOW]	= "fifo_low",
+	[RTSCHED_DEADLINE]	= "deadline",
+};
+
+static enum rtsched_policy rtsched_policy;
+
+static inline int rtsched_init(void)
+{
+	int i;
+
+	for (i = 0; i < RTSCHED_NR; i++)
+		if (!strcmp(sched, rtsched_names[i]))
+			break;
+	if (i == RTSCHED_NR) {
+		pr_err("%s: unknown sched '%s'\n", __func__, sched);
+		return -EINVAL;
+	}
+	rtsched_policy = i;
+	if (i == RTSCHED_DEADLINE &&
+	    !(dl_runtime_us <= dl_deadline_us && dl_deadline_us <= dl_period_us &&
+	      dl_runtime_us)) {
+		pr_err("%s: need 0 < dl_runtime_us <= dl_deadline_us <= dl_period_us\n",
+		       __func__);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* put @t into @policy */
+static inline int rtsched_set(struct task_struct *t,
+			      enum rtsched_policy policy)
+{
+	struct sched_attr attr = {
+		.size		= sizeof(attr),
+		.sched_policy	= SCHED_DEADLINE,
+		.sched_runtime	= (u64)dl_runtime_us * NSEC_PER_USEC,
+		.sched_deadline	= (u64)dl_deadline_us * NSEC_PER_USEC,
+		.sched_period	= (u64)dl_period_us * NSEC_PER_USEC,
+	};
+
+	switch (policy) {
+	case RTSCHED_FIFO:
+		sched_set_fifo(t);
+		return 0;
+	case RTSCHED_FIFO_LOW:
+		sched_set_fifo_low(t);
+		return 0;
+	case RTSCHED_DEADLINE:
+		return sched_setattr_nocheck(t, &attr);
+	default:
+		sched_set_normal(t, 0);
+		return 0;
+	}
+}
+
+/* put @t into the class given by sched= */
+static inline int rtsched_apply(struct task_struct *t)
+{
+	int ret = rtsched_set(t, rtsched_policy);
+
+	if (ret)
+		pr_err("%s: cannot make %s %s: %d\n", __func__, t->comm,
+		       rtsched_names[rtsched_policy], ret);
+	return ret;
+}
+
+#endif /* _SYNC_RTSCHED_H */
@@ -0,0 +1,417 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Reader/writer fairness benchmark
+ *
+ * kthread_rwspin.c runs three readers against one rwlock writer and
+ * kthread_rwsem.c shows down_write() + downgrade_write(); neither says
+ * whether the writer gets in when readers pile up. Here nreaders
+ * threads read in a tight loop while nwriters threads come back every
+ * write_gap_us, for rwlock_t, rw_semaphore and percpu_rw_semaphore.
+ *
+ * Reported per primitive: reader throughput and spread across readers,
+ * writer acquire latency percentiles (the starvation view), and for
+ * rw_semaphore what handing a write hold over to a read hold costs:
+ * downgrade_write() against up_write() + down_read(). Writers alternate
+ * between the two.
+ *
+ *   insmod rwfair.ko nreaders=64 write_gap_us=500
+ *   cat /sys/kernel/debug/rwfair/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/spinlock.h>
+#include <linux/rwsem.h>
+#include <linux/percpu-rwsem.h>
+
+#include "bench.h"
+
+#define MODNAME "[RWFAIR] "
+
+static char *prim = "all";
+module_param(prim, charp, 0444);
+MODULE_PARM_DESC(prim, "all, rwlock, rwsem or percpu_rwsem");
+
+static int nreaders;
+module_param(nreaders, int, 0444);
+MODULE_PARM_DESC(nreaders, "Reader threads (0 = one per online CPU)");
+
+static int nwriters = 1;
+module_param(nwriters, int, 0444);
+MODULE_PARM_DESC(nwriters, "Writer threads");
+
+static int read_cs_ns = 200;
+module_param(read_cs_ns, int, 0444);
+MODULE_PARM_DESC(read_cs_ns, "Read section length in ns");
+
+static int write_cs_ns = 200;
+module_param(write_cs_ns, int, 0444);
+MODULE_PARM_DESC(write_cs_ns, "Write section length in ns");
+
+static int write_gap_us = 1000;
+module_param(write_gap_us, int, 0444);
+MODULE_PARM_DESC(write_gap_us, "Time a writer sleeps between writes in us");
+
+static int duration_ms = 5000;
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Run length per primitive in ms");
+
+static unsigned long rf_data;
+
+static DEFINE_RWLOCK(rf_rwlock);
+static DECLARE_RWSEM(rf_rwsem);
+static struct percpu_rw_semaphore rf_pcpu_rwsem;
+
+static void rwlock_rlock(void)		{ read_lock(&rf_rwlock); }
+static void rwlock_runlock(void)	{ read_unlock(&rf_rwlock); }
+static void rwlock_wlock(void)		{ write_lock(&rf_rwlock); }
+static void rwlock_wunlock(void)	{ write_unlock(&rf_rwlock); }
+
+static void rwsem_rlock(void)		{ down_read(&rf_rwsem); }
+static void rwsem_runlock(void)		{ up_read(&rf_rwsem); }
+static void rwsem_wlock(void)		{ down_write(&rf_rwsem); }
+static void rwsem_wunlock(void)		{ up_write(&rf_rwsem); }
+static void rwsem_downgrade(void)	{ downgrade_write(&rf_rwsem); }
+
+static void pcpu_rlock(void)		{ percpu_down_read(&rf_pcpu_rwsem); }
+static void pcpu_runlock(void)		{ percpu_up_read(&rf_pcpu_rwsem); }
+static void pcpu_wlock(void)		{ percpu_down_write(&rf_pcpu_rwsem); }
+static void pcpu_wunlock(void)		{ percpu_up_write(&rf_pcpu_rwsem); }
+
+struct rf_ops {
+	const char *name;
+	void (*read_lock)(void);
+	void (*read_unlock)(void);
+	void (*write_lock)(void);
+	void (*write_unlock)(void);
+	void (*downgrade)(void);	/* NULL: no downgrade_write() */
+};
+
+static const struct rf_ops rf_ops_table[] = {
+	{ "rwlock", rwlock_rlock, rwlock_runlock, rwlock_wlock,
+	  rwlock_wunlock, NULL },
+	{ "rwsem", rwsem_rlock, rwsem_runlock, rwsem_wlock,
+	  rwsem_wunlock, rwsem_downgrade },
+	{ "percpu_rwsem", pcpu_rlock, pcpu_runlock, pcpu_wlock,
+	  pcpu_wunlock, NULL },
+};
+
+struct rf_reader {
+	struct task_struct *task;
+	u64 reads;
+} ____cacheline_aligned_in_smp;
+
+struct rf_writer {
+	struct task_struct *task;
+	u64 writes;
+	struct bench_hist acq;		/* write lock acquire latency */
+	struct bench_hist downgrade;	/* downgrade_write() */
+	struct bench_hist relock;	/* up_write() + down_read() */
+} ____cacheline_aligned_in_smp;
+
+struct rf_result {
+	bool ran;
+	u64 ns;
+	u64 reads;
+	u64 min_reads;
+	u64 max_reads;
+	u64 writes;
+	struct bench_hist acq;
+	struct bench_hist downgrade;
+	struct bench_hist relock;
+	struct bench_perf_sum perf;	/* readers only */
+};
+
+static const struct rf_ops *rf_ops;
+static struct rf_reader *rf_readers;
+static struct rf_writer *rf_writers;
+static struct rf_result rf_results[ARRAY_SIZE(rf_ops_table)];
+static struct bench_ctl rf_ctl;
+static struct task_struct *rf_task;
+static DECLARE_COMPLETION(rf_all_done);
+static struct dentry *rf_dir;
+
+static int rf_reader_fn(void *arg)
+{
+	struct rf_reader *r = arg;
+	struct bench_perf perf;
+	unsigned long sink = 0;
+
+	bench_perf_open(&perf);
+	bench_gate(&rf_ctl);
+	bench_perf_start(&perf);
+	while (bench_running(&rf_ctl)) {
+		rf_ops->read_lock();
+		sink += READ_ONCE(rf_data);
+		bench_spin_ns(read_cs_ns);
+		rf_ops->read_unlock();
+		if (++r->reads % 64 == 0)
+			cond_resched();
+	}
+	barrier_data(&sink);
+	bench_perf_stop(&perf, &rf_ctl);
+	bench_done(&rf_ctl);
+	return 0;
+}
+
+static int rf_writer_fn(void *arg)
+{
+	struct rf_writer *w = arg;
+	u64 t0, t1;
+
+	bench_gate(&rf_ctl);
+	while (bench_running(&rf_ctl)) {
+		if (write_gap_us)
+			usleep_range(write_gap_us, write_gap_us + 1);
+
+		t0 = ktime_get_ns();
+		rf_ops->write_lock();
+		t1 = ktime_get_ns();
+		bench_hist_add(&w->acq, t1 - t0);
+		WRITE_ONCE(rf_data, rf_data + 1);
+		bench_spin_ns(write_cs_ns);
+
+		if (!rf_ops->downgrade) {
+			rf_ops->write_unlock();
+		} else {
+			/* hand over to a read hold, both ways in turn */
+			t0 = ktime_get_ns();
+			if (w->writes & 1) {
+				rf_ops->downgrade();
+				bench_hist_add(&w->downgrade, ktime_get_ns() - t0);
+			} else {
+				rf_ops->write_unlock();
+				rf_ops->read_lock();
+				bench_hist_add(&w->relock, ktime_get_ns() - t0);
+			}
+			bench_spin_ns(read_cs_ns);
+			rf_ops->read_unlock();
+		}
+		w->writes++;
+	}
+	bench_done(&rf_ctl);
+	return 0;
+}
+
+static void rf_stop_threads(void)
+{
+	int i;
+
+	for (i = 0; i < nreaders; i++)
+		if (!IS_ERR_OR_NULL(rf_readers[i].task))
+			kthread_stop(rf_readers[i].task);
+	for (i = 0; i < nwriters; i++)
+		if (!IS_ERR_OR_NULL(rf_writers[i].task))
+			kthread_stop(rf_writers[i].task);
+}
+
+static void rf_collect(struct rf_result *r)
+{
+	int i;
+
+	r->min_reads = U64_MAX;
+	for (i = 0; i < nreaders; i++) {
+		r->reads += rf_readers[i].reads;
+		r->min_reads = min(r->min_reads, rf_readers[i].reads);
+		r->max_reads = max(r->max_reads, rf_readers[i].reads);
+	}
+	bench_hist_init(&r->acq);
+	bench_hist_init(&r->downgrade);
+	bench_hist_init(&r->relock);
+	for (i = 0; i < nwriters; i++) {
+		r->writes += rf_writers[i].writes;
+		bench_hist_merge(&r->acq, &rf_writers[i].acq);
+		bench_hist_merge(&r->downgrade, &rf_writers[i].downgrade);
+		bench_hist_merge(&r->relock, &rf_writers[i].relock);
+	}
+}
+
+static int rf_run(int p)
+{
+	struct rf_result *r = &rf_results[p];
+	int i, ret = 0;
+
+	rf_ops = &rf_ops_table[p];
+	memset(rf_readers, 0, array_size(nreaders, sizeof(*rf_readers)));
+	memset(rf_writers, 0, array_size(nwriters, sizeof(*rf_writers)));
+	for (i = 0; i < nwriters; i++) {
+		bench_hist_init(&rf_writers[i].acq);
+		bench_hist_init(&rf_writers[i].downgrade);
+		bench_hist_init(&rf_writers[i].relock);
+	}
+
+	bench_ctl_init(&rf_ctl, nreaders + nwriters, duration_ms);
+	for (i = 0; i < nreaders; i++) {
+		rf_readers[i].task = bench_kthread_place(rf_reader_fn,
+						&rf_readers[i], "rwfair-r", i,
+						nwriters + i);
+		if (IS_ERR(rf_readers[i].task)) {
+			ret = PTR_ERR(rf_readers[i].task);
+			goto out;
+		}
+	}
+	for (i = 0; i < nwriters; i++) {
+		rf_writers[i].task = bench_kthread_place(rf_writer_fn,
+						&rf_writers[i], "rwfair-w", i, i);
+		if (IS_ERR(rf_writers[i].task)) {
+			ret = PTR_ERR(rf_writers[i].task);
+			goto out;
+		}
+	}
+
+	wait_for_completion(&rf_ctl.finished);
+	r->ns = bench_elapsed_ns(&rf_ctl);
+	rf_collect(r);
+	r->perf = rf_ctl.perf;
+	r->ran = true;
+out:
+	if (ret)
+		pr_err("%s: unable to start kernel thread\n", __func__);
+	rf_stop_threads();
+	bench_ctl_cleanup(&rf_ctl);
+	return ret;
+}
+
+static int rf_main(void *arg)
+{
+	int p;
+
+	for (p = 0; p < ARRAY_SIZE(rf_ops_table); p++) {
+		if (strcmp(prim, "all") && strcmp(prim, rf_ops_table[p].name))
+			continue;
+		if (kthread_should_stop() || rf_run(p))
+			break;
+	}
+	complete(&rf_all_done);
+	bench_park();
+	return 0;
+}
+
+static int rf_results_show(struct seq_file *m, void *v)
+{
+	int p;
+
+	if (!completion_done(&rf_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_printf(m, "readers %d writers %d read_cs_ns %d write_cs_ns %d write_gap_us %d\n",
+		   nreaders, nwriters, read_cs_ns, write_cs_ns, write_gap_us);
+	bench_placement_show(m);
+	for (p = 0; p < ARRAY_SIZE(rf_ops_table); p++) {
+		struct rf_result *r = &rf_results[p];
+
+		if (!r->ran)
+			continue;
+		seq_printf(m, "\n[%s]\n", rf_ops_table[p].name);
+		seq_printf(m, "reads/s %llu per-reader min %llu max %llu writes/s %llu\n",
+			   bench_rate(r->reads, r->ns), r->min_reads,
+			   r->max_reads, bench_rate(r->writes, r->ns));
+		seq_puts(m, "reader");
+		bench_perf_show(m, &r->perf, r->reads);
+		seq_putc(m, '\n');
+		bench_hist_show(m, "write_acq_ns", &r->acq);
+		if (rf_ops_table[p].downgrade) {
+			bench_hist_show(m, "downgrade_ns", &r->downgrade);
+			bench_hist_show(m, "up+down_read_ns", &r->relock);
+		}
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(rf_results);
+
+static void rf_free(void)
+{
+	vfree(rf_readers);
+	vfree(rf_writers);
+	percpu_free_rwsem(&rf_pcpu_rwsem);
+	bench_placement_free();
+}
+
+static int __init rf_init(void)
+{
+	int ret;
+
+	if (nreaders <= 0)
+		nreaders = num_online_cpus();
+	if (nwriters <= 0)
+		nwriters = 1;
+	if (write_gap_us < 0)
+		write_gap_us = 0;
+
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+	ret = percpu_init_rwsem(&rf_pcpu_rwsem);
+	if (ret) {
+		bench_placement_free();
+		return ret;
+	}
+	rf_readers = vzalloc(array_size(nreaders, sizeof(*rf_readers)));
+	rf_writers = vzalloc(array_size(nwriters, sizeof(*rf_writers)));
+	if (!rf_readers || !rf_writers) {
+		rf_free();
+		return -ENOMEM;
+	}
+
+	rf_task = kthread_run(rf_main, NULL, "rwfair");
+	if (IS_ERR(rf_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		rf_free();
+		return PTR_ERR(rf_task);
+	}
+
+	rf_dir = debugfs_create_dir("rwfair", NULL);
+	debugfs_create_file("results", 0444, rf_dir, NULL, &rf_results_fops);
+	return 0;
+}
+
+static void __exit rf_exit(void)
+{
+	debugfs_remove_recursive(rf_dir);
+	kthread_stop(rf_task);
+	rf_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(rf_init);
+module_exit(rf_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("reader/writer fairness: rwlock, rwsem, percpu_rwsem");
+MODULE_LICENSE("Dual MIT/GPL");
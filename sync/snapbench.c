@@ -0,0 +1,440 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Snapshot read benchmark
+ *
+ * Readers copy a two-word value {a, b} (priv_data of kthread_spin.c and
+ * kthread_mutex.c) while one writer stores a == b == generation every
+ * write_gap_us. The copy is protected by a spinlock, a mutex, a rwlock,
+ * or the lock-free SNAPSHOT_SEQ and SNAPSHOT_LATCH containers of
+ * snapshot.h, for a sweep of reader counts.
+ *
+ * With irq_us set, the latch runs also get an hrtimer that reads the
+ * snapshot from hard interrupt context every irq_us.
+ *
+ *   insmod snapbench.ko readers=4,16,64 irq_us=100
+ *   cat /sys/kernel/debug/snapbench/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/hrtimer.h>
+
+#include "bench.h"
+#include "snapshot.h"
+
+#define MODNAME "[SNAPBENCH] "
+
+#define SB_MAX_STEPS	16
+
+static char *prim = "all";
+module_param(prim, charp, 0444);
+MODULE_PARM_DESC(prim, "all, spinlock, mutex, rwlock, seqcount or latch");
+
+static int readers[SB_MAX_STEPS];
+static int nr_steps;
+module_param_array(readers, int, &nr_steps, 0444);
+MODULE_PARM_DESC(readers, "Reader counts to run (default 1, 2, 4, ... 4x online CPUs)");
+
+static int write_gap_us = 100;
+module_param(write_gap_us, int, 0444);
+MODULE_PARM_DESC(write_gap_us, "Time the writer sleeps between writes in us (0 = none)");
+
+static int irq_us;
+module_param(irq_us, int, 0444);
+MODULE_PARM_DESC(irq_us, "Period of the hardirq latch reader in us (0 = off)");
+
+static int duration_ms = 2000;
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Run length per primitive and reader count in ms");
+
+struct sb_pair {
+	u64 a;
+	u64 b;
+};
+
+static struct sb_pair sb_data;
+static DEFINE_SPINLOCK(sb_spin);
+static DEFINE_MUTEX(sb_mutex);
+static DEFINE_RWLOCK(sb_rwlock);
+static SNAPSHOT_SEQ(struct sb_pair) sb_seq;
+static SNAPSHOT_LATCH(struct sb_pair) sb_latch;
+
+/* Each read returns the retries it needed, 0 for the locks. */
+static unsigned int spin_read(struct sb_pair *v)
+{
+	spin_lock(&sb_spin);
+	*v = sb_data;
+	spin_unlock(&sb_spin);
+	return 0;
+}
+
+static void spin_write(const struct sb_pair *v)
+{
+	spin_lock(&sb_spin);
+	sb_data = *v;
+	spin_unlock(&sb_spin);
+}
+
+static unsigned int mutex_read(struct sb_pair *v)
+{
+	mutex_lock(&sb_mutex);
+	*v = sb_data;
+	mutex_unlock(&sb_mutex);
+	return 0;
+}
+
+static void mutex_write(const struct sb_pair *v)
+{
+	mutex_lock(&sb_mutex);
+	sb_data = *v;
+	mutex_unlock(&sb_mutex);
+}
+
+static unsigned int rwlock_read(struct sb_pair *v)
+{
+	read_lock(&sb_rwlock);
+	*v = sb_data;
+	read_unlock(&sb_rwlock);
+	return 0;
+}
+
+static void rwlock_write(const struct sb_pair *v)
+{
+	write_lock(&sb_rwlock);
+	sb_data = *v;
+	write_unlock(&sb_rwlock);
+}
+
+static unsigned int seqcount_read(struct sb_pair *v)
+{
+	return snapshot_seq_read(&sb_seq, v);
+}
+
+static void seqcount_write(const struct sb_pair *v)
+{
+	snapshot_seq_write(&sb_seq, v);
+}
+
+static unsigned int latch_read(struct sb_pair *v)
+{
+	return snapshot_latch_read(&sb_latch, v);
+}
+
+static void latch_write(const struct sb_pair *v)
+{
+	snapshot_latch_write(&sb_latch, v);
+}
+
+struct sb_ops {
+	const char *name;
+	unsigned int (*read)(struct sb_pair *v);
+	void (*write)(const struct sb_pair *v);
+	bool irq_safe;
+};
+
+static const struct sb_ops sb_ops_table[] = {
+	{ "spinlock",	spin_read,	spin_write,	false },
+	{ "mutex",	mutex_read,	mutex_write,	false },
+	{ "rwlock",	rwlock_read,	rwlock_write,	false },
+	{ "seqcount",	seqcount_read,	seqcount_write,	false },
+	{ "latch",	latch_read,	latch_write,	true },
+};
+
+struct sb_reader {
+	struct task_struct *task;
+	u64 reads;
+	u64 retries;
+	u64 torn;
+} ____cacheline_aligned_in_smp;
+
+struct sb_result {
+	bool ran;
+	u64 reads_per_sec;
+	u64 retries_milli;	/* retries per 1000 reads */
+	u64 torn;
+	u64 writes_per_sec;
+	u64 write_p99;
+	u64 irq_reads;
+	u64 irq_torn;
+	u64 reads;
+	struct bench_perf_sum perf;	/* readers only */
+};
+
+static const struct sb_ops *sb_ops;
+static struct sb_reader *sb_readers;
+static struct task_struct *sb_writer;
+static u64 sb_writes;
+static struct bench_hist sb_wlat;
+static struct hrtimer sb_irq_timer;
+static u64 sb_irq_reads;
+static u64 sb_irq_torn;
+static struct sb_result sb_results[ARRAY_SIZE(sb_ops_table)][SB_MAX_STEPS];
+static struct bench_ctl sb_ctl;
+static struct task_struct *sb_task;
+static DECLARE_COMPLETION(sb_all_done);
+static struct dentry *sb_dir;
+
+static int read_function(void *data)
+{
+	struct sb_reader *r = data;
+	struct bench_perf perf;
+	struct sb_pair v;
+
+	bench_perf_open(&perf);
+	bench_gate(&sb_ctl);
+	bench_perf_start(&perf);
+	while (bench_running(&sb_ctl)) {
+		r->retries += sb_ops->read(&v);
+		if (v.a != v.b)
+			r->torn++;
+		if (++r->reads % 64 == 0)
+			cond_resched();
+	}
+	bench_perf_stop(&perf, &sb_ctl);
+	bench_done(&sb_ctl);
+	return 0;
+}
+
+static int writer_function(void *data)
+{
+	struct sb_pair v = { 0, 0 };
+	u64 t0;
+
+	bench_gate(&sb_ctl);
+	while (bench_running(&sb_ctl)) {
+		v.a = v.b = v.a + 1;
+		t0 = ktime_get_ns();
+		sb_ops->write(&v);
+		bench_hist_add(&sb_wlat, ktime_get_ns() - t0);
+		sb_writes++;
+		if (write_gap_us)
+			usleep_range(write_gap_us, write_gap_us + 1);
+		else
+			cond_resched();
+	}
+	bench_done(&sb_ctl);
+	return 0;
+}
+
+static enum hrtimer_restart sb_irq_read(struct hrtimer *timer)
+{
+	struct sb_pair v;
+
+	sb_ops->read(&v);
+	if (v.a != v.b)
+		sb_irq_torn++;
+	sb_irq_reads++;
+	hrtimer_forward_now(timer, us_to_ktime(irq_us));
+	return HRTIMER_RESTART;
+}
+
+static int sb_run(int p, int step)
+{
+	struct sb_result *r = &sb_results[p][step];
+	bool irq = irq_us > 0 && sb_ops_table[p].irq_safe;
+	int n = readers[step];
+	u64 reads = 0, retries = 0, torn = 0, ns;
+	int i, ret = 0;
+
+	sb_ops = &sb_ops_table[p];
+	memset(sb_readers, 0, array_size(n, sizeof(*sb_readers)));
+	sb_writes = 0;
+	sb_irq_reads = 0;
+	sb_irq_torn = 0;
+	bench_hist_init(&sb_wlat);
+
+	bench_ctl_init(&sb_ctl, n + 1, duration_ms);
+	sb_writer = bench_kthread_place(writer_function, NULL, "snapbench-w",
+					0, 0);
+	if (IS_ERR(sb_writer)) {
+		ret = PTR_ERR(sb_writer);
+		sb_writer = NULL;
+		goto out;
+	}
+	for (i = 0; i < n; i++) {
+		sb_readers[i].task = bench_kthread_place(read_function,
+					&sb_readers[i], "snapbench-r", i, i + 1);
+		if (IS_ERR(sb_readers[i].task)) {
+			ret = PTR_ERR(sb_readers[i].task);
+			goto out;
+		}
+	}
+	if (irq)
+		hrtimer_start(&sb_irq_timer, us_to_ktime(irq_us),
+			      HRTIMER_MODE_REL);
+
+	wait_for_completion(&sb_ctl.finished);
+	if (irq)
+		hrtimer_cancel(&sb_irq_timer);
+	ns = bench_elapsed_ns(&sb_ctl);
+	for (i = 0; i < n; i++) {
+		reads += sb_readers[i].reads;
+		retries += sb_readers[i].retries;
+		torn += sb_readers[i].torn;
+	}
+	r->reads_per_sec = bench_rate(reads, ns);
+	r->retries_milli = bench_milli(retries, reads);
+	r->torn = torn;
+	r->writes_per_sec = bench_rate(sb_writes, ns);
+	r->write_p99 = bench_hist_pct(&sb_wlat, 990);
+	r->irq_reads = sb_irq_reads;
+	r->irq_torn = sb_irq_torn;
+	r->reads = reads;
+	r->perf = sb_ctl.perf;
+	r->ran = true;
+out:
+	if (ret)
+		pr_err("%s: unable to start kernel thread\n", __func__);
+	for (i = 0; i < n; i++)
+		if (!IS_ERR_OR_NULL(sb_readers[i].task))
+			kthread_stop(sb_readers[i].task);
+	if (sb_writer)
+		kthread_stop(sb_writer);
+	bench_ctl_cleanup(&sb_ctl);
+	return ret;
+}
+
+static int sb_main(void *arg)
+{
+	int p, s;
+
+	for (p = 0; p < ARRAY_SIZE(sb_ops_table); p++) {
+		if (strcmp(prim, "all") && strcmp(prim, sb_ops_table[p].name))
+			continue;
+		for (s = 0; s < nr_steps; s++)
+			if (kthread_should_stop() || sb_run(p, s))
+				goto out;
+	}
+out:
+	complete(&sb_all_done);
+	bench_park();
+	return 0;
+}
+
+static int sb_results_show(struct seq_file *m, void *v)
+{
+	int p, s;
+
+	if (!completion_done(&sb_all_done)) {
+		seq_puts(m, "running\n");
+		return 0;
+	}
+
+	seq_printf(m, "write_gap_us %d irq_us %d duration_ms %d\n",
+		   write_gap_us, irq_us, duration_ms);
+	bench_placement_show(m);
+	seq_printf(m, "%-8s %8s %14s %10s %6s %10s %14s %10s %8s\n", "prim",
+		   "readers", "reads/s", "retry/rd", "torn", "writes/s",
+		   "write_p99_ns", "irq_reads", "irq_torn");
+	for (p = 0; p < ARRAY_SIZE(sb_ops_table); p++) {
+		for (s = 0; s < nr_steps; s++) {
+			struct sb_result *r = &sb_results[p][s];
+
+			if (!r->ran)
+				continue;
+			seq_printf(m, "%-8s %8d %14llu " BENCH_MILLI_FMTW(6)
+				   " %6llu %10llu %14llu %10llu %8llu",
+				   sb_ops_table[p].name, readers[s],
+				   r->reads_per_sec,
+				   BENCH_MILLI_ARG(r->retries_milli), r->torn,
+				   r->writes_per_sec, r->write_p99,
+				   r->irq_reads, r->irq_torn);
+			bench_perf_show(m, &r->perf, r->reads);
+			seq_putc(m, '\n');
+		}
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(sb_results);
+
+static int __init sb_init(void)
+{
+	int i, ret, max_readers = 0;
+
+	if (!nr_steps) {
+		for (i = 1; i <= 4 * num_online_cpus() &&
+			    nr_steps < SB_MAX_STEPS; i *= 2)
+			readers[nr_steps++] = i;
+	}
+	for (i = 0; i < nr_steps; i++) {
+		readers[i] = max(readers[i], 1);
+		max_readers = max(max_readers, readers[i]);
+	}
+
+	snapshot_seq_init(&sb_seq);
+	snapshot_latch_init(&sb_latch);
+	hrtimer_init(&sb_irq_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sb_irq_timer.function = sb_irq_read;
+
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+	sb_readers = vzalloc(array_size(max_readers, sizeof(*sb_readers)));
+	if (!sb_readers) {
+		bench_placement_free();
+		return -ENOMEM;
+	}
+
+	sb_task = kthread_run(sb_main, NULL, "snapbench");
+	if (IS_ERR(sb_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		vfree(sb_readers);
+		bench_placement_free();
+		return PTR_ERR(sb_task);
+	}
+
+	sb_dir = debugfs_create_dir("snapbench", NULL);
+	debugfs_create_file("results", 0444, sb_dir, NULL, &sb_results_fops);
+	return 0;
+}
+
+static void __exit sb_exit(void)
+{
+	debugfs_remove_recursive(sb_dir);
+	kthread_stop(sb_task);
+	vfree(sb_readers);
+	bench_placement_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(sb_init);
+module_exit(sb_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("lock-free snapshot readers vs spinlock, mutex and rwlock");
+MODULE_LICENSE("Dual MIT/GPL");
@@ -0,0 +1,140 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Multi-word snapshots with lock-free readers.
+ *
+ * priv_data {a, b} in kthread_spin.c and kthread_mutex.c can be read
+ * torn unless the reader takes the writer's lock. The containers here
+ * let readers copy a consistent value of any type without writing to
+ * shared memory; writers serialise on a spinlock.
+ *
+ *   SNAPSHOT_SEQ(type)		one copy guarded by a seqcount. A reader
+ *				that overlaps a write retries. Readers must
+ *				not interrupt a writer on the same CPU (they
+ *				would spin forever), so no IRQ/NMI readers
+ *				unless writers disable interrupts.
+ *   SNAPSHOT_LATCH(type)	two copies and a latch seqcount. Writers
+ *				update one copy while readers use the other,
+ *				so a reader never waits for a writer and can
+ *				run in IRQ or NMI context, even on the CPU
+ *				of an interrupted writer. Costs twice the
+ *				memory and two copies per write.
+ *
+ * Read helpers return the number of retries the read needed.
+ *
+ * Usage:
+ *	static SNAPSHOT_LATCH(struct { int a; int b; }) snap;
+ *	typeof(snap.data[0]) v = { 10, 20 };
+ *
+ *	snapshot_latch_init(&snap);
+ *	snapshot_latch_write(&snap, &v);
+ *	snapshot_latch_read(&snap, &v);
+ */
+#ifndef _SYNC_SNAPSHOT_H
+#define _SYNC_SNAPSHOT_H
+
+#include <linux/kernel.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock.h>
+
+#define SNAPSHOT_SEQ(type)					\
+	struct {						\
+		spinlock_t lock;				\
+		seqcount_spinlock_t seq;			\
+		type data;					\
+	}
+
+#define snapshot_seq_init(s)					\
+	do {							\
+		spin_lock_init(&(s)->lock);			\
+		seqcount_spinlock_init(&(s)->seq, &(s)->lock);	\
+	} while (0)
+
+#define snapshot_seq_read(s, dst)				\
+({								\
+	unsigned int __seq, __retries = 0;			\
+								\
+	for (;;) {						\
+		__seq = read_seqcount_begin(&(s)->seq);		\
+		*(dst) = (s)->data;				\
+		if (!read_seqcount_retry(&(s)->seq, __seq))	\
+			break;					\
+		__retries++;					\
+	}							\
+	__retries;						\
+})
+
+#define snapshot_seq_write(s, src)				\
+	do {							\
+		spin_lock(&(s)->lock);				\
+		write_seqcount_begin(&(s)->seq);		\
+		(s)->data = *(src);				\
+		write_seqcount_end(&(s)->seq);			\
+		spin_unlock(&(s)->lock);			\
+	} while (0)
+
+#define SNAPSHOT_LATCH(type)					\
+	struct {						\
+		spinlock_t lock;				\
+		seqcount_latch_t seq;				\
+		type data[2];					\
+	}
+
+#define snapshot_latch_init(s)					\
+	do {							\
+		spin_lock_init(&(s)->lock);			\
+		seqcount_latch_init(&(s)->seq);			\
+	} while (0)
+
+/* the low bit of the count selects the copy no writer is touching */
+#define snapshot_latch_read(s, dst)				\
+({								\
+	unsigned int __seq, __retries = 0;			\
+								\
+	for (;;) {						\
+		__seq = raw_read_seqcount_latch(&(s)->seq);	\
+		*(dst) = (s)->data[__seq & 1];			\
+		if (!raw_read_seqcount_latch_retry(&(s)->seq, __seq)) \
+			break;					\
+		__retries++;					\
+	}							\
+	__retries;						\
+})
+
+#define snapshot_latch_write(s, src)				\
+	do {							\
+		spin_lock(&(s)->lock);				\
+		raw_write_seqcount_latch(&(s)->seq);		\
+		(s)->data[0] = *(src);				\
+		raw_write_seqcount_latch(&(s)->seq);		\
+		(s)->data[1] = *(src);				\
+		spin_unlock(&(s)->lock);			\
+	} while (0)
+
+#endif /* _SYNC_SNAPSHOT_H */
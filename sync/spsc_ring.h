@@ -0,0 +1,133 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Lock-free single-producer/single-consumer ring of pointers.
+ *
+ * The producer owns head, the consumer owns tail; each lives on its own
+ * cache line together with a cached copy of the other side's index, so
+ * in steady state each side only touches the other's line when its
+ * cached view runs out. Both sides move items in batches.
+ *
+ * Exactly one thread may call spsc_ring_push() and exactly one other
+ * thread spsc_ring_pop(); no locking is needed between them.
+ */
+#ifndef _SYNC_SPSC_RING_H
+#define _SYNC_SPSC_RING_H
+
+#include <linux/kernel.h>
+#include <linux/cache.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <asm/barrier.h>
+
+struct spsc_ring {
+	unsigned int mask;
+	void **slots;
+
+	/* producer */
+	unsigned int head ____cacheline_aligned_in_smp;
+	unsigned int cached_tail;
+
+	/* consumer */
+	unsigned int tail ____cacheline_aligned_in_smp;
+	unsigned int cached_head;
+};
+
+/* @size is rounded up to a power of two */
+static inline int spsc_ring_init(struct spsc_ring *r, unsigned int size)
+{
+	size = roundup_pow_of_two(max(size, 2U));
+	r->slots = kcalloc(size, sizeof(*r->slots), GFP_KERNEL);
+	if (!r->slots)
+		return -ENOMEM;
+	r->mask = size - 1;
+	r->head = r->cached_tail = 0;
+	r->tail = r->cached_head = 0;
+	return 0;
+}
+
+static inline void spsc_ring_free(struct spsc_ring *r)
+{
+	kfree(r->slots);
+	r->slots = NULL;
+}
+
+/* Producer: enqueue up to @n items, returns how many were queued. */
+static inline unsigned int spsc_ring_push(struct spsc_ring *r,
+					  void * const *items, unsigned int n)
+{
+	unsigned int head = r->head;
+	unsigned int space = r->mask + 1 - (head - r->cached_tail);
+	unsigned int i;
+
+	if (space < n) {
+		/* pairs with the release in spsc_ring_pop() */
+		r->cached_tail = smp_load_acquire(&r->tail);
+		space = r->mask + 1 - (head - r->cached_tail);
+		n = min(n, space);
+	}
+	for (i = 0; i < n; i++)
+		r->slots[(head + i) & r->mask] = items[i];
+	smp_store_release(&r->head, head + n);
+	return n;
+}
+
+/* Consumer: dequeue up to @n items, returns how many were taken. */
+static inline unsigned int spsc_ring_pop(struct spsc_ring *r, void **items,
+					 unsigned int n)
+{
+	unsigned int tail = r->tail;
+	unsigned int avail = r->cached_head - tail;
+	unsigned int i;
+
+	if (avail < n) {
+		/* pairs with the release in spsc_ring_push() */
+		r->cached_head = smp_load_acquire(&r->head);
+		avail = r->cached_head - tail;
+		n = min(n, avail);
+	}
+	for (i = 0; i < n; i++)
+		items[i] = r->slots[(tail + i) & r->mask];
+	smp_store_release(&r->tail, tail + n);
+	return n;
+}
+
+/* Consumer side: nothing left to pop. */
+static inline bool spsc_ring_empty(struct spsc_ring *r)
+{
+	return smp_load_acquire(&r->head) == r->tail;
+}
+
+/* Producer side: no room to push. */
+static inline bool spsc_ring_full(struct spsc_ring *r)
+{
+	return r->head - smp_load_acquire(&r->tail) > r->mask;
+}
+
+#endif /* _SYNC_SPSC_RING_H */
@@ -0,0 +1,217 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Statistics counters with a selectable implementation.
+ *
+ * kthread_counter.c loses updates on a plain int and kthread_atomic.c
+ * fixes that with one atomic_t; both put every increment on the same
+ * cache line. stat_counter hides the choice of design behind one API so
+ * hot paths can switch and measure:
+ *
+ *   STAT_ATOMIC		one atomic_t, exact and cheap to read
+ *   STAT_ATOMIC64		one atomic64_t
+ *   STAT_PERCPU_COUNTER	percpu_counter, folds into the global count
+ *				every @batch increments per CPU
+ *   STAT_LOCAL			per-CPU local_t, summed on read
+ *   STAT_SLOTS			array of cache-line padded per-CPU slots,
+ *				local_t adds, summed lazily on read
+ *
+ * Usage:
+ *	struct stat_counter c;
+ *
+ *	stat_counter_init(&c, STAT_SLOTS, 0);
+ *	stat_counter_inc(&c);
+ *	pr_info("%lld\n", stat_counter_read(&c));
+ *	stat_counter_destroy(&c);
+ */
+#ifndef _SYNC_STAT_COUNTER_H
+#define _SYNC_STAT_COUNTER_H
+
+#include <linux/kernel.h>
+#include <linux/atomic.h>
+#include <linux/percpu.h>
+#include <linux/percpu_counter.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <asm/local.h>
+
+enum stat_counter_type {
+	STAT_ATOMIC,
+	STAT_ATOMIC64,
+	STAT_PERCPU_COUNTER,
+	STAT_LOCAL,
+	STAT_SLOTS,
+	STAT_NR_TYPES,
+};
+
+static const char * const stat_counter_names[STAT_NR_TYPES] = {
+	[STAT_ATOMIC]		= "atomic",
+	[STAT_ATOMIC64]		= "atomic64",
+	[STAT_PERCPU_COUNTER]	= "percpu_counter",
+	[STAT_LOCAL]		= "local",
+	[STAT_SLOTS]		= "slots",
+};
+
+struct stat_slot {
+	local_t v;
+} ____cacheline_aligned_in_smp;
+
+struct stat_counter {
+	enum stat_counter_type type;
+	s32 batch;
+	union {
+		atomic_t at;
+		atomic64_t at64;
+		struct percpu_counter pc;
+		local_t __percpu *lc;
+		struct stat_slot *slots;	/* nr_cpu_ids entries */
+	};
+};
+
+/* @batch only matters for STAT_PERCPU_COUNTER, 0 = percpu_counter_batch */
+static inline int stat_counter_init(struct stat_counter *c,
+				    enum stat_counter_type type, s32 batch)
+{
+	c->type = type;
+	c->batch = batch > 0 ? batch : percpu_counter_batch;
+
+	switch (type) {
+	case STAT_ATOMIC:
+		atomic_set(&c->at, 0);
+		return 0;
+	case STAT_ATOMIC64:
+		atomic64_set(&c->at64, 0);
+		return 0;
+	case STAT_PERCPU_COUNTER:
+		return percpu_counter_init(&c->pc, 0, GFP_KERNEL);
+	case STAT_LOCAL:
+		c->lc = alloc_percpu(local_t);
+		return c->lc ? 0 : -ENOMEM;
+	case STAT_SLOTS:
+		c->slots = kcalloc(nr_cpu_ids, sizeof(*c->slots), GFP_KERNEL);
+		return c->slots ? 0 : -ENOMEM;
+	default:
+		return -EINVAL;
+	}
+}
+
+static inline void stat_counter_destroy(struct stat_counter *c)
+{
+	switch (c->type) {
+	case STAT_PERCPU_COUNTER:
+		percpu_counter_destroy(&c->pc);
+		break;
+	case STAT_LOCAL:
+		free_percpu(c->lc);
+		break;
+	case STAT_SLOTS:
+		kfree(c->slots);
+		break;
+	default:
+		break;
+	}
+}
+
+static inline void stat_counter_add(struct stat_counter *c, long v)
+{
+	struct stat_slot *slot;
+
+	switch (c->type) {
+	case STAT_ATOMIC:
+		atomic_add(v, &c->at);
+		break;
+	case STAT_ATOMIC64:
+		atomic64_add(v, &c->at64);
+		break;
+	case STAT_PERCPU_COUNTER:
+		percpu_counter_add_batch(&c->pc, v, c->batch);
+		break;
+	case STAT_LOCAL:
+		local_add(v, get_cpu_ptr(c->lc));
+		put_cpu_ptr(c->lc);
+		break;
+	case STAT_SLOTS:
+		/*
+		 * Only this CPU writes its slot, but an IRQ adding between
+		 * a plain load and store would be lost. local_add() is one
+		 * unlocked instruction on x86.
+		 */
+		slot = &c->slots[get_cpu()];
+		local_add(v, &slot->v);
+		put_cpu();
+		break;
+	default:
+		break;
+	}
+}
+
+static inline void stat_counter_inc(struct stat_counter *c)
+{
+	stat_counter_add(c, 1);
+}
+
+/* exact value; for the per-CPU designs this walks every CPU */
+static inline s64 stat_counter_read(struct stat_counter *c)
+{
+	s64 sum = 0;
+	int cpu;
+
+	switch (c->type) {
+	case STAT_ATOMIC:
+		return atomic_read(&c->at);
+	case STAT_ATOMIC64:
+		return atomic64_read(&c->at64);
+	case STAT_PERCPU_COUNTER:
+		return percpu_counter_sum(&c->pc);
+	case STAT_LOCAL:
+		for_each_possible_cpu(cpu)
+			sum += local_read(per_cpu_ptr(c->lc, cpu));
+		return sum;
+	case STAT_SLOTS:
+		for_each_possible_cpu(cpu)
+			sum += local_read(&c->slots[cpu].v);
+		return sum;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Cheap, possibly stale value. Only percpu_counter differs from
+ * stat_counter_read(): it returns the folded count, which may be off by
+ * up to batch * num_online_cpus().
+ */
+static inline s64 stat_counter_read_fast(struct stat_counter *c)
+{
+	if (c->type == STAT_PERCPU_COUNTER)
+		return percpu_counter_read(&c->pc);
+	return stat_counter_read(c);
+}
+
+#endif /* _SYNC_STAT_COUNTER_H */
@@ -0,0 +1,493 @@
+/*
+ * ******************************************************************************
+ * This program is part of the source code provided with "Linux Kernel Programming"
+ * (C) 2022  Samir Mulani
+ *
+ * Git repository:
+ * https://github.com/SamirMulani/Linux_Kernel_Base
+ * ******************************************************************************
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ *
+ */
+
+/*
+ * Wakeup latency of the hand-off primitives
+ *
+ * kthread_sync_waitq.c, kthread_compl.c and kthread_sync.c hand work over
+ * with a waitqueue, a completion and a semaphore, padded with mdelay()
+ * and msleep() so the wakeup itself never shows. This module measures
+ * just that, cyclictest style: every interval_us the waker stamps the
+ * time immediately before wake_up()/swake_up_one()/complete()/up(), and
+ * the sleeping wakee stamps again as soon as its wait returns. The
+ * difference goes into a histogram per primitive and placement:
+ *
+ *   same	waker and wakee pinned to cpu_a
+ *   cross	waker on cpu_a, wakee on cpu_b
+ *
+ * Iterations where the wakee had not actually gone to sleep are counted
+ * as "awake" and left out of the histogram.
+ *
+ * With sched= other than normal (rtsched.h) every run is repeated with
+ * waker and wakee in that class, and hog=1 keeps a SCHED_NORMAL busy
+ * loop on every online CPU meanwhile, so the two show what an RT class
+ * buys against background load. SCHED_DEADLINE threads cannot be pinned;
+ * its runs leave both threads to the scheduler and are labelled "any".
+ *
+ *   insmod wakelat.ko cpu_a=2 cpu_b=3 loops=20000
+ *   cat /sys/kernel/debug/wakelat/results
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/wait.h>
+#include <linux/swait.h>
+#include <linux/completion.h>
+#include <linux/semaphore.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/debugfs.h>
+
+#include "bench.h"
+#include "rtsched.h"
+
+#define MODNAME "[WAKELAT] "
+
+static char *mech = "all";
+module_param(mech, charp, 0444);
+MODULE_PARM_DESC(mech, "all, waitq, swait, completion or semaphore");
+
+static int loops = 10000;
+module_param(loops, int, 0444);
+MODULE_PARM_DESC(loops, "Wakeups measured per primitive and placement");
+
+static int interval_us = 100;
+module_param(interval_us, int, 0444);
+MODULE_PARM_DESC(interval_us, "Time between wakeups in us");
+
+static int cpu_a = -1;
+module_param(cpu_a, int, 0444);
+MODULE_PARM_DESC(cpu_a, "Waker CPU (-1 = placement= slot 0, else first online CPU)");
+
+static int cpu_b = -1;
+module_param(cpu_b, int, 0444);
+MODULE_PARM_DESC(cpu_b, "Wakee CPU for the cross placement (-1 = placement= slot 1, else second online CPU)");
+
+static bool hog;
+module_param(hog, bool, 0444);
+MODULE_PARM_DESC(hog, "Run a SCHED_NORMAL busy loop on every online CPU during the runs");
+
+enum {
+	WL_WAITQ,
+	WL_SWAIT,
+	WL_COMPLETION,
+	WL_SEMAPHORE,
+	WL_NR_MECHS,
+};
+
+static const char * const wl_mech_names[WL_NR_MECHS] = {
+	[WL_WAITQ]	= "waitq",
+	[WL_SWAIT]	= "swait",
+	[WL_COMPLETION]	= "completion",
+	[WL_SEMAPHORE]	= "semaphore",
+};
+
+enum {
+	WL_SAME,
+	WL_CROSS,
+	WL_ANY,			/* unpinned, for SCHED_DEADLINE */
+	WL_NR_PLACEMENTS,
+};
+
+static const char * const wl_place_names[WL_NR_PLACEMENTS] = {
+	[WL_SAME]	= "same",
+	[WL_CROSS]	= "cross",
+	[WL_ANY]	= "any",
+};
+
+enum {
+	WL_NORMAL,		/* SCHED_NORMAL */
+	WL_RT,			/* the class given by sched= */
+	WL_NR_CLASSES,
+};
+
+struct wl_result {
+	bool ran;
+	int err;
+	u64 awake;
+	struct bench_hist lat;
+	struct bench_perf_sum perf;	/* wakee */
+};
+
+static struct wl_result wl_results[WL_NR_MECHS][WL_NR_PLACEMENTS][WL_NR_CLASSES];
+
+static int wl_mech;
+static int wl_waiting;		/* wakee is about to block */
+static int wl_flag;		/* condition for waitq and swait */
+static u64 wl_stamp;		/* waker's timestamp for this round */
+static int wl_abort;		/* threads could not be given their class */
+
+static DECLARE_WAIT_QUEUE_HEAD(wl_wq);
+static DECLARE_SWAIT_QUEUE_HEAD(wl_swq);
+static DECLARE_COMPLETION(wl_comp);
+static struct semaphore wl_sem;
+
+static DECLARE_COMPLETION(wl_run_go);
+static DECLARE_COMPLETION(wl_run_done);
+static DECLARE_COMPLETION(wl_all_done);
+static struct task_struct *wl_task;
+static struct task_struct **wl_hogs;
+static struct dentry *wl_dir;
+
+static void wl_wait(void)
+{
+	switch (wl_mech) {
+	case WL_WAITQ:
+		wait_event(wl_wq, READ_ONCE(wl_flag));
+		WRITE_ONCE(wl_flag, 0);
+		break;
+	case WL_SWAIT:
+		swait_event_exclusive(wl_swq, READ_ONCE(wl_flag));
+		WRITE_ONCE(wl_flag, 0);
+		break;
+	case WL_COMPLETION:
+		wait_for_completion(&wl_comp);
+		break;
+	case WL_SEMAPHORE:
+		down(&wl_sem);
+		break;
+	}
+}
+
+static void wl_wake(void)
+{
+	switch (wl_mech) {
+	case WL_WAITQ:
+		WRITE_ONCE(wl_flag, 1);
+		wake_up(&wl_wq);
+		break;
+	case WL_SWAIT:
+		WRITE_ONCE(wl_flag, 1);
+		swake_up_one(&wl_swq);
+		break;
+	case WL_COMPLETION:
+		complete(&wl_comp);
+		break;
+	case WL_SEMAPHORE:
+		up(&wl_sem);
+		break;
+	}
+}
+
+static int wl_wakee(void *arg)
+{
+	struct wl_result *r = arg;
+	struct bench_perf perf;
+	u64 now, cs;
+	int i;
+
+	bench_perf_open(&perf);
+	wait_for_completion(&wl_run_go);
+	bench_perf_start(&perf);
+	for (i = 0; i < loops && !READ_ONCE(wl_abort); i++) {
+		cs = bench_ctxsw();
+		smp_store_release(&wl_waiting, 1);
+		wl_wait();
+		now = ktime_get_ns();
+		if (bench_ctxsw() == cs)
+			r->awake++;
+		else
+			bench_hist_add(&r->lat, now - READ_ONCE(wl_stamp));
+	}
+	bench_perf_stop_sum(&perf, &r->perf, NULL);
+	complete(&wl_run_done);
+	bench_park();
+	return 0;
+}
+
+static int wl_waker(void *arg)
+{
+	int i;
+
+	wait_for_completion(&wl_run_go);
+	for (i = 0; i < loops && !READ_ONCE(wl_abort); i++) {
+		usleep_range(interval_us, interval_us + 1);
+		while (!smp_load_acquire(&wl_waiting)) {
+			if (kthread_should_stop())
+				return 0;
+			usleep_range(1, 2);
+		}
+		WRITE_ONCE(wl_waiting, 0);
+		WRITE_ONCE(wl_stamp, ktime_get_ns());
+		wl_wake();
+	}
+	bench_park();
+	return 0;
+}
+
+static int wl_hog_fn(void *arg)
+{
+	u64 end;
+
+	while (!kthread_should_stop()) {
+		end = ktime_get_ns() + NSEC_PER_MSEC;
+		while (ktime_get_ns() < end)
+			cpu_relax();
+		cond_resched();
+	}
+	return 0;
+}
+
+static int wl_hogs_start(void)
+{
+	struct task_struct *t;
+	int cpu;
+
+	wl_hogs = kcalloc(nr_cpu_ids, sizeof(*wl_hogs), GFP_KERNEL);
+	if (!wl_hogs)
+		return -ENOMEM;
+	for_each_online_cpu(cpu) {
+		t = bench_kthread_run_on_cpu(wl_hog_fn, NULL, "wakelat-hog",
+					     cpu, cpu);
+		if (IS_ERR(t)) {
+			pr_err("%s: unable to start kernel thread\n", __func__);
+			return PTR_ERR(t);
+		}
+		wl_hogs[cpu] = t;
+	}
+	return 0;
+}
+
+static void wl_hogs_stop(void)
+{
+	int cpu;
+
+	if (!wl_hogs)
+		return;
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++)
+		if (wl_hogs[cpu])
+			kthread_stop(wl_hogs[cpu]);
+	kfree(wl_hogs);
+	wl_hogs = NULL;
+}
+
+static struct task_struct *wl_start(int (*fn)(void *), void *data,
+				    const char *name, int p, int cpu)
+{
+	if (p == WL_ANY)
+		return kthread_run(fn, data, "%s/%d", name, 0);
+	return bench_kthread_run_on_cpu(fn, data, name, 0, cpu);
+}
+
+static int wl_run(int m, int p, int c)
+{
+	struct wl_result *r = &wl_results[m][p][c];
+	struct task_struct *wakee, *waker;
+	int wakee_cpu = p == WL_SAME ? cpu_a : cpu_b;
+
+	wl_mech = m;
+	wl_waiting = 0;
+	wl_flag = 0;
+	reinit_completion(&wl_comp);
+	reinit_completion(&wl_run_go);
+	reinit_completion(&wl_run_done);
+	sema_init(&wl_sem, 0);
+	bench_hist_init(&r->lat);
+	memset(&r->perf, 0, sizeof(r->perf));
+	r->awake = 0;
+	r->err = 0;
+
+	/* both wait for wl_run_go, so they start in their final class */
+	waker = wl_start(wl_waker, NULL, "wakelat-waker", p, cpu_a);
+	if (IS_ERR(waker))
+		goto fail;
+	wakee = wl_start(wl_wakee, r, "wakelat-wakee", p, wakee_cpu);
+	if (IS_ERR(wakee)) {
+		WRITE_ONCE(wl_abort, 1);
+		complete_all(&wl_run_go);
+		kthread_stop(waker);
+		goto fail;
+	}
+
+	if (c == WL_RT) {
+		r->err = rtsched_apply(waker);
+		if (!r->err)
+			r->err = rtsched_apply(wakee);
+	}
+	WRITE_ONCE(wl_abort, r->err);
+	complete_all(&wl_run_go);
+
+	wait_for_completion(&wl_run_done);
+	kthread_stop(waker);
+	kthread_stop(wakee);
+	r->ran = true;
+	return 0;
+fail:
+	pr_err("%s: unable to start kernel thread\n", __func__);
+	return -ENOMEM;
+}
+
+static int wl_main(void *arg)
+{
+	int nr_classes = rtsched_policy == RTSCHED_NORMAL ? 1 : WL_NR_CLASSES;
+	int m, p, c;
+
+	if (hog && wl_hogs_start())
+		goto out;
+
+	for (m = 0; m < WL_NR_MECHS; m++) {
+		if (strcmp(mech, "all") && strcmp(mech, wl_mech_names[m]))
+			continue;
+		for (c = 0; c < nr_classes; c++) {
+			for (p = 0; p < WL_NR_PLACEMENTS; p++) {
+				bool any = c == WL_RT &&
+					   rtsched_policy == RTSCHED_DEADLINE;
+
+				if (any != (p == WL_ANY))
+					continue;
+				if (p == WL_CROSS && cpu_b == cpu_a)
+					continue;
+				if (kthread_should_stop() || wl_run(m, p, c))
+					goto out;
+			}
+		}
+	}
+out:
+	wl_hogs_stop();
+	complete(&wl_all_done);
+	bench_park();
+	return 0;
+}
+
+static int wl_results_show(struct seq_file *s, void *v)
+{
+	char label[40];
+	int m, p, c;
+
+	if (!completion_done(&wl_all_done)) {
+		seq_puts(s, "running\n");
+		return 0;
+	}
+
+	seq_printf(s, "cpu_a %d cpu_b %d loops %d interval_us %d sched %s hog %d\n",
+		   cpu_a, cpu_b, loops, interval_us,
+		   rtsched_names[rtsched_policy], hog);
+	if (rtsched_policy == RTSCHED_DEADLINE)
+		seq_printf(s, "dl_runtime_us %u dl_deadline_us %u dl_period_us %u\n",
+			   dl_runtime_us, dl_deadline_us, dl_period_us);
+	bench_placement_show(s);
+	for (m = 0; m < WL_NR_MECHS; m++) {
+		for (c = 0; c < WL_NR_CLASSES; c++) {
+			for (p = 0; p < WL_NR_PLACEMENTS; p++) {
+				struct wl_result *r = &wl_results[m][p][c];
+
+				if (!r->ran)
+					continue;
+				snprintf(label, sizeof(label), "%s/%s/%s",
+					 wl_mech_names[m], wl_place_names[p],
+					 c == WL_RT ?
+					 rtsched_names[rtsched_policy] : "normal");
+				if (r->err) {
+					seq_printf(s, "%-16s failed (%d)\n", label,
+						   r->err);
+					continue;
+				}
+				bench_hist_show(s, label, &r->lat);
+				if (r->awake)
+					seq_printf(s, "%-16s awake=%llu\n", "",
+						   r->awake);
+				if (perf) {
+					seq_printf(s, "%-16s wakee", "");
+					bench_perf_show(s, &r->perf,
+							r->awake + r->lat.count);
+					seq_putc(s, '\n');
+				}
+			}
+		}
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(wl_results);
+
+static bool wl_cpu_ok(int cpu)
+{
+	return cpu >= 0 && cpu < nr_cpu_ids && cpu_online(cpu);
+}
+
+static int __init wl_init(void)
+{
+	int cpu, ret;
+
+	ret = rtsched_init();
+	if (ret)
+		return ret;
+	ret = bench_placement_init();
+	if (ret)
+		return ret;
+
+	/* unset CPUs come from placement= slots 0 and 1, if it pins */
+	if (!wl_cpu_ok(cpu_a))
+		cpu_a = bench_place_cpu(0);
+	if (!wl_cpu_ok(cpu_a))
+		cpu_a = bench_nth_online_cpu(0);
+	if (!wl_cpu_ok(cpu_b) && bench_place_cpu(1) != cpu_a)
+		cpu_b = bench_place_cpu(1);
+	if (!wl_cpu_ok(cpu_b)) {
+		cpu_b = cpu_a;
+		for_each_online_cpu(cpu) {
+			if (cpu != cpu_a) {
+				cpu_b = cpu;
+				break;
+			}
+		}
+	}
+	if (loops <= 0)
+		loops = 1;
+	if (interval_us <= 0)
+		interval_us = 1;
+
+	wl_task = kthread_run(wl_main, NULL, "wakelat");
+	if (IS_ERR(wl_task)) {
+		pr_err("%s: unable to start kernel thread\n", __func__);
+		bench_placement_free();
+		return PTR_ERR(wl_task);
+	}
+
+	wl_dir = debugfs_create_dir("wakelat", NULL);
+	debugfs_create_file("results", 0444, wl_dir, NULL, &wl_results_fops);
+	return 0;
+}
+
+static void __exit wl_exit(void)
+{
+	debugfs_remove_recursive(wl_dir);
+	kthread_stop(wl_task);
+	bench_placement_free();
+	pr_info(MODNAME "Exiting module.\n");
+}
+
+module_init(wl_init);
+module_exit(wl_exit);
+
+MODULE_AUTHOR("Samir Mulani");
+MODULE_DESCRIPTION("wakeup latency of waitqueue, swait, completion and semaphore");
+MODULE_LICENSE("Dual MIT/GPL");